@@ -0,0 +1,9 @@
+#include "crimson_alignment_kernel.hpp"
+
+namespace crimson {
+namespace kernel {
+
+void FillAvx2(DiagonalFill &fill) { Fill<kAvx2Bytes>(fill); }
+
+} // namespace kernel
+} // namespace crimson
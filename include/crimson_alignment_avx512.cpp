@@ -0,0 +1,9 @@
+#include "crimson_alignment_kernel.hpp"
+
+namespace crimson {
+namespace kernel {
+
+void FillAvx512(DiagonalFill &fill) { Fill<kAvx512Bytes>(fill); }
+
+} // namespace kernel
+} // namespace crimson
@@ -1,154 +1,1222 @@
 #include "crimson_alignment_engine.hpp"
+#include "crimson_alignment_kernel.hpp"
 #include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace crimson {
 
-int Align(const char *query, unsigned int query_len, const char *target,
-          unsigned int target_len, AlignmentType type, int match, int mismatch,
-          int gap, std::string *cigar, unsigned int *target_begin, int gap_open,
-          int gap_extend) {
+namespace {
 
-  // TODO implement semiglobal alignment
+using uint = unsigned int;
 
-  using std::string;
-  using std::vector;
-  using uint = unsigned int;
+// Traceback matrices of alignments up to this many cells are kept whole,
+// larger alignments recompute them in blocks of rows
+constexpr size_t kMaxTraceCells = size_t(1) << 26;
 
-  bool isAffineGap = gap_open != 0 && gap_extend != 0;
-  bool needsCigar = cigar != nullptr && target_begin != nullptr;
+// Score of cells outside of a band and of unreachable gap states, low enough
+// not to overflow when gaps are added to it
+constexpr int kNegative = -(1 << 29);
 
-  vector<vector<int>> dp(query_len + 1, vector<int>(target_len + 1));
-  vector<vector<int>> dpD(query_len + 1, vector<int>(target_len + 1));
-  vector<vector<int>> dpI(query_len + 1, vector<int>(target_len + 1));
-  vector<vector<char>> prev(query_len + 1, vector<char>(target_len + 1));
+using kernel::GapScore;
+using kernel::kAffineGaps;
+using kernel::kDualGaps;
+using kernel::kExtendsD;
+using kernel::kExtendsD2;
+using kernel::kExtendsI;
+using kernel::kExtendsI2;
+using kernel::kFromD;
+using kernel::kFromD2;
+using kernel::kFromI;
+using kernel::kFromI2;
+using kernel::kFromM;
+using kernel::kLinearGaps;
+using kernel::kSourceBits;
+using kernel::kStop;
+using kernel::Scoring;
 
-  for (uint i = 1; i <= query_len; i++) {
-    if (type == AlignmentType::local) {
-      dp[i][0] = 0;
+// Gaps are affine if either of their scores is set, and dual affine if the
+// second pair is set as well
+Scoring MakeScoring(AlignmentType type, int match, int mismatch, int gap,
+                    int gap_open, int gap_extend, int gap_open2,
+                    int gap_extend2) {
+  const bool isAffineGap = gap_open != 0 || gap_extend != 0;
+  return {type,        match,       mismatch,
+          gap,         gap_open,    gap_extend,
+          gap_open2,   gap_extend2, isAffineGap,
+          isAffineGap && (gap_open2 != 0 || gap_extend2 != 0)};
+}
+
+// Score of each base of long gaps, which Z-drops allow for
+int GapExtendScore(const Scoring &s) {
+  if (s.isDualGap)
+    return std::min(std::abs(s.gap_extend), std::abs(s.gap_extend2));
+  if (s.isAffineGap)
+    return std::abs(s.gap_extend);
+  return std::abs(s.gap);
+}
+
+// Row of the score matrices, the best scores H and those of the vertical gap
+// states which the next row extends. Horizontal gaps only depend on the row
+// itself. Gap states the scoring has no use for are left empty.
+struct Row {
+  std::vector<int> H;
+  std::vector<int> I;
+  std::vector<int> I2;
+
+  // Sizes the row for the scoring, keeping what it has allocated
+  void Reset(const Scoring &s, size_t cols) {
+    H.resize(cols);
+    I.resize(s.isAffineGap ? cols : 0);
+    I2.resize(s.isDualGap ? cols : 0);
+  }
+
+  void Clear(uint j) {
+    H[j] = kNegative;
+    if (!I.empty())
+      I[j] = kNegative;
+    if (!I2.empty())
+      I2[j] = kNegative;
+  }
+};
+
+// Row 0 of the score matrices, where no vertical gap ends
+void FirstRow(const Scoring &s, uint target_len, Row &row) {
+  row.H[0] = 0;
+  for (uint j = 1; j <= target_len; ++j)
+    row.H[j] = s.type == AlignmentType::global ? GapScore(s, j) : 0;
+  std::fill(row.I.begin(), row.I.end(), kNegative);
+  std::fill(row.I2.begin(), row.I2.end(), kNegative);
+}
+
+// Computes columns [first, last] of row i of the score matrices from the
+// previous row, and their traceback codes from trace[0] on if trace is not
+// null. Column first - 1 of H and columns of the previous row outside of its
+// computed range have to be cleared. Local alignments report their best cell
+// in bestH, bestI and bestJ, the first one in row major order on ties.
+//
+// H is the best of a match, the vertical gap states I and I2, which consume
+// the query, and the horizontal ones D and D2, in that order of preference.
+// A gap state extends its gap rather than opening one from H on ties.
+template <int Gaps>
+void FillRowGaps(const Scoring &s, uint i, char queryBase, const char *target,
+                 uint first, uint last, const Row &prev, Row &cur, char *trace,
+                 int &bestH, uint &bestI, uint &bestJ) {
+  const bool isLocal = s.type == AlignmentType::local;
+  // scores in locals, which stores to the rows can not alias
+  const int match = s.match, mismatch = s.mismatch, gap = s.gap;
+  const int gapOpen = s.gap_open, gapExtend = s.gap_extend;
+  const int gapOpen2 = s.gap_open2, gapExtend2 = s.gap_extend2;
+  const int *prevH = prev.H.data(), *prevI = prev.I.data(),
+            *prevI2 = prev.I2.data();
+  int *H = cur.H.data(), *curI = cur.I.data(), *curI2 = cur.I2.data();
+
+  // column 0 ends no horizontal gap
+  int D = kNegative, D2 = kNegative;
+  if (first == 0) {
+    H[0] = isLocal ? 0 : GapScore(s, i);
+    if (Gaps != kLinearGaps)
+      curI[0] = kNegative;
+    if (Gaps == kDualGaps)
+      curI2[0] = kNegative;
+    if (trace != nullptr)
+      trace[0] = kStop;
+  }
+
+  // cells left and up left of the current one are carried in registers
+  const uint begin = std::max(first, 1u);
+  int left = H[begin - 1], upLeft = prevH[begin - 1];
+  for (uint j = begin; j <= last; ++j) {
+    const int up = prevH[j];
+    int mscore = upLeft + (queryBase == target[j - 1] ? match : mismatch);
+    int I, I2 = kNegative, extends = 0;
+    if (Gaps != kLinearGaps) {
+      const int openI = up + gapOpen, openD = left + gapOpen;
+      if (trace != nullptr)
+        extends = (prevI[j] >= openI ? kExtendsI : 0) |
+                  (D >= openD ? kExtendsD : 0);
+      I = curI[j] = std::max(openI, prevI[j]) + gapExtend;
+      D = std::max(openD, D) + gapExtend;
     } else {
-      dp[i][0] = dp[i - 1][0] + gap;
+      I = up + gap;
+      D = left + gap;
+    }
+    if (Gaps == kDualGaps) {
+      const int openI = up + gapOpen2, openD = left + gapOpen2;
+      if (trace != nullptr)
+        extends |= (prevI2[j] >= openI ? kExtendsI2 : 0) |
+                   (D2 >= openD ? kExtendsD2 : 0);
+      I2 = curI2[j] = std::max(openI, prevI2[j]) + gapExtend2;
+      D2 = std::max(openD, D2) + gapExtend2;
+    }
+
+    int h = std::max({mscore, I, D});
+    if (Gaps == kDualGaps)
+      h = std::max({h, I2, D2});
+    if (isLocal)
+      h = std::max(h, 0);
+    H[j] = h;
+    left = h;
+    upLeft = up;
+
+    if (trace != nullptr) {
+      char source = kFromD2;
+      if (isLocal && h <= 0)
+        source = kStop;
+      else if (h == mscore)
+        source = kFromM;
+      else if (h == I)
+        source = kFromI;
+      else if (h == D)
+        source = kFromD;
+      else if (h == I2)
+        source = kFromI2;
+      char code = static_cast<char>(source | extends);
+      trace[j - first] = code;
+    }
+
+    if (isLocal && bestH < h) {
+      bestH = h;
+      bestI = i;
+      bestJ = j;
     }
   }
+}
+
+void FillRow(const Scoring &s, uint i, char queryBase, const char *target,
+             uint first, uint last, const Row &prev, Row &cur, char *trace,
+             int &bestH, uint &bestI, uint &bestJ) {
+  if (s.isDualGap)
+    FillRowGaps<kDualGaps>(s, i, queryBase, target, first, last, prev, cur,
+                           trace, bestH, bestI, bestJ);
+  else if (s.isAffineGap)
+    FillRowGaps<kAffineGaps>(s, i, queryBase, target, first, last, prev, cur,
+                             trace, bestH, bestI, bestJ);
+  else
+    FillRowGaps<kLinearGaps>(s, i, queryBase, target, first, last, prev, cur,
+                             trace, bestH, bestI, bestJ);
+}
 
-  for (uint i = 1; i <= target_len; i++) {
-    if (type == AlignmentType::local || type == AlignmentType::semiglobal) {
-      dp[0][i] = 0;
+// Appends a run of len ops to cigar, merged with its last run if that has
+// the same op
+void AppendRun(std::string &cigar, unsigned long len, char op) {
+  if (!cigar.empty() && cigar.back() == op) {
+    // find_last_not_of gives npos, which wraps to 0, for a single run
+    size_t k = cigar.find_last_not_of("0123456789", cigar.size() - 2) + 1;
+    const size_t lastRun = k;
+    unsigned long run = 0;
+    for (; k + 1 < cigar.size(); ++k)
+      run = run * 10 + static_cast<unsigned long>(cigar[k] - '0');
+    len += run;
+    cigar.resize(lastRun);
+  }
+  char digits[24];
+  cigar.append(digits, std::to_chars(digits, digits + sizeof(digits), len).ptr);
+  cigar += op;
+}
+
+// Appends the run length encoding of the reversed path to cigar
+void AppendCigar(const std::vector<char> &longCigar, std::string *cigar) {
+  unsigned long run = 0;
+  for (size_t k = longCigar.size(); k > 0; --k) {
+    ++run;
+    if (k == 1 || longCigar[k - 1] != longCigar[k - 2]) {
+      AppendRun(*cigar, run, longCigar[k - 1]);
+      run = 0;
+    }
+  }
+}
+
+// Appends the cigar piece to cigar, merging the runs where they meet
+void JoinCigar(std::string &cigar, const std::string &piece) {
+  unsigned long run = 0;
+  for (char c : piece) {
+    if (c >= '0' && c <= '9') {
+      run = run * 10 + static_cast<unsigned long>(c - '0');
     } else {
-      dp[0][i] = dp[0][i - 1] + gap;
-    }
-  }
-
-  int maxDpVal = 0;
-  uint maxDpI = 0, maxDpJ = 0;
-
-  for (uint i = 1; i <= query_len; i++) {
-    for (uint j = 1; j <= target_len; j++) {
-      int mscore =
-          dp[i - 1][j - 1] + (query[i - 1] == target[j - 1] ? match : mismatch);
-      dpI[i][j] =
-          isAffineGap
-              ? std::max(dp[i - 1][j] + gap_open, dpI[i - 1][j]) + gap_extend
-              : dp[i - 1][j] + gap;
-      dpD[i][j] =
-          isAffineGap
-              ? std::max(dp[i][j - 1] + gap_open, dpD[i][j - 1]) + gap_extend
-              : dp[i][j - 1] + gap;
-
-      dp[i][j] = std::max({mscore, dpI[i][j], dpD[i][j], 0});
-
-      if (dp[i][j] == mscore) {
-        prev[i][j] = 'M';
-      } else if (dp[i][j] == dpI[i][j]) {
-        prev[i][j] = 'I';
-      } else if (dp[i][j] == dpD[i][j]) {
-        prev[i][j] = 'D';
-      }
+      AppendRun(cigar, run, c);
+      run = 0;
+    }
+  }
+}
 
-      if (maxDpVal < dp[i][j]) {
-        maxDpVal = dp[i][j];
-        maxDpI = i;
-        maxDpJ = j;
-      }
+// Follows the traceback codes given by codeAt(i, j) from cell (i, j) of H to
+// the start of the alignment, appends its path to longCigar in reverse and
+// leaves i and j at the query and target positions the alignment starts at.
+// A path which enters a gap state stays in it for as long as the codes say
+// its gap extends.
+template <typename CodeAt>
+void TraceBack(AlignmentType type, uint &i, uint &j, CodeAt codeAt,
+               std::vector<char> &longCigar) {
+  // gap state the path is in, or kFromM while it is in H
+  char state = kFromM;
+  while (true) {
+    if (i == 0) {
+      // the target may start anywhere in semiglobal alignments
+      if (type != AlignmentType::global || j == 0)
+        break;
+      j--;
+      longCigar.push_back('D');
+      continue;
+    }
+    if (j == 0) {
+      if (type == AlignmentType::local)
+        break;
+      i--;
+      longCigar.push_back('I');
+      continue;
+    }
+
+    char code = codeAt(i, j);
+    if (state == kFromM) {
+      state = static_cast<char>(code & kSourceBits);
+      if (state == kStop)
+        break;
+      if (state != kFromM)
+        continue;
+      i--;
+      j--;
+      longCigar.push_back('M');
+      continue;
     }
+
+    char extends;
+    if (state == kFromI || state == kFromI2) {
+      extends = state == kFromI ? kExtendsI : kExtendsI2;
+      i--;
+      longCigar.push_back('I');
+    } else {
+      extends = state == kFromD ? kExtendsD : kExtendsD2;
+      j--;
+      longCigar.push_back('D');
+    }
+    if ((code & extends) == 0)
+      state = kFromM;
   }
+}
 
-  // for (uint i = 0; i <= query_len; ++i) {
-  //   for (uint j = 0; j <= target_len; ++j) {
-  //     printf("%d\t", dp[i][j]);
-  //   }
-  //   printf("\n");
-  // }
+// Target columns [lo[i], hi[i]] of query row i within band_width of the
+// diagonals of the path through the points, which are ordered and increasing
+// in both coordinates. Between two points the band spans the diagonals of
+// both, so an indel may lie anywhere in between. The band never moves left.
+void BandAround(const std::vector<std::pair<long, long>> &path,
+                uint query_len, uint target_len, uint band_width,
+                std::vector<uint> &lo, std::vector<uint> &hi) {
+  lo.resize(query_len + 1);
+  hi.resize(query_len + 1);
 
-  uint startI = query_len, startJ = target_len;
+  auto clamp = [target_len](long j) {
+    return uint(std::min(std::max(j, 0l), long(target_len)));
+  };
+  for (size_t k = 0; k + 1 < path.size(); ++k) {
+    long diagonalA = path[k].second - path[k].first;
+    long diagonalB = path[k + 1].second - path[k + 1].first;
+    long lowest = std::min(diagonalA, diagonalB) - long(band_width);
+    long highest = std::max(diagonalA, diagonalB) + long(band_width);
+    for (long i = path[k].first; i <= path[k + 1].first; ++i) {
+      bool isFirst = k == 0 || i > path[k].first;
+      lo[size_t(i)] = isFirst ? clamp(i + lowest)
+                              : std::min(lo[size_t(i)], clamp(i + lowest));
+      hi[size_t(i)] = isFirst ? clamp(i + highest)
+                              : std::max(hi[size_t(i)], clamp(i + highest));
+    }
+  }
+
+  for (uint i = query_len; i > 0; --i)
+    lo[i - 1] = std::min(lo[i - 1], lo[i]);
+  for (uint i = 1; i <= query_len; ++i)
+    hi[i] = std::max(hi[i], hi[i - 1]);
+}
+
+// Highest score an alignment through cell (i, j) with score h could reach,
+// if every following base matched and only the gaps needed to reach the end
+// of the alignment were paid for
+int BestReachable(const Scoring &s, uint query_len, uint target_len, uint i,
+                  uint j, int h) {
+  const uint rows = query_len - i, cols = target_len - j;
+  uint gaps = 0;
+  if (s.type == AlignmentType::global)
+    gaps = rows > cols ? rows - cols : cols - rows;
+  else if (s.type == AlignmentType::semiglobal && rows > cols)
+    gaps = rows - cols;
+
+  return h + std::max(s.match, 0) * int(std::min(rows, cols)) +
+         std::min(GapScore(s, gaps), 0);
+}
+
+// Exact match of a piecewise alignment
+struct PieceMatch {
+  uint query_pos;
+  uint target_pos;
+  uint len;
+};
+
+} // namespace
+
+// Alignments which call others pass the workspace on, and only keep their
+// own buffers across such calls
+struct AlignmentWorkspace::Buffers {
+  // lanes of the vectorized kernel
+  std::vector<char> queryLanes;
+  std::vector<char> targetLanes;
+  std::vector<char> diagonals;
+  std::vector<size_t> traceBegin;
+
+  // rows of the scalar kernel and their bands
+  Row rows[2];
+  std::vector<Row> checkpoints;
+  std::vector<uint> lo;
+  std::vector<uint> hi;
+  std::vector<size_t> offset;
+  std::vector<std::pair<long, long>> path;
+
+  std::vector<char> trace;
+  std::vector<char> longCigar;
+
+  // pieces of piecewise alignments and extensions
+  std::vector<PieceMatch> matches;
+  std::string piece;
+  std::string reversedQuery;
+  std::string reversedTarget;
+};
+
+AlignmentWorkspace::AlignmentWorkspace()
+    : buffers_(std::make_unique<Buffers>()) {}
+
+AlignmentWorkspace::~AlignmentWorkspace() = default;
+
+AlignmentWorkspace::AlignmentWorkspace(AlignmentWorkspace &&) noexcept =
+    default;
+
+AlignmentWorkspace &
+AlignmentWorkspace::operator=(AlignmentWorkspace &&) noexcept = default;
+
+size_t AlignmentWorkspace::capacity() const {
+  auto bytes = [](const auto &buffer) {
+    return buffer.capacity() * sizeof(buffer[0]);
+  };
+  auto rowBytes = [&bytes](const Row &row) {
+    return bytes(row.H) + bytes(row.I) + bytes(row.I2);
+  };
+  const Buffers &b = *buffers_;
+  size_t ret = bytes(b.queryLanes) + bytes(b.targetLanes) +
+               bytes(b.diagonals) + bytes(b.traceBegin) +
+               rowBytes(b.rows[0]) + rowBytes(b.rows[1]) +
+               bytes(b.checkpoints) + bytes(b.lo) + bytes(b.hi) +
+               bytes(b.offset) + bytes(b.path) + bytes(b.trace) +
+               bytes(b.longCigar) + bytes(b.matches) + bytes(b.piece) +
+               bytes(b.reversedQuery) + bytes(b.reversedTarget);
+  for (const Row &i : b.checkpoints)
+    ret += rowBytes(i);
+  return ret;
+}
+
+namespace {
+
+int AlignCheckpointedWith(AlignmentWorkspace::Buffers &b, const char *query,
+                          uint query_len, const char *target, uint target_len,
+                          AlignmentType type, int match, int mismatch, int gap,
+                          uint block_rows, std::string *cigar,
+                          uint *target_begin, int gap_open, int gap_extend,
+                          int gap_open2, int gap_extend2, uint *query_begin) {
+  using std::vector;
+
+  const Scoring s = MakeScoring(type, match, mismatch, gap, gap_open,
+                                gap_extend, gap_open2, gap_extend2);
+  const bool needsCigar = cigar != nullptr && target_begin != nullptr;
+  const size_t cols = size_t(target_len) + 1;
+  const uint blockRows = std::max(std::min(block_rows, query_len), 1u);
+  const uint blocks = query_len == 0 ? 0 : (query_len - 1) / blockRows + 1;
+
+  // checkpoint rows k * blockRows and the traceback of one block
+  vector<Row> &checkpoints = b.checkpoints;
+  vector<char> &trace = b.trace;
+  if (needsCigar) {
+    if (checkpoints.size() < blocks)
+      checkpoints.resize(blocks);
+    trace.resize(size_t(blockRows) * cols);
+  }
+  Row *rows = b.rows;
+  rows[0].Reset(s, cols);
+  rows[1].Reset(s, cols);
+
+  int bestH = 0;
+  uint bestI = 0, bestJ = 0;
 
-  int ret = dp[startI][startJ];
+  FirstRow(s, target_len, rows[0]);
+  for (uint i = 1; i <= query_len; ++i) {
+    const Row &prev = rows[(i - 1) & 1];
+    if (needsCigar && (i - 1) % blockRows == 0)
+      checkpoints[(i - 1) / blockRows] = prev;
+    // with a single block the traceback is kept from this pass
+    char *traceRow = needsCigar && blocks == 1
+                         ? trace.data() + size_t(i - 1) * cols
+                         : nullptr;
+    FillRow(s, i, query[i - 1], target, 0, target_len, prev, rows[i & 1],
+            traceRow, bestH, bestI, bestJ);
+  }
+
+  const vector<int> &lastH = rows[query_len & 1].H;
+  uint startI = query_len, startJ = target_len;
+  int ret = lastH[target_len];
 
   if (type == AlignmentType::local) {
-    startI = maxDpI;
-    startJ = maxDpJ;
-    ret = maxDpVal;
+    startI = bestI;
+    startJ = bestJ;
+    ret = bestH;
+  } else if (type == AlignmentType::semiglobal) {
+    // the target may end anywhere
+    startJ =
+        uint(std::max_element(lastH.begin(), lastH.end()) - lastH.begin());
+    ret = lastH[startJ];
   }
 
+  if (!needsCigar)
+    return ret;
+
+  uint loadedBlock = blocks == 1 ? 0 : blocks;
+  auto codeAt = [&](uint i, uint j) {
+    uint block = (i - 1) / blockRows;
+    if (block != loadedBlock) {
+      // recompute the traceback of the block from its checkpoint row
+      uint first = block * blockRows + 1;
+      uint last = std::min(query_len, first + blockRows - 1);
+      rows[0] = checkpoints[block];
+      int unusedH = 0;
+      uint unusedI = 0, unusedJ = 0;
+      for (uint k = first; k <= last; ++k) {
+        uint cur = (k - first + 1) & 1, prev = cur ^ 1;
+        FillRow(s, k, query[k - 1], target, 0, target_len, rows[prev],
+                rows[cur], trace.data() + size_t(k - first) * cols, unusedH,
+                unusedI, unusedJ);
+      }
+      loadedBlock = block;
+    }
+    return trace[size_t(i - 1 - loadedBlock * blockRows) * cols + j];
+  };
+
+  vector<char> &longCigar = b.longCigar;
+  longCigar.clear();
+  TraceBack(type, startI, startJ, codeAt, longCigar);
+
+  AppendCigar(longCigar, cigar);
+  *target_begin = startJ;
+  if (query_begin != nullptr)
+    *query_begin = startI;
+
+  return ret;
+}
+
+// Scalar alignment, with the traceback of large alignments in blocks
+int AlignScalar(AlignmentWorkspace::Buffers &b, const char *query,
+                uint query_len, const char *target, uint target_len,
+                AlignmentType type, int match, int mismatch, int gap,
+                std::string *cigar, uint *target_begin, int gap_open,
+                int gap_extend, int gap_open2, int gap_extend2,
+                uint *query_begin) {
+  uint blockRows = query_len;
+  if ((size_t(query_len) + 1) * (size_t(target_len) + 1) > kMaxTraceCells)
+    blockRows = uint(std::ceil(std::sqrt(double(query_len))));
+  return AlignCheckpointedWith(b, query, query_len, target, target_len, type,
+                               match, mismatch, gap, blockRows, cigar,
+                               target_begin, gap_open, gap_extend, gap_open2,
+                               gap_extend2, query_begin);
+}
+
+// Bytes of the narrowest lanes which hold every score and row index of the
+// alignment, or 0 if 32 bits may not, and the score of unreachable states for
+// them. Scores start at 0 and change by at most one step per anti-diagonal,
+// and gap states take a step from scores of the previous one.
+uint LaneBytes(const Scoring &s, uint query_len, uint target_len,
+               int &negative) {
+  long long step = std::max({std::abs(s.match), std::abs(s.mismatch),
+                             std::abs(s.gap)});
+  if (s.isAffineGap)
+    step = std::max(step, (long long)std::abs(s.gap_open) +
+                              std::abs(s.gap_extend));
+  if (s.isDualGap)
+    step = std::max(step, (long long)std::abs(s.gap_open2) +
+                              std::abs(s.gap_extend2));
+  step = std::max(step, 1ll);
+  const long long bound = (query_len + 4ll + target_len) * step;
+  auto fits = [&](long long lane_max) {
+    return bound + 2 * step + 1 <= lane_max &&
+           query_len + (long long)kernel::kAvx512Bytes <= lane_max;
+  };
+  negative = int(-(bound + step + 1));
+  if (fits(std::numeric_limits<std::int8_t>::max()))
+    return 1;
+  if (fits(std::numeric_limits<std::int16_t>::max()))
+    return 2;
+  if (fits(std::numeric_limits<std::int32_t>::max()))
+    return 4;
+  return 0;
+}
+
+// Bases of sequence in lanes, reversed if asked, followed by a vector of zero
+// lanes
+void ToLanes(const char *sequence, uint len, bool reverse, uint lane_bytes,
+             std::vector<char> &lanes) {
+  lanes.assign((size_t(len) + kernel::kAvx512Bytes) * lane_bytes, 0);
+  for (uint k = 0; k < len; ++k) {
+    unsigned char base =
+        static_cast<unsigned char>(sequence[reverse ? len - 1 - k : k]);
+    char *lane = lanes.data() + size_t(k) * lane_bytes;
+    if (lane_bytes == 1) {
+      *lane = static_cast<char>(base);
+    } else if (lane_bytes == 2) {
+      std::int16_t value = base;
+      std::memcpy(lane, &value, sizeof(value));
+    } else {
+      std::int32_t value = base;
+      std::memcpy(lane, &value, sizeof(value));
+    }
+  }
+}
+
+int AlignVectorizedWith(AlignmentWorkspace::Buffers &b, const char *query,
+                        uint query_len, const char *target, uint target_len,
+                        AlignmentType type, int match, int mismatch, int gap,
+                        SimdLevel level, std::string *cigar, uint *target_begin,
+                        int gap_open, int gap_extend, int gap_open2,
+                        int gap_extend2, uint *query_begin) {
+  using std::vector;
+
+  const Scoring s = MakeScoring(type, match, mismatch, gap, gap_open,
+                                gap_extend, gap_open2, gap_extend2);
+  const bool needsCigar = cigar != nullptr && target_begin != nullptr;
+  int negative = 0;
+  const uint laneBytes = LaneBytes(s, query_len, target_len, negative);
+  level = std::min(level, HostSimdLevel());
+
+  if (level == SimdLevel::none || query_len == 0 || target_len == 0 ||
+      laneBytes == 0 ||
+      (needsCigar && (size_t(query_len) + 1) * (size_t(target_len) + 1) >
+                         kMaxTraceCells))
+    return AlignScalar(b, query, query_len, target, target_len, type, match,
+                       mismatch, gap, cigar, target_begin, gap_open, gap_extend,
+                       gap_open2, gap_extend2, query_begin);
+
+  vector<char> &queryLanes = b.queryLanes, &targetLanes = b.targetLanes;
+  ToLanes(query, query_len, false, laneBytes, queryLanes);
+  ToLanes(target, target_len, true, laneBytes, targetLanes);
+
+  const size_t stride = size_t(query_len) + 1 + kernel::kAvx512Bytes;
+  vector<char> &diagonals = b.diagonals;
+  diagonals.assign(11 * stride * laneBytes, 0);
+
+  // traceback of every anti-diagonal, starting from its first row
+  auto firstRow = [target_len](uint d) {
+    return d > target_len ? d - target_len : 1;
+  };
+  vector<size_t> &traceBegin = b.traceBegin;
+  vector<char> &trace = b.trace;
   if (needsCigar) {
-    uint i = startI;
-    uint j = startJ;
-
-    vector<char> longCigar;
-
-    while (
-        (type == AlignmentType::local && dp[i][j] > 0) ||
-        ((type == AlignmentType::global || type == AlignmentType::semiglobal) &&
-         i + j > 0)) {
-      if (i == 0) {
-        // D
-        j--;
-        longCigar.push_back('D');
+    traceBegin.resize(size_t(query_len) + target_len + 1);
+    size_t cells = 0;
+    for (uint d = 2; d <= query_len + target_len; ++d) {
+      traceBegin[d] = cells;
+      cells += std::min(d - 1, query_len) - firstRow(d) + 1;
+    }
+    trace.resize(cells + kernel::kAvx512Bytes);
+  }
+
+  kernel::DiagonalFill fill = {};
+  fill.s = s;
+  fill.lane_bytes = laneBytes;
+  fill.negative = negative;
+  fill.query_len = query_len;
+  fill.target_len = target_len;
+  fill.query = queryLanes.data();
+  fill.target = targetLanes.data();
+  fill.diagonals = diagonals.data();
+  fill.diagonal_stride = stride;
+  fill.trace = needsCigar ? trace.data() : nullptr;
+  fill.trace_begin = traceBegin.data();
+
+#ifdef CRIMSON_X86_KERNELS
+  if (level == SimdLevel::avx512)
+    kernel::FillAvx512(fill);
+  else if (level == SimdLevel::avx2)
+    kernel::FillAvx2(fill);
+  else
+    kernel::FillSse41(fill);
+#endif
+
+  if (!needsCigar)
+    return fill.score;
+
+  vector<char> &longCigar = b.longCigar;
+  longCigar.clear();
+  uint startI = fill.end_i, startJ = fill.end_j;
+  TraceBack(
+      type, startI, startJ,
+      [&](uint i, uint j) {
+        return trace[traceBegin[i + j] + i - firstRow(i + j)];
+      },
+      longCigar);
+  AppendCigar(longCigar, cigar);
+  *target_begin = startJ;
+  if (query_begin != nullptr)
+    *query_begin = startI;
+
+  return fill.score;
+}
+
+} // namespace
+
+int AlignCheckpointed(const char *query, unsigned int query_len,
+                      const char *target, unsigned int target_len,
+                      AlignmentType type, int match, int mismatch, int gap,
+                      unsigned int block_rows, std::string *cigar,
+                      unsigned int *target_begin, int gap_open, int gap_extend,
+                      int gap_open2, int gap_extend2,
+                      unsigned int *query_begin) {
+  AlignmentWorkspace workspace;
+  return AlignCheckpointedWith(workspace.buffers(), query, query_len, target,
+                               target_len, type, match, mismatch, gap,
+                               block_rows, cigar, target_begin, gap_open,
+                               gap_extend, gap_open2, gap_extend2, query_begin);
+}
+
+SimdLevel HostSimdLevel() {
+#ifdef CRIMSON_X86_KERNELS
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+      return SimdLevel::avx512;
+    if (__builtin_cpu_supports("avx2"))
+      return SimdLevel::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+      return SimdLevel::sse41;
+    return SimdLevel::none;
+  }();
+  return level;
+#else
+  return SimdLevel::none;
+#endif
+}
+
+int Align(const char *query, unsigned int query_len, const char *target,
+          unsigned int target_len, AlignmentType type, int match, int mismatch,
+          int gap, std::string *cigar, unsigned int *target_begin, int gap_open,
+          int gap_extend, int gap_open2, int gap_extend2,
+          unsigned int *query_begin) {
+  AlignmentWorkspace workspace;
+  return Align(workspace, query, query_len, target, target_len, type, match,
+               mismatch, gap, cigar, target_begin, gap_open, gap_extend,
+               gap_open2, gap_extend2, query_begin);
+}
+
+int Align(AlignmentWorkspace &workspace, const char *query,
+          unsigned int query_len, const char *target, unsigned int target_len,
+          AlignmentType type, int match, int mismatch, int gap,
+          std::string *cigar, unsigned int *target_begin, int gap_open,
+          int gap_extend, int gap_open2, int gap_extend2,
+          unsigned int *query_begin) {
+  return AlignVectorizedWith(workspace.buffers(), query, query_len, target,
+                             target_len, type, match, mismatch, gap,
+                             HostSimdLevel(), cigar, target_begin, gap_open,
+                             gap_extend, gap_open2, gap_extend2, query_begin);
+}
+
+int AlignVectorized(const char *query, unsigned int query_len,
+                    const char *target, unsigned int target_len,
+                    AlignmentType type, int match, int mismatch, int gap,
+                    SimdLevel level, std::string *cigar,
+                    unsigned int *target_begin, int gap_open, int gap_extend,
+                    int gap_open2, int gap_extend2, unsigned int *query_begin) {
+  AlignmentWorkspace workspace;
+  return AlignVectorizedWith(workspace.buffers(), query, query_len, target,
+                             target_len, type, match, mismatch, gap, level,
+                             cigar, target_begin, gap_open, gap_extend,
+                             gap_open2, gap_extend2, query_begin);
+}
+
+int AlignBanded(const char *query, unsigned int query_len, const char *target,
+                unsigned int target_len, AlignmentType type, int match,
+                int mismatch, int gap,
+                const std::vector<AlignmentAnchor> &anchors,
+                unsigned int band_width, std::string *cigar,
+                unsigned int *target_begin, int gap_open, int gap_extend,
+                int gap_open2, int gap_extend2, unsigned int *query_begin) {
+  AlignmentWorkspace workspace;
+  return AlignBanded(workspace, query, query_len, target, target_len, type,
+                     match, mismatch, gap, anchors, band_width, cigar,
+                     target_begin, gap_open, gap_extend, gap_open2, gap_extend2,
+                     query_begin);
+}
+
+int AlignBanded(AlignmentWorkspace &workspace, const char *query,
+                unsigned int query_len, const char *target,
+                unsigned int target_len, AlignmentType type, int match,
+                int mismatch, int gap,
+                const std::vector<AlignmentAnchor> &anchors,
+                unsigned int band_width, std::string *cigar,
+                unsigned int *target_begin, int gap_open, int gap_extend,
+                int gap_open2, int gap_extend2, unsigned int *query_begin) {
+  using std::vector;
+
+  AlignmentWorkspace::Buffers &b = workspace.buffers();
+
+  if (query_len == 0)
+    return Align(workspace, query, query_len, target, target_len, type, match,
+                 mismatch, gap, cigar, target_begin, gap_open, gap_extend,
+                 gap_open2, gap_extend2, query_begin);
+
+  // path the band follows, beyond the outer anchors of alignments with free
+  // ends it continues along their diagonals
+  vector<std::pair<long, long>> &path = b.path;
+  path.clear();
+  if (type == AlignmentType::global)
+    path.push_back({0, 0});
+  for (const AlignmentAnchor &i : anchors) {
+    if (i.query_pos > query_len || i.target_pos > target_len)
+      continue;
+    if (!path.empty() && (i.query_pos <= path.back().first ||
+                          i.target_pos < path.back().second))
+      continue;
+    path.push_back({long(i.query_pos), long(i.target_pos)});
+  }
+  if (type == AlignmentType::global) {
+    if (path.back().first == query_len)
+      path.pop_back();
+    path.push_back({long(query_len), long(target_len)});
+  } else {
+    if (path.empty())
+      return Align(workspace, query, query_len, target, target_len, type, match,
+                   mismatch, gap, cigar, target_begin, gap_open, gap_extend,
+                   gap_open2, gap_extend2, query_begin);
+    if (path.front().first > 0)
+      path.insert(path.begin(),
+                  {0, path.front().second - path.front().first});
+    if (path.back().first < query_len)
+      path.push_back({long(query_len),
+                      path.back().second + query_len - path.back().first});
+  }
+
+  const Scoring s = MakeScoring(type, match, mismatch, gap, gap_open,
+                                gap_extend, gap_open2, gap_extend2);
+  const size_t cols = size_t(target_len) + 1;
+  const size_t cellsTotal = (size_t(query_len) + 1) * cols;
+
+  vector<uint> &lo = b.lo, &hi = b.hi;
+  vector<size_t> &offset = b.offset;
+  offset.resize(query_len + 1);
+  vector<char> &trace = b.trace;
+  Row *rows = b.rows;
+  rows[0].Reset(s, cols);
+  rows[1].Reset(s, cols);
+  vector<char> &longCigar = b.longCigar;
+
+  // best score reachable by leaving the band from row i, through its last
+  // cell or cells above the start of the next row
+  auto exitScore = [&](uint i, const int *rowH) {
+    int ret = kNegative;
+    if (hi[i] < target_len)
+      ret = BestReachable(s, query_len, target_len, i, hi[i], rowH[hi[i]]);
+    if (i < query_len)
+      for (uint j = lo[i]; j < std::min(lo[i + 1], hi[i] + 1); ++j)
+        ret = std::max(ret,
+                       BestReachable(s, query_len, target_len, i, j, rowH[j]));
+    return ret;
+  };
+
+  for (uint width = std::max(band_width, 1u);; width *= 2) {
+    BandAround(path, query_len, target_len, width, lo, hi);
+
+    size_t cells = 0;
+    for (uint i = 1; i <= query_len; ++i) {
+      offset[i] = cells;
+      cells += hi[i] - lo[i] + 1;
+    }
+    // a band as large as the whole matrix gains nothing
+    if (cells + cols >= cellsTotal)
+      return Align(workspace, query, query_len, target, target_len, type, match,
+                   mismatch, gap, cigar, target_begin, gap_open, gap_extend,
+                   gap_open2, gap_extend2, query_begin);
+    trace.resize(cells);
+
+    int bestH = 0;
+    uint bestI = 0, bestJ = 0;
+    int bestExit = kNegative;
+
+    FirstRow(s, target_len, rows[0]);
+    for (uint j = 0; j < lo[0]; ++j)
+      rows[0].Clear(j);
+    for (uint j = hi[0] + 1; j <= target_len; ++j)
+      rows[0].Clear(j);
+    bestExit = exitScore(0, rows[0].H.data());
+
+    for (uint i = 1; i <= query_len; ++i) {
+      Row &prev = rows[(i - 1) & 1], &cur = rows[i & 1];
+      // bands only move right, so the previous row is cleared where this
+      // row reads past it
+      for (uint j = hi[i - 1] + 1; j <= hi[i]; ++j)
+        prev.Clear(j);
+      if (lo[i] > 0) {
+        if (lo[i] == lo[i - 1])
+          prev.Clear(lo[i] - 1);
+        cur.H[lo[i] - 1] = kNegative;
+      }
+      FillRow(s, i, query[i - 1], target, lo[i], hi[i], prev, cur,
+              trace.data() + offset[i], bestH, bestI, bestJ);
+      bestExit = std::max(bestExit, exitScore(i, cur.H.data()));
+    }
+
+    const int *lastH = rows[query_len & 1].H.data();
+    uint i = query_len, j = target_len;
+    int ret = lastH[target_len];
+
+    if (type == AlignmentType::local) {
+      i = bestI;
+      j = bestJ;
+      ret = bestH;
+    } else if (type == AlignmentType::semiglobal) {
+      j = uint(std::max_element(lastH + lo[query_len],
+                                lastH + hi[query_len] + 1) -
+               lastH);
+      ret = lastH[j];
+    }
+    // an alignment outside of the band could still score higher
+    if (bestExit > ret)
+      continue;
+
+    longCigar.clear();
+    TraceBack(
+        type, i, j,
+        [&](uint k, uint l) { return trace[offset[k] + l - lo[k]]; },
+        longCigar);
+
+    if (cigar != nullptr && target_begin != nullptr) {
+      AppendCigar(longCigar, cigar);
+      *target_begin = j;
+      if (query_begin != nullptr)
+        *query_begin = i;
+    }
+    return ret;
+  }
+}
+
+int AlignPiecewise(const char *query, unsigned int query_len,
+                   const char *target, unsigned int target_len, int match,
+                   int mismatch, int gap,
+                   const std::vector<AlignmentAnchor> &anchors,
+                   unsigned int anchor_len, unsigned int band_width,
+                   std::string *cigar, int gap_open, int gap_extend,
+                   int gap_open2, int gap_extend2) {
+  AlignmentWorkspace workspace;
+  return AlignPiecewise(workspace, query, query_len, target, target_len,
+                        match, mismatch, gap, anchors, anchor_len, band_width,
+                        cigar, gap_open, gap_extend, gap_open2, gap_extend2);
+}
+
+int AlignPiecewise(AlignmentWorkspace &workspace, const char *query,
+                   unsigned int query_len, const char *target,
+                   unsigned int target_len, int match, int mismatch, int gap,
+                   const std::vector<AlignmentAnchor> &anchors,
+                   unsigned int anchor_len, unsigned int band_width,
+                   std::string *cigar, int gap_open, int gap_extend,
+                   int gap_open2, int gap_extend2) {
+  AlignmentWorkspace::Buffers &b = workspace.buffers();
+
+  // exact matches the alignment runs through, the last one an empty match
+  // at the end of the sequences
+  std::vector<PieceMatch> &matches = b.matches;
+  matches.clear();
+  for (const AlignmentAnchor &i : anchors) {
+    if (anchor_len == 0 || size_t(i.query_pos) + anchor_len > query_len ||
+        size_t(i.target_pos) + anchor_len > target_len ||
+        std::memcmp(query + i.query_pos, target + i.target_pos,
+                    anchor_len) != 0)
+      continue;
+    if (!matches.empty()) {
+      PieceMatch &last = matches.back();
+      const uint queryEnd = last.query_pos + last.len;
+      if (i.query_pos >= last.query_pos && i.query_pos <= queryEnd &&
+          long(i.target_pos) - long(i.query_pos) ==
+              long(last.target_pos) - long(last.query_pos)) {
+        last.len =
+            std::max(last.len, i.query_pos + anchor_len - last.query_pos);
         continue;
       }
-      if (j == 0) {
-        // I
-        i--;
-        longCigar.push_back('I');
+      if (i.query_pos < queryEnd || i.target_pos < last.target_pos + last.len)
         continue;
+    }
+    matches.push_back({i.query_pos, i.target_pos, anchor_len});
+  }
+  matches.push_back({query_len, target_len, 0});
+
+  int score = 0;
+  uint queryPos = 0, targetPos = 0;
+  std::string &piece = b.piece;
+  for (const PieceMatch &i : matches) {
+    const uint pieceQueryLen = i.query_pos - queryPos;
+    const uint pieceTargetLen = i.target_pos - targetPos;
+    if (pieceQueryLen > 0 || pieceTargetLen > 0) {
+      piece.clear();
+      uint pieceBegin = 0;
+      score += AlignBanded(workspace, query + queryPos, pieceQueryLen,
+                           target + targetPos, pieceTargetLen,
+                           AlignmentType::global, match, mismatch, gap, {},
+                           band_width, cigar != nullptr ? &piece : nullptr,
+                           &pieceBegin, gap_open, gap_extend, gap_open2,
+                           gap_extend2);
+      if (cigar != nullptr)
+        JoinCigar(*cigar, piece);
+    }
+    if (i.len > 0) {
+      score += int(i.len) * match;
+      if (cigar != nullptr)
+        AppendRun(*cigar, i.len, 'M');
+    }
+    queryPos = i.query_pos + i.len;
+    targetPos = i.target_pos + i.len;
+  }
+  return score;
+}
+
+int ExtendAlignment(const char *query, unsigned int query_len,
+                    const char *target, unsigned int target_len, int match,
+                    int mismatch, int gap, int x_drop, int z_drop,
+                    bool leftward, std::string *cigar,
+                    unsigned int *query_extent, unsigned int *target_extent,
+                    bool *z_dropped, int gap_open, int gap_extend,
+                    int gap_open2, int gap_extend2) {
+  AlignmentWorkspace workspace;
+  return ExtendAlignment(workspace, query, query_len, target, target_len,
+                         match, mismatch, gap, x_drop, z_drop, leftward, cigar,
+                         query_extent, target_extent, z_dropped, gap_open,
+                         gap_extend, gap_open2, gap_extend2);
+}
+
+int ExtendAlignment(AlignmentWorkspace &workspace, const char *query,
+                    unsigned int query_len, const char *target,
+                    unsigned int target_len, int match, int mismatch,
+                    int gap, int x_drop, int z_drop, bool leftward,
+                    std::string *cigar, unsigned int *query_extent,
+                    unsigned int *target_extent, bool *z_dropped,
+                    int gap_open, int gap_extend, int gap_open2,
+                    int gap_extend2) {
+  using std::vector;
+
+  AlignmentWorkspace::Buffers &b = workspace.buffers();
+
+  // a leftward extension is one to the right of the reversed sequences
+  std::string &reversedQuery = b.reversedQuery;
+  std::string &reversedTarget = b.reversedTarget;
+  if (leftward) {
+    reversedQuery.assign(query, query_len);
+    reversedTarget.assign(target, target_len);
+    std::reverse(reversedQuery.begin(), reversedQuery.end());
+    std::reverse(reversedTarget.begin(), reversedTarget.end());
+    query = reversedQuery.c_str();
+    target = reversedTarget.c_str();
+  }
+
+  const Scoring s = MakeScoring(AlignmentType::global, match, mismatch, gap,
+                                gap_open, gap_extend, gap_open2, gap_extend2);
+  const size_t cols = size_t(target_len) + 1;
+  // longest horizontal gap which drops by at most x_drop, and the score of
+  // each base of long gaps
+  uint maxGap = 0;
+  while (maxGap < target_len && GapScore(s, maxGap + 1) >= -x_drop)
+    ++maxGap;
+  const int extendScore = GapExtendScore(s);
+
+  // columns [lo[i], hi[i]] of row i are computed, and their traceback kept
+  // from trace[offset[i]] on
+  vector<uint> &lo = b.lo, &hi = b.hi;
+  vector<size_t> &offset = b.offset;
+  vector<char> &trace = b.trace;
+  lo.assign(1, 0);
+  hi.assign(1, maxGap);
+  offset.assign(1, 0);
+  trace.clear();
+  Row *rows = b.rows;
+  rows[0].Reset(s, cols);
+  rows[1].Reset(s, cols);
+
+  int best = 0;
+  uint bestI = 0, bestJ = 0;
+  bool isZDropped = false;
+
+  FirstRow(s, target_len, rows[0]);
+  // columns of the previous row which are within x_drop of the best cell
+  uint aliveLo = 0, aliveHi = maxGap;
+  for (uint i = 1; i <= query_len; ++i) {
+    Row &prev = rows[(i - 1) & 1], &cur = rows[i & 1];
+    lo.push_back(aliveLo);
+    hi.push_back(std::min(target_len, aliveHi + 1 + maxGap));
+    offset.push_back(trace.size());
+    trace.resize(trace.size() + hi[i] - lo[i] + 1);
+
+    // the previous row is cleared where this row reads past it
+    for (uint j = hi[i - 1] + 1; j <= hi[i]; ++j)
+      prev.Clear(j);
+    if (lo[i] > 0) {
+      if (lo[i] == lo[i - 1])
+        prev.Clear(lo[i] - 1);
+      cur.H[lo[i] - 1] = kNegative;
+    }
+    int unusedH = 0;
+    uint unusedI = 0, unusedJ = 0;
+    FillRow(s, i, query[i - 1], target, lo[i], hi[i], prev, cur,
+            trace.data() + offset[i], unusedH, unusedI, unusedJ);
+
+    const int *H = cur.H.data();
+    const uint rowBestJ =
+        uint(std::max_element(H + lo[i], H + hi[i] + 1) - H);
+    const int rowBest = H[rowBestJ];
+    if (rowBest > best) {
+      best = rowBest;
+      bestI = i;
+      bestJ = rowBestJ;
+    } else if (z_drop > 0) {
+      const long diagonals =
+          std::abs((long(rowBestJ) - long(bestJ)) - long(i - bestI));
+      if (best - rowBest > z_drop + extendScore * diagonals) {
+        isZDropped = true;
+        break;
       }
+    }
 
-      if (prev[i][j] == 'M') {
-        // M
-        i--;
-        j--;
-        longCigar.push_back('M');
-        continue;
-      } else if (prev[i][j] == 'I') {
-        // I
-        i--;
-        longCigar.push_back('I');
-        continue;
-      } else if (prev[i][j] == 'D') {
-        // D
-        j--;
-        longCigar.push_back('D');
-        continue;
+    aliveLo = hi[i] + 1;
+    for (uint j = lo[i]; j <= hi[i]; ++j) {
+      if (H[j] >= best - x_drop) {
+        aliveLo = std::min(aliveLo, j);
+        aliveHi = j;
       }
     }
+    if (aliveLo > hi[i])
+      break;
+  }
 
-    std::reverse(longCigar.begin(), longCigar.end());
+  if (query_extent != nullptr)
+    *query_extent = bestI;
+  if (target_extent != nullptr)
+    *target_extent = bestJ;
+  if (z_dropped != nullptr)
+    *z_dropped = isZDropped;
 
-    int cigarNum = 0;
-    for (uint i = 0; i < longCigar.size(); i++) {
-      ++cigarNum;
-      if (i + 1 == longCigar.size() || longCigar[i] != longCigar[i + 1]) {
-        *cigar += std::to_string(cigarNum);
-        *cigar += longCigar[i];
-        cigarNum = 0;
-      }
+  if (cigar != nullptr) {
+    vector<char> &longCigar = b.longCigar;
+    longCigar.clear();
+    uint startI = bestI, startJ = bestJ;
+    TraceBack(
+        AlignmentType::global, startI, startJ,
+        [&](uint k, uint l) { return trace[offset[k] + l - lo[k]]; },
+        longCigar);
+    // the path of the reversed sequences, traced from its end, is the one
+    // of the sequences in order
+    if (leftward)
+      std::reverse(longCigar.begin(), longCigar.end());
+    std::string &extension = b.piece;
+    extension.clear();
+    AppendCigar(longCigar, &extension);
+    if (leftward) {
+      JoinCigar(extension, *cigar);
+      cigar->swap(extension);
+    } else {
+      JoinCigar(*cigar, extension);
     }
+  }
+  return best;
+}
+
+std::vector<AlignmentPart>
+SplitAtZDrops(std::string_view cigar, const char *query, const char *target,
+              int match, int mismatch, int gap, int z_drop, int gap_open,
+              int gap_extend, int gap_open2, int gap_extend2) {
+  const Scoring s = MakeScoring(AlignmentType::global, match, mismatch, gap,
+                                gap_open, gap_extend, gap_open2, gap_extend2);
+  const int extendScore = GapExtendScore(s);
 
-    *target_begin = j;
+  std::vector<std::pair<char, uint>> runs;
+  uint len = 0;
+  for (char c : cigar) {
+    if (c >= '0' && c <= '9') {
+      len = len * 10 + uint(c - '0');
+    } else {
+      runs.push_back({c, len});
+      len = 0;
+    }
   }
 
-  return ret;
+  // point after len columns of run k of the cigar, i and j bases into the
+  // sequences, where the alignment has the score
+  struct Point {
+    size_t k;
+    uint len;
+    uint i;
+    uint j;
+    int score;
+  };
+  std::vector<AlignmentPart> parts;
+  auto addPart = [&](const Point &from, const Point &to) {
+    if (to.score - from.score < z_drop)
+      return;
+    AlignmentPart part = {from.i, from.j, to.score - from.score, {}};
+    for (size_t k = from.k; k <= to.k && k < runs.size(); ++k) {
+      uint begin = k == from.k ? from.len : 0;
+      uint end = k == to.k ? to.len : runs[k].second;
+      if (end > begin)
+        AppendRun(part.cigar, end - begin, runs[k].first);
+    }
+    parts.push_back(std::move(part));
+  };
+
+  // the part after a drop starts where the score is lowest before it rises
+  Point cur = {0, 0, 0, 0, 0};
+  Point start = cur, best = cur;
+  bool isDropped = false;
+  auto check = [&]() {
+    if (cur.score > best.score) {
+      best = cur;
+    } else if (isDropped && cur.score < start.score) {
+      start = best = cur;
+    } else if (z_drop > 0) {
+      const long diagonals =
+          std::abs((long(cur.j) - long(best.j)) - long(cur.i - best.i));
+      if (best.score - cur.score > z_drop + extendScore * diagonals) {
+        addPart(start, best);
+        isDropped = true;
+        start = best = cur;
+      }
+    }
+  };
+  for (size_t k = 0; k < runs.size(); ++k) {
+    const char op = runs[k].first;
+    cur.k = k;
+    cur.len = 0;
+    if (op == 'M' || op == '=' || op == 'X') {
+      while (cur.len < runs[k].second) {
+        cur.score += query[cur.i] == target[cur.j] ? match : mismatch;
+        ++cur.i;
+        ++cur.j;
+        ++cur.len;
+        check();
+      }
+    } else if (op == 'I' || op == 'D') {
+      cur.score += GapScore(s, runs[k].second);
+      (op == 'I' ? cur.i : cur.j) += runs[k].second;
+      cur.len = runs[k].second;
+      check();
+    }
+  }
+  if (!isDropped)
+    return {{0, 0, cur.score, std::string(cigar)}};
+  addPart(start, cur);
+  if (parts.empty())
+    return {{0, 0, cur.score, std::string(cigar)}};
+  return parts;
 }
 
 } // namespace crimson
@@ -1,17 +1,215 @@
 #ifndef CRIMSON_ALIGNMENT_ENGINE_HPP_
 #define CRIMSON_ALIGNMENT_ENGINE_HPP_
 
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace crimson {
 
 enum class AlignmentType { global, local, semiglobal };
 
+// Instruction sets of the vectorized alignment kernel, from none up
+enum class SimdLevel { none, sse41, avx2, avx512 };
+
+// Highest level supported by both the build and the host CPU
+SimdLevel HostSimdLevel();
+
+// Buffers of the score matrices, tracebacks and cigars of alignments, which
+// grow to the largest alignment they were used for and are kept for the next
+// ones, so that a thread which aligns many sequences through the same
+// workspace allocates about as often as its largest alignment grows. A
+// workspace may be used by one thread at a time.
+class AlignmentWorkspace {
+public:
+  AlignmentWorkspace();
+  ~AlignmentWorkspace();
+
+  AlignmentWorkspace(AlignmentWorkspace &&) noexcept;
+  AlignmentWorkspace &operator=(AlignmentWorkspace &&) noexcept;
+
+  // Bytes allocated by the buffers
+  size_t capacity() const;
+
+  // Buffers, opaque outside of the alignment engine
+  struct Buffers;
+  Buffers &buffers() { return *buffers_; }
+
+private:
+  std::unique_ptr<Buffers> buffers_;
+};
+
+// Global aligns the whole query to the whole target, local the best pair of
+// substrings, and semiglobal the whole query to a substring of the target.
+// A gap of length l scores l * gap, or gap_open + l * gap_extend if either of
+// those is set, and the higher of that and gap_open2 + l * gap_extend2 if
+// those are set too, so that long gaps cost less per base than short ones.
+// Affine gaps are aligned with Gotoh's gap states and traced back through
+// them. Alignments are computed by AlignVectorized at the level of the host,
+// and large ones with a cigar by AlignCheckpointed with about
+// sqrt(query_len) rows per block.
+//
+// With a cigar and target_begin, the cigar covers the alignment from the
+// target position target_begin and the query position query_begin on, if
+// given, which is 0 unless the alignment is local.
 int Align(const char *query, unsigned int query_len, const char *target,
           unsigned int target_len, AlignmentType type, int match, int mismatch,
           int gap, std::string *cigar = nullptr,
           unsigned int *target_begin = nullptr, int gap_open = 0,
-          int gap_extend = 0);
+          int gap_extend = 0, int gap_open2 = 0, int gap_extend2 = 0,
+          unsigned int *query_begin = nullptr);
+
+// Same alignment as Align with the buffers of workspace
+int Align(AlignmentWorkspace &workspace, const char *query,
+          unsigned int query_len, const char *target, unsigned int target_len,
+          AlignmentType type, int match, int mismatch, int gap,
+          std::string *cigar = nullptr, unsigned int *target_begin = nullptr,
+          int gap_open = 0, int gap_extend = 0, int gap_open2 = 0,
+          int gap_extend2 = 0, unsigned int *query_begin = nullptr);
+
+// Same alignment as Align which keeps only every block_rows-th row of the
+// score matrices and the traceback of block_rows query rows at a time,
+// recomputed from the checkpoint rows during traceback. It takes
+// O((query_len / block_rows + block_rows) * target_len) memory and about
+// twice the time, and O(target_len) memory without a cigar.
+int AlignCheckpointed(const char *query, unsigned int query_len,
+                      const char *target, unsigned int target_len,
+                      AlignmentType type, int match, int mismatch, int gap,
+                      unsigned int block_rows, std::string *cigar = nullptr,
+                      unsigned int *target_begin = nullptr, int gap_open = 0,
+                      int gap_extend = 0, int gap_open2 = 0,
+                      int gap_extend2 = 0, unsigned int *query_begin = nullptr);
+
+// Same alignment as Align computed by anti-diagonals in vector lanes of the
+// given level, or of the host if it supports less. Lanes have 8, 16 or 32
+// bits, the fewest the scores of the alignment are known to fit into. Falls
+// back to the scalar kernel without a supported level.
+int AlignVectorized(const char *query, unsigned int query_len,
+                    const char *target, unsigned int target_len,
+                    AlignmentType type, int match, int mismatch, int gap,
+                    SimdLevel level, std::string *cigar = nullptr,
+                    unsigned int *target_begin = nullptr, int gap_open = 0,
+                    int gap_extend = 0, int gap_open2 = 0, int gap_extend2 = 0,
+                    unsigned int *query_begin = nullptr);
+
+// Point through which an alignment is expected to pass, such as the start of
+// a chained minimizer match
+struct AlignmentAnchor {
+  unsigned int query_pos;
+  unsigned int target_pos;
+};
+
+// Same alignment as Align computed only in a band around a path which runs
+// from the start of the alignment through the anchors to its end, and along
+// the diagonals of the outer anchors where local and semiglobal alignments
+// have free ends. Between two anchors the band spans the diagonals of both.
+// It reaches band_width columns beyond the path and is doubled while an
+// alignment leaving it could still score higher, so the result is optimal
+// among alignments which start in the band, and sequences which follow the
+// anchors take O(query_len * band_width) time and memory.
+int AlignBanded(const char *query, unsigned int query_len, const char *target,
+                unsigned int target_len, AlignmentType type, int match,
+                int mismatch, int gap,
+                const std::vector<AlignmentAnchor> &anchors,
+                unsigned int band_width, std::string *cigar = nullptr,
+                unsigned int *target_begin = nullptr, int gap_open = 0,
+                int gap_extend = 0, int gap_open2 = 0, int gap_extend2 = 0,
+                unsigned int *query_begin = nullptr);
+
+// Same alignment as AlignBanded with the buffers of workspace
+int AlignBanded(AlignmentWorkspace &workspace, const char *query,
+                unsigned int query_len, const char *target,
+                unsigned int target_len, AlignmentType type, int match,
+                int mismatch, int gap,
+                const std::vector<AlignmentAnchor> &anchors,
+                unsigned int band_width, std::string *cigar = nullptr,
+                unsigned int *target_begin = nullptr, int gap_open = 0,
+                int gap_extend = 0, int gap_open2 = 0, int gap_extend2 = 0,
+                unsigned int *query_begin = nullptr);
+
+// Global alignment of the query to the target through the exact matches of
+// anchor_len bases which start at the anchors. Anchors whose bases differ,
+// which are out of order or which overlap the previous match off its diagonal
+// are skipped, and overlapping ones on a diagonal are merged. Only the pieces
+// between the matches are aligned, each by AlignBanded, and their cigars are
+// joined with those of the matches, so dense anchors take time about linear
+// in the length of the sequences. The alignment is optimal only among those
+// through the matches.
+int AlignPiecewise(const char *query, unsigned int query_len,
+                   const char *target, unsigned int target_len, int match,
+                   int mismatch, int gap,
+                   const std::vector<AlignmentAnchor> &anchors,
+                   unsigned int anchor_len, unsigned int band_width,
+                   std::string *cigar = nullptr, int gap_open = 0,
+                   int gap_extend = 0, int gap_open2 = 0,
+                   int gap_extend2 = 0);
+
+// Same alignment as AlignPiecewise with the buffers of workspace
+int AlignPiecewise(AlignmentWorkspace &workspace, const char *query,
+                   unsigned int query_len, const char *target,
+                   unsigned int target_len, int match, int mismatch, int gap,
+                   const std::vector<AlignmentAnchor> &anchors,
+                   unsigned int anchor_len, unsigned int band_width,
+                   std::string *cigar = nullptr, int gap_open = 0,
+                   int gap_extend = 0, int gap_open2 = 0,
+                   int gap_extend2 = 0);
+
+// Alignment which starts at the beginning of both the query and the target,
+// or if leftward ends at their ends, and extends into them for as long as it
+// pays off. Rows of the score matrices are computed only around the cells
+// which score at most x_drop below the best one so far, and the extension
+// stops at the end of the query or once no cell is left. It also stops once
+// the best cell of a row scores more than z_drop below the best one so far,
+// after a gap of the length between their diagonals is allowed for, so long
+// gaps are extended over but diverged regions are not, and sets z_dropped.
+// A z_drop of 0 turns that off. Returns the score of the best cell, which is
+// query_extent and target_extent bases into the sequences, and joins the
+// cigar of the extension to the end of cigar, or to its start if leftward.
+int ExtendAlignment(const char *query, unsigned int query_len,
+                    const char *target, unsigned int target_len, int match,
+                    int mismatch, int gap, int x_drop, int z_drop,
+                    bool leftward, std::string *cigar = nullptr,
+                    unsigned int *query_extent = nullptr,
+                    unsigned int *target_extent = nullptr,
+                    bool *z_dropped = nullptr, int gap_open = 0,
+                    int gap_extend = 0, int gap_open2 = 0,
+                    int gap_extend2 = 0);
+
+// Same extension as ExtendAlignment with the buffers of workspace
+int ExtendAlignment(AlignmentWorkspace &workspace, const char *query,
+                    unsigned int query_len, const char *target,
+                    unsigned int target_len, int match, int mismatch,
+                    int gap, int x_drop, int z_drop, bool leftward,
+                    std::string *cigar = nullptr,
+                    unsigned int *query_extent = nullptr,
+                    unsigned int *target_extent = nullptr,
+                    bool *z_dropped = nullptr, int gap_open = 0,
+                    int gap_extend = 0, int gap_open2 = 0,
+                    int gap_extend2 = 0);
+
+// Part of an alignment which starts query_begin and target_begin bases into
+// its sequences
+struct AlignmentPart {
+  unsigned int query_begin;
+  unsigned int target_begin;
+  int score;
+  std::string cigar;
+};
+
+// Splits the alignment of query and target which the cigar describes where
+// its score drops more than z_drop below the best one so far, with gaps
+// allowed for as in ExtendAlignment. A part ends at its best column before
+// the drop, and the next one starts where the score is lowest after it, so
+// the diverged region between them is left out. The first part starts and
+// the last one ends where the alignment does. Parts which score less than
+// z_drop are left out, and the whole alignment is the only part if it does
+// not drop, z_drop is 0 or no part is left.
+std::vector<AlignmentPart>
+SplitAtZDrops(std::string_view cigar, const char *query, const char *target,
+              int match, int mismatch, int gap, int z_drop, int gap_open = 0,
+              int gap_extend = 0, int gap_open2 = 0, int gap_extend2 = 0);
 
 } // namespace crimson
 
@@ -0,0 +1,323 @@
+#ifndef CRIMSON_ALIGNMENT_KERNEL_HPP_
+#define CRIMSON_ALIGNMENT_KERNEL_HPP_
+
+#include "crimson_alignment_engine.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace crimson {
+namespace kernel {
+
+// Scoring of an alignment. A gap of length l scores l * gap, with affine gaps
+// gap_open + l * gap_extend instead, and with dual affine gaps the higher of
+// that and gap_open2 + l * gap_extend2, so long gaps may cost less per base.
+// It has no member functions, as those would be linked from any of the units
+// compiled for different instruction sets, see GapScore.
+struct Scoring {
+  AlignmentType type;
+  int match;
+  int mismatch;
+  int gap;
+  int gap_open;
+  int gap_extend;
+  int gap_open2;
+  int gap_extend2;
+  bool isAffineGap;
+  bool isDualGap;
+};
+
+// Traceback code of a cell, the low bits tell which state the best score H
+// comes from, or kStop if a local alignment starts there, and every gap state
+// has a bit set if it extends the gap of the cell before it instead of
+// opening one from H
+constexpr char kStop = 0;
+constexpr char kFromM = 1;
+constexpr char kFromI = 2;
+constexpr char kFromD = 3;
+constexpr char kFromI2 = 4;
+constexpr char kFromD2 = 5;
+constexpr char kSourceBits = 7;
+constexpr char kExtendsI = 8;
+constexpr char kExtendsD = 16;
+constexpr char kExtendsI2 = 32;
+constexpr char kExtendsD2 = 64;
+
+// Score matrices of an alignment filled one anti-diagonal at a time, so the
+// cells of a diagonal, which do not depend on each other, are computed in
+// vector lanes. Diagonal d holds cells (i, d - i) at index i. Every score and
+// row index has to fit into lanes of lane_bytes, and so does negative, which
+// is below every score and stands for cells of unreachable states.
+struct DiagonalFill {
+  Scoring s;
+  unsigned int lane_bytes;
+  int negative;
+
+  unsigned int query_len;
+  unsigned int target_len;
+  // query and reversed target as lanes followed by a vector of zero lanes
+  const void *query;
+  const void *target;
+  // 11 zeroed diagonals of diagonal_stride lanes, at least query_len + 1
+  // lanes and a vector
+  void *diagonals;
+  size_t diagonal_stride;
+  // traceback code of cell (i, j) of diagonal d = i + j at
+  // trace[trace_begin[d] + i - (first row of d)] if not null, followed by a
+  // vector of padding
+  char *trace;
+  const size_t *trace_begin;
+
+  // last cell of the alignment and its score
+  int score;
+  unsigned int end_i;
+  unsigned int end_j;
+};
+
+// Kernels compiled for the instruction sets of their names, and the width of
+// their vectors in bytes
+constexpr unsigned int kSse41Bytes = 16;
+constexpr unsigned int kAvx2Bytes = 32;
+constexpr unsigned int kAvx512Bytes = 64;
+void FillSse41(DiagonalFill &fill);
+void FillAvx2(DiagonalFill &fill);
+void FillAvx512(DiagonalFill &fill);
+
+namespace {
+
+// Score of a gap of length bases. Every unit has its own copy, and it calls
+// nothing from other headers, so the scalar code never runs a copy compiled
+// for a vector instruction set.
+inline int GapScore(const Scoring &s, unsigned int length) {
+  if (length == 0)
+    return 0;
+  if (!s.isAffineGap)
+    return int(length) * s.gap;
+  const int score = s.gap_open + int(length) * s.gap_extend;
+  const int score2 = s.gap_open2 + int(length) * s.gap_extend2;
+  return s.isDualGap && score2 > score ? score2 : score;
+}
+
+// Vectors of the GNU extensions, the kernels are only built by compilers that
+// also select between and convert them, others align with the scalar code
+template <typename Lane, unsigned int Bytes> struct Lanes {
+  typedef Lane Vector __attribute__((vector_size(Bytes)));
+  typedef char Codes __attribute__((vector_size(Bytes / sizeof(Lane))));
+};
+
+// Gap models the kernel is compiled for
+constexpr int kLinearGaps = 0;
+constexpr int kAffineGaps = 1;
+constexpr int kDualGaps = 2;
+
+// Same recurrences and traceback codes as the row kernel of the scalar
+// alignment, see FillRow
+template <typename Lane, unsigned int Bytes, int Gaps>
+void FillLanes(DiagonalFill &f) {
+  using Vector = typename Lanes<Lane, Bytes>::Vector;
+  using Codes = typename Lanes<Lane, Bytes>::Codes;
+  constexpr unsigned int kWidth = Bytes / sizeof(Lane);
+
+  const Scoring &s = f.s;
+  const unsigned int n = f.query_len, m = f.target_len;
+  const bool isLocal = s.type == AlignmentType::local;
+  const bool isGlobal = s.type == AlignmentType::global;
+  const Lane *query = static_cast<const Lane *>(f.query);
+  const Lane *target = static_cast<const Lane *>(f.target);
+
+  Lane *diagonals = static_cast<Lane *>(f.diagonals);
+  const size_t stride = f.diagonal_stride;
+  Lane *H[3] = {diagonals, diagonals + stride, diagonals + 2 * stride};
+  Lane *I[2] = {diagonals + 3 * stride, diagonals + 4 * stride};
+  Lane *D[2] = {diagonals + 5 * stride, diagonals + 6 * stride};
+  Lane *I2[2] = {diagonals + 7 * stride, diagonals + 8 * stride};
+  Lane *D2[2] = {diagonals + 9 * stride, diagonals + 10 * stride};
+
+  auto load = [](const Lane *from) {
+    Vector v;
+    std::memcpy(&v, from, sizeof(v));
+    return v;
+  };
+  auto store = [](Lane *to, Vector v) { std::memcpy(to, &v, sizeof(v)); };
+  auto max = [](Vector a, Vector b) { return a > b ? a : b; };
+
+  const Vector zero = {};
+  const Vector match = zero + Lane(s.match);
+  const Vector mismatch = zero + Lane(s.mismatch);
+  const Vector gap = zero + Lane(s.gap);
+  const Vector gapOpen = zero + Lane(s.gap_open);
+  const Vector gapExtend = zero + Lane(s.gap_extend);
+  const Vector gapOpen2 = zero + Lane(s.gap_open2);
+  const Vector gapExtend2 = zero + Lane(s.gap_extend2);
+  const Vector fromM = zero + Lane(kFromM), fromI = zero + Lane(kFromI),
+               fromD = zero + Lane(kFromD), fromI2 = zero + Lane(kFromI2),
+               fromD2 = zero + Lane(kFromD2);
+  const Vector extendsI = zero + Lane(kExtendsI),
+               extendsD = zero + Lane(kExtendsD),
+               extendsI2 = zero + Lane(kExtendsI2),
+               extendsD2 = zero + Lane(kExtendsD2);
+  const Lane negative = Lane(f.negative);
+  Vector iota = zero;
+  for (unsigned int k = 0; k < kWidth; ++k)
+    iota[k] = Lane(k);
+
+  // row 0 and column 0 cells of diagonal d, where no gap state ends
+  auto setBorders = [&](unsigned int d) {
+    if (d <= m) {
+      H[d % 3][0] = isGlobal ? Lane(GapScore(s, d)) : Lane(0);
+      I[d & 1][0] = I2[d & 1][0] = negative;
+    }
+    if (d >= 1 && d <= n) {
+      H[d % 3][d] = isLocal ? Lane(0) : Lane(GapScore(s, d));
+      I[d & 1][d] = I2[d & 1][d] = negative;
+      D[d & 1][d] = D2[d & 1][d] = negative;
+    }
+  };
+  setBorders(0);
+  setBorders(1);
+
+  f.score = 0;
+  f.end_i = 0;
+  f.end_j = 0;
+  if (s.type == AlignmentType::semiglobal) {
+    f.score = GapScore(s, n);
+    f.end_i = n;
+  }
+
+  for (unsigned int d = 2; d <= n + m; ++d) {
+    const unsigned int first = d > m ? d - m : 1;
+    const unsigned int last = d - 1 < n ? d - 1 : n;
+    const Lane *diagH = H[(d + 1) % 3];
+    const Lane *prevH = H[(d + 2) % 3];
+    const Lane *prevI = I[(d - 1) & 1], *prevD = D[(d - 1) & 1];
+    const Lane *prevI2 = I2[(d - 1) & 1], *prevD2 = D2[(d - 1) & 1];
+    Lane *curH = H[d % 3], *curI = I[d & 1], *curD = D[d & 1];
+    Lane *curI2 = I2[d & 1], *curD2 = D2[d & 1];
+    char *trace = f.trace ? f.trace + f.trace_begin[d] : nullptr;
+    // best score of every lane on this diagonal and the first row it is in
+    Vector best = zero, bestRow = zero;
+
+    for (unsigned int i = first; i <= last; i += kWidth) {
+      // cell (i, j) compares query[i - 1] and target[j - 1], which is at
+      // m - j of the reversed target
+      Vector mscore = load(diagH + i - 1) +
+                      (load(query + i - 1) == load(target + m - d + i)
+                           ? match
+                           : mismatch);
+      Vector up = load(prevH + i - 1), left = load(prevH + i);
+      Vector vertical, horizontal, vertical2 = zero, horizontal2 = zero;
+      Vector extends = zero;
+      if (Gaps == kLinearGaps) {
+        vertical = up + gap;
+        horizontal = left + gap;
+      } else {
+        Vector openI = up + gapOpen, extendI = load(prevI + i - 1);
+        Vector openD = left + gapOpen, extendD = load(prevD + i);
+        vertical = max(openI, extendI) + gapExtend;
+        horizontal = max(openD, extendD) + gapExtend;
+        store(curI + i, vertical);
+        store(curD + i, horizontal);
+        if (trace != nullptr)
+          extends = (extendI >= openI ? extendsI : zero) |
+                    (extendD >= openD ? extendsD : zero);
+      }
+      if (Gaps == kDualGaps) {
+        Vector openI = up + gapOpen2, extendI = load(prevI2 + i - 1);
+        Vector openD = left + gapOpen2, extendD = load(prevD2 + i);
+        vertical2 = max(openI, extendI) + gapExtend2;
+        horizontal2 = max(openD, extendD) + gapExtend2;
+        store(curI2 + i, vertical2);
+        store(curD2 + i, horizontal2);
+        if (trace != nullptr)
+          extends |= (extendI >= openI ? extendsI2 : zero) |
+                     (extendD >= openD ? extendsD2 : zero);
+      }
+
+      Vector h = max(mscore, max(vertical, horizontal));
+      if (Gaps == kDualGaps)
+        h = max(h, max(vertical2, horizontal2));
+      if (isLocal)
+        h = max(h, zero);
+      store(curH + i, h);
+
+      if (trace != nullptr) {
+        Vector code = Gaps == kDualGaps
+                          ? (h == horizontal ? fromD
+                                             : (h == vertical2 ? fromI2
+                                                               : fromD2))
+                          : fromD;
+        code = h == vertical ? fromI : code;
+        code = h == mscore ? fromM : code;
+        if (isLocal)
+          code = h <= zero ? zero : code;
+        code |= extends;
+        Codes codes = __builtin_convertvector(code, Codes);
+        std::memcpy(trace + (i - first), &codes, sizeof(codes));
+      }
+      if (isLocal) {
+        if (last - i + 1 < kWidth)
+          h = iota < Lane(last - i + 1) ? h : zero;
+        bestRow = h > best ? iota + Lane(i) : bestRow;
+        best = max(best, h);
+      }
+    }
+    setBorders(d);
+
+    if (isLocal) {
+      // the first best cell in row major order is kept on ties, so an equal
+      // one replaces it only from an earlier row
+      Lane bestH = 0;
+      unsigned int bestI = 0;
+      for (unsigned int k = 0; k < kWidth; ++k) {
+        unsigned int row = static_cast<unsigned int>(bestRow[k]);
+        if (best[k] > bestH || (best[k] == bestH && row < bestI)) {
+          bestH = best[k];
+          bestI = row;
+        }
+      }
+      if (bestH > f.score ||
+          (bestH == f.score && bestH > 0 && bestI < f.end_i)) {
+        f.score = bestH;
+        f.end_i = bestI;
+        f.end_j = d - bestI;
+      }
+    } else if (s.type == AlignmentType::semiglobal) {
+      if (first <= n && n <= last && curH[n] > f.score) {
+        f.score = curH[n];
+        f.end_j = d - n;
+      }
+    }
+  }
+
+  if (isGlobal) {
+    f.score = H[(n + m) % 3][n];
+    f.end_i = n;
+    f.end_j = m;
+  }
+}
+
+template <typename Lane, unsigned int Bytes> void FillGaps(DiagonalFill &fill) {
+  if (fill.s.isDualGap)
+    FillLanes<Lane, Bytes, kDualGaps>(fill);
+  else if (fill.s.isAffineGap)
+    FillLanes<Lane, Bytes, kAffineGaps>(fill);
+  else
+    FillLanes<Lane, Bytes, kLinearGaps>(fill);
+}
+
+template <unsigned int Bytes> void Fill(DiagonalFill &fill) {
+  if (fill.lane_bytes == 1)
+    FillGaps<std::int8_t, Bytes>(fill);
+  else if (fill.lane_bytes == 2)
+    FillGaps<std::int16_t, Bytes>(fill);
+  else
+    FillGaps<std::int32_t, Bytes>(fill);
+}
+
+} // namespace
+
+} // namespace kernel
+} // namespace crimson
+
+#endif // CRIMSON_ALIGNMENT_KERNEL_HPP_
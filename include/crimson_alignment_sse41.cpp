@@ -0,0 +1,9 @@
+#include "crimson_alignment_kernel.hpp"
+
+namespace crimson {
+namespace kernel {
+
+void FillSse41(DiagonalFill &fill) { Fill<kSse41Bytes>(fill); }
+
+} // namespace kernel
+} // namespace crimson
@@ -0,0 +1,327 @@
+#include "crimson_chaining_engine.hpp"
+#include "crimson_radix_sort.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace crimson {
+
+namespace {
+
+template <typename KmerT> bool IsReverse(const BasicOverlap<KmerT> &overlap) {
+  return overlap.is_original_query != overlap.is_original_reference;
+}
+
+// Cost of a gap between the diagonals of two chained matches
+int GapCost(unsigned int gap, unsigned int kmer_len) {
+  if (gap == 0)
+    return 0;
+  return static_cast<int>(0.01 * kmer_len * gap + 0.5 * std::log2(gap));
+}
+
+// Mapping quality of a chain whose best secondary chain scores
+// secondary_score
+unsigned int MappingQuality(int score, int secondary_score, size_t matches) {
+  double quality = 40.0 * (1.0 - double(secondary_score) / score) *
+                   std::min(1.0, double(matches) / 10.0) * std::log(score);
+  return static_cast<unsigned int>(std::clamp(quality, 0.0, 60.0));
+}
+
+// Chain as it is traced back, whose matches are indices into the sorted
+// overlaps kept in Buffers::traced from begin on, last match first
+struct ChainTrace {
+  int score;
+  size_t order;
+  size_t begin;
+  size_t size;
+  unsigned int query_begin;
+  unsigned int query_end;
+  ChainKind kind;
+  size_t parent;
+  int secondaryScore;
+  unsigned int secondaryCount;
+  bool reported;
+};
+
+} // namespace
+
+template <typename KmerT> struct ChainingWorkspace<KmerT>::Buffers {
+  std::vector<BasicOverlap<KmerT>> overlaps;
+  std::vector<BasicOverlap<KmerT>> sortBuffer;
+  // best score of a chain ending at every match, and the match before it
+  std::vector<int> score;
+  std::vector<long> prev;
+  // matches in decreasing order of score
+  std::vector<std::uint32_t> ends;
+  std::vector<std::uint32_t> endsBuffer;
+  std::vector<std::uint8_t> used;
+  std::vector<std::uint32_t> traced;
+  std::vector<ChainTrace> traces;
+
+  size_t capacity() const {
+    return (overlaps.capacity() + sortBuffer.capacity()) *
+               sizeof(BasicOverlap<KmerT>) +
+           score.capacity() * sizeof(int) + prev.capacity() * sizeof(long) +
+           (ends.capacity() + endsBuffer.capacity() + traced.capacity()) *
+               sizeof(std::uint32_t) +
+           used.capacity() + traces.capacity() * sizeof(ChainTrace);
+  }
+};
+
+template <typename KmerT>
+ChainingWorkspace<KmerT>::ChainingWorkspace()
+    : buffers_(std::make_unique<Buffers>()) {}
+template <typename KmerT> ChainingWorkspace<KmerT>::~ChainingWorkspace() =
+    default;
+template <typename KmerT>
+ChainingWorkspace<KmerT>::ChainingWorkspace(ChainingWorkspace &&) noexcept =
+    default;
+template <typename KmerT>
+ChainingWorkspace<KmerT> &
+ChainingWorkspace<KmerT>::operator=(ChainingWorkspace &&) noexcept = default;
+
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>> &ChainingWorkspace<KmerT>::overlaps() {
+  return buffers_->overlaps;
+}
+
+template <typename KmerT> size_t ChainingWorkspace<KmerT>::capacity() const {
+  return buffers_->capacity();
+}
+
+template <typename KmerT>
+std::vector<BasicChain<KmerT>>
+ChainOverlaps(std::vector<BasicOverlap<KmerT>> overlaps,
+              unsigned int kmer_len, unsigned int query_len,
+              const ChainOptions &options) {
+  ChainingWorkspace<KmerT> workspace;
+  workspace.overlaps().swap(overlaps);
+  return ChainOverlaps(workspace, kmer_len, query_len, options);
+}
+
+template <typename KmerT>
+std::vector<BasicChain<KmerT>>
+ChainOverlaps(ChainingWorkspace<KmerT> &workspace, unsigned int kmer_len,
+              unsigned int query_len, const ChainOptions &options) {
+  using std::vector;
+  typedef BasicOverlap<KmerT> Overlap;
+
+  typename ChainingWorkspace<KmerT>::Buffers &buffers = workspace.buffers();
+  vector<Overlap> &overlaps = buffers.overlaps;
+
+  // matches on the reverse strand are taken on the reverse complement of
+  // the query, so chains are colinear on both strands
+  std::uint32_t maxReference = 0, maxPos = 0;
+  for (Overlap &i : overlaps) {
+    if (IsReverse(i))
+      i.query_pos = query_len - i.query_pos - kmer_len;
+    maxReference = std::max(maxReference, i.reference_index);
+    maxPos = std::max(maxPos, i.reference_pos);
+  }
+
+  // sorted by reference, strand, reference position and query position, in
+  // a single key if it fits into 64 bits
+  const unsigned int queryBits = BitWidth(query_len);
+  const unsigned int posBits = BitWidth(maxPos);
+  const unsigned int targetBits = BitWidth(maxReference) + 1 + posBits;
+  auto targetKey = [posBits](const Overlap &x) {
+    return (std::uint64_t(x.reference_index) << 1 | IsReverse(x)) << posBits |
+           x.reference_pos;
+  };
+  if (targetBits + queryBits <= 64) {
+    RadixSort(overlaps, buffers.sortBuffer, targetBits + queryBits,
+              [&](const Overlap &x) {
+                return targetKey(x) << queryBits | x.query_pos;
+              });
+  } else {
+    RadixSort(overlaps, buffers.sortBuffer, queryBits,
+              [](const Overlap &x) { return x.query_pos; });
+    RadixSort(overlaps, buffers.sortBuffer, targetBits, targetKey);
+  }
+
+  const size_t n = overlaps.size();
+  vector<int> &score = buffers.score;
+  vector<long> &prev = buffers.prev;
+  score.assign(n, 0);
+  prev.assign(n, -1);
+  size_t groupBegin = 0;
+  int maxScore = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const Overlap &cur = overlaps[i];
+    if (i > 0 && (overlaps[i - 1].reference_index != cur.reference_index ||
+                  IsReverse(overlaps[i - 1]) != IsReverse(cur)))
+      groupBegin = i;
+
+    score[i] = static_cast<int>(kmer_len);
+    size_t tried = 0;
+    for (size_t j = i; j > groupBegin && tried < options.max_predecessors;
+         ++tried) {
+      const Overlap &last = overlaps[--j];
+      unsigned int targetGap = cur.reference_pos - last.reference_pos;
+      if (targetGap > options.max_gap)
+        break;
+      if (targetGap == 0 || cur.query_pos <= last.query_pos)
+        continue;
+      unsigned int queryGap = cur.query_pos - last.query_pos;
+      if (queryGap > options.max_gap)
+        continue;
+      unsigned int gap = targetGap > queryGap ? targetGap - queryGap
+                                              : queryGap - targetGap;
+      if (gap > options.bandwidth)
+        continue;
+
+      int extended = score[j] +
+                     static_cast<int>(std::min({queryGap, targetGap,
+                                                kmer_len})) -
+                     GapCost(gap, kmer_len);
+      if (extended > score[i]) {
+        score[i] = extended;
+        prev[i] = static_cast<long>(j);
+      }
+    }
+    maxScore = std::max(maxScore, score[i]);
+  }
+
+  // chains are traced back from their best ends down, and stop at matches
+  // of better chains
+  vector<std::uint32_t> &ends = buffers.ends;
+  ends.resize(n);
+  std::iota(ends.begin(), ends.end(), std::uint32_t(0));
+  RadixSort(ends, buffers.endsBuffer, BitWidth(std::uint64_t(maxScore)),
+            [&](std::uint32_t x) {
+              return static_cast<std::uint32_t>(maxScore - score[x]);
+            });
+
+  vector<std::uint8_t> &used = buffers.used;
+  vector<std::uint32_t> &traced = buffers.traced;
+  vector<ChainTrace> &traces = buffers.traces;
+  used.assign(n, 0);
+  traced.clear();
+  traces.clear();
+  for (std::uint32_t i : ends) {
+    if (used[i])
+      continue;
+    const size_t begin = traced.size();
+    long j = static_cast<long>(i);
+    for (; j != -1 && !used[static_cast<size_t>(j)];
+         j = prev[static_cast<size_t>(j)]) {
+      used[static_cast<size_t>(j)] = 1;
+      traced.push_back(static_cast<std::uint32_t>(j));
+    }
+    const size_t size = traced.size() - begin;
+    int chainScore =
+        score[i] - (j == -1 ? 0 : score[static_cast<size_t>(j)]);
+    if (size < options.min_matches || chainScore < options.min_score) {
+      traced.resize(begin);
+      continue;
+    }
+
+    const Overlap &first = overlaps[traced.back()];
+    const Overlap &last = overlaps[i];
+    ChainTrace trace = {};
+    trace.score = chainScore;
+    trace.order = traces.size();
+    trace.begin = begin;
+    trace.size = size;
+    trace.query_begin = first.query_pos;
+    trace.query_end = last.query_pos + kmer_len;
+    if (IsReverse(first)) {
+      trace.query_begin = query_len - trace.query_end;
+      trace.query_end = query_len - first.query_pos;
+    }
+    traces.push_back(trace);
+  }
+  std::sort(traces.begin(), traces.end(),
+            [](const ChainTrace &x, const ChainTrace &y) {
+              return x.score != y.score ? x.score > y.score
+                                        : x.order < y.order;
+            });
+
+  // every chain is either a secondary chain of the first better primary or
+  // supplementary chain it mostly overlaps on the query, or one itself
+  bool hasPrimary = false;
+  for (size_t i = 0; i < traces.size(); ++i) {
+    ChainTrace &trace = traces[i];
+    size_t p = 0;
+    for (; p < i; ++p) {
+      const ChainTrace &other = traces[p];
+      if (other.kind == ChainKind::secondary)
+        continue;
+      unsigned int begin = std::max(trace.query_begin, other.query_begin);
+      unsigned int end = std::min(trace.query_end, other.query_end);
+      unsigned int shorter =
+          std::min(trace.query_end - trace.query_begin,
+                   other.query_end - other.query_begin);
+      if (begin < end && end - begin >= options.mask_level * shorter)
+        break;
+    }
+    if (p == i) {
+      trace.kind = hasPrimary ? ChainKind::supplementary : ChainKind::primary;
+      hasPrimary = true;
+      continue;
+    }
+    trace.kind = ChainKind::secondary;
+    trace.parent = p;
+    traces[p].secondaryScore = std::max(traces[p].secondaryScore, trace.score);
+  }
+
+  // the quality counts every secondary chain, of which only the best ones
+  // are reported
+  size_t reportedTotal = 0;
+  for (ChainTrace &trace : traces) {
+    trace.reported = true;
+    if (trace.kind == ChainKind::secondary) {
+      ChainTrace &parent = traces[trace.parent];
+      trace.reported = trace.score >= options.secondary_ratio * parent.score &&
+                       parent.secondaryCount < options.max_secondary;
+      parent.secondaryCount += trace.reported;
+    }
+    reportedTotal += trace.reported;
+  }
+
+  vector<BasicChain<KmerT>> ret;
+  ret.reserve(reportedTotal);
+  for (const ChainTrace &trace : traces) {
+    if (!trace.reported)
+      continue;
+    BasicChain<KmerT> chain;
+    chain.matches.reserve(trace.size);
+    for (size_t i = trace.begin + trace.size; i > trace.begin; --i)
+      chain.matches.push_back(overlaps[traced[i - 1]]);
+    chain.reference_index = chain.matches[0].reference_index;
+    chain.is_reverse = IsReverse(chain.matches[0]);
+    chain.kind = trace.kind;
+    chain.score = trace.score;
+    chain.mapq = trace.kind == ChainKind::secondary
+                     ? 0
+                     : MappingQuality(trace.score, trace.secondaryScore,
+                                      trace.size);
+    chain.query_begin = trace.query_begin;
+    chain.query_end = trace.query_end;
+    chain.reference_begin = chain.matches[0].reference_pos;
+    chain.reference_end = chain.matches.back().reference_pos + kmer_len;
+    ret.push_back(std::move(chain));
+  }
+  return ret;
+}
+
+template class ChainingWorkspace<std::uint32_t>;
+template class ChainingWorkspace<std::uint64_t>;
+
+template std::vector<BasicChain<std::uint32_t>>
+ChainOverlaps<std::uint32_t>(std::vector<BasicOverlap<std::uint32_t>>,
+                             unsigned int, unsigned int, const ChainOptions &);
+template std::vector<BasicChain<std::uint64_t>>
+ChainOverlaps<std::uint64_t>(std::vector<BasicOverlap<std::uint64_t>>,
+                             unsigned int, unsigned int, const ChainOptions &);
+
+template std::vector<BasicChain<std::uint32_t>>
+ChainOverlaps<std::uint32_t>(ChainingWorkspace<std::uint32_t> &, unsigned int,
+                             unsigned int, const ChainOptions &);
+template std::vector<BasicChain<std::uint64_t>>
+ChainOverlaps<std::uint64_t>(ChainingWorkspace<std::uint64_t> &, unsigned int,
+                             unsigned int, const ChainOptions &);
+
+} // namespace crimson
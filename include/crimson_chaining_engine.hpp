@@ -0,0 +1,105 @@
+#ifndef CRIMSON_CHAINING_ENGINE_HPP_
+#define CRIMSON_CHAINING_ENGINE_HPP_
+
+#include "crimson_minimizer_engine.hpp"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace crimson {
+
+struct ChainOptions {
+  // largest distance between consecutive matches of a chain on either
+  // sequence, and largest difference of their diagonals
+  unsigned int max_gap = 5000;
+  unsigned int bandwidth = 500;
+  // number of preceding matches each match tries to extend
+  unsigned int max_predecessors = 50;
+  // smallest score and number of matches of a reported chain
+  int min_score = 40;
+  unsigned int min_matches = 3;
+  // secondary chains reported per primary one, and the fraction of its
+  // score they need
+  unsigned int max_secondary = 5;
+  double secondary_ratio = 0.8;
+  // fraction of the shorter query span two chains have to share for one to
+  // be a secondary chain of the other
+  double mask_level = 0.5;
+};
+
+enum class ChainKind { primary, secondary, supplementary };
+
+// Colinear minimizer matches on one strand of a reference. Matches are in
+// increasing order on both sequences, so the query positions of reverse
+// chains are positions on the reverse complement of the query. The query
+// span is given on the query itself.
+template <typename KmerT> struct BasicChain {
+  std::vector<BasicOverlap<KmerT>> matches;
+  unsigned int reference_index;
+  bool is_reverse;
+  ChainKind kind;
+  int score;
+  // mapping quality, 0 for secondary chains
+  unsigned int mapq;
+  unsigned int query_begin;
+  unsigned int query_end;
+  unsigned int reference_begin;
+  unsigned int reference_end;
+};
+
+using Chain = BasicChain<unsigned int>;
+
+// Matches of a query and the scratch space of chaining them, which grow to
+// the most matches chained with them and are reused by later queries, so a
+// worker which keeps its own workspace gathers and chains matches without
+// allocating once it has grown.
+template <typename KmerT> class ChainingWorkspace {
+public:
+  ChainingWorkspace();
+  ~ChainingWorkspace();
+
+  ChainingWorkspace(ChainingWorkspace &&) noexcept;
+  ChainingWorkspace &operator=(ChainingWorkspace &&) noexcept;
+
+  // Matches to chain, as MinimizerIndex::Overlaps puts them, which
+  // ChainOverlaps reorders
+  std::vector<BasicOverlap<KmerT>> &overlaps();
+
+  // Bytes allocated by the buffers
+  size_t capacity() const;
+
+  // Buffers, opaque outside of the chaining engine
+  struct Buffers;
+  Buffers &buffers() { return *buffers_; }
+
+private:
+  std::unique_ptr<Buffers> buffers_;
+};
+
+// Chains the matches of a query of query_len bases found by
+// MinimizerIndex::Overlaps. Matches are radix sorted by reference, strand
+// and position, so the work depends only on their number and not on the
+// number of references, and every match extends the best of the
+// max_predecessors matches before it, where each chained match adds up to
+// kmer_len new bases and a gap of diagonals costs 0.01 * kmer_len * gap +
+// log2(gap) / 2.
+//
+// Chains are taken from the best one down and never share matches. They
+// are returned in decreasing order of score: a chain which covers most of
+// the query span of a better one is its secondary chain, every other one
+// is the primary chain or, if there is one already, a supplementary chain.
+template <typename KmerT>
+std::vector<BasicChain<KmerT>>
+ChainOverlaps(std::vector<BasicOverlap<KmerT>> overlaps,
+              unsigned int kmer_len, unsigned int query_len,
+              const ChainOptions &options = {});
+
+// Same chains of the matches in workspace, with its buffers
+template <typename KmerT>
+std::vector<BasicChain<KmerT>>
+ChainOverlaps(ChainingWorkspace<KmerT> &workspace, unsigned int kmer_len,
+              unsigned int query_len, const ChainOptions &options = {});
+
+} // namespace crimson
+
+#endif // CRIMSON_CHAINING_ENGINE_HPP_
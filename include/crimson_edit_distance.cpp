@@ -0,0 +1,325 @@
+#include "crimson_edit_distance.hpp"
+#include "crimson_output.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace crimson {
+
+namespace {
+
+using uint = unsigned int;
+using Word = std::uint64_t;
+
+constexpr uint kWordBits = 64;
+constexpr Word kHighBit = Word(1) << (kWordBits - 1);
+constexpr int kUnreachable = std::numeric_limits<int>::max() / 2;
+
+// Vertical deltas of 64 rows of a column, P set where a cell is one more
+// than the cell above and M where it is one less, and the bottom cell
+struct Block {
+  Word P;
+  Word M;
+  int score;
+};
+
+// Advances a block by one column given the positions of the column's base
+// in the query rows, and the horizontal delta hin above the block. Returns
+// the horizontal delta of its bottom cell. Hyyrö's formulation of Myers'
+// algorithm.
+int AdvanceBlock(Block &block, Word Eq, int hin) {
+  const Word hinIsNegative = hin < 0 ? 1 : 0;
+  const Word Xv = Eq | block.M;
+  Eq |= hinIsNegative;
+  const Word Xh = (((Eq & block.P) + block.P) ^ block.P) | Eq;
+  Word Ph = block.M | ~(Xh | block.P);
+  Word Mh = block.P & Xh;
+
+  int hout = 0;
+  if (Ph & kHighBit)
+    hout = 1;
+  else if (Mh & kHighBit)
+    hout = -1;
+
+  Ph <<= 1;
+  Mh <<= 1;
+  Mh |= hinIsNegative;
+  if (hin > 0)
+    Ph |= 1;
+  block.P = Mh | ~(Xv | Ph);
+  block.M = Ph & Xv;
+  block.score += hout;
+  return hout;
+}
+
+// Cell of row bit r of the block, counting from its top
+int CellAt(const Block &block, uint r) {
+  if (r + 1 == kWordBits)
+    return block.score;
+  return block.score - __builtin_popcountll(block.P >> (r + 1)) +
+         __builtin_popcountll(block.M >> (r + 1));
+}
+
+// Computed blocks of every column, kept for the traceback
+struct Columns {
+  std::vector<uint> first, last;
+  std::vector<size_t> begin;
+  std::vector<Block> blocks;
+
+  void Clear() {
+    first.clear();
+    last.clear();
+    begin.clear();
+    blocks.clear();
+  }
+  void Push(uint firstBlock, uint lastBlock, const std::vector<Block> &band) {
+    first.push_back(firstBlock);
+    last.push_back(lastBlock);
+    begin.push_back(blocks.size());
+    blocks.insert(blocks.end(), band.begin() + long(firstBlock),
+                  band.begin() + long(lastBlock) + 1);
+  }
+};
+
+class Myers {
+public:
+  Myers(const char *query, uint query_len, const char *target,
+        uint target_len, AlignmentType type)
+      : query_(query), target_(target), n_(query_len), m_(target_len),
+        isGlobal_(type == AlignmentType::global),
+        blocksTotal_((query_len + kWordBits - 1) / kWordBits),
+        symbol_(256, 0) {
+    // symbol 0 stands for every base which is not in the query
+    uint symbols = 1;
+    for (uint i = 0; i < n_; ++i) {
+      unsigned char base = static_cast<unsigned char>(query_[i]);
+      if (symbol_[base] == 0)
+        symbol_[base] = symbols++;
+    }
+    Peq_.assign(size_t(symbols) * blocksTotal_, 0);
+    for (uint i = 0; i < n_; ++i) {
+      size_t symbol = symbol_[static_cast<unsigned char>(query_[i])];
+      Peq_[symbol * blocksTotal_ + i / kWordBits] |= Word(1) << (i % kWordBits);
+    }
+    // rows past the query match everything, so they do not raise the bottom
+    // cell of the last block
+    const uint padding = blocksTotal_ * kWordBits - n_;
+    if (padding > 0) {
+      Word mask = ~Word(0) << (kWordBits - padding);
+      for (uint s = 0; s < symbols; ++s)
+        Peq_[size_t(s) * blocksTotal_ + blocksTotal_ - 1] |= mask;
+    }
+  }
+
+  // Distance if it is at most k, kUnreachable otherwise. The end column of
+  // semiglobal alignments is the first with the least distance.
+  int Run(int k, Columns *columns, uint *end) {
+    const uint limit = uint(k);
+    std::vector<Block> band(blocksTotal_);
+    for (uint b = 0; b < blocksTotal_; ++b)
+      band[b] = {~Word(0), 0, int((b + 1) * kWordBits)};
+
+    // rows up to k of column 0 hold cells up to k
+    uint first = 0;
+    uint last = std::min(blocksTotal_ - 1, limit / kWordBits);
+    if (columns != nullptr) {
+      columns->Clear();
+      columns->Push(first, last, band);
+    }
+
+    int best = kUnreachable;
+    if (last + 1 == blocksTotal_ && int(n_) <= k) {
+      best = int(n_);
+      *end = 0;
+    }
+
+    for (uint j = 1; j <= m_; ++j) {
+      const Word *Eq =
+          Peq_.data() +
+          size_t(symbol_[static_cast<unsigned char>(target_[j - 1])]) *
+              blocksTotal_;
+
+      int hout = isGlobal_ ? 1 : 0;
+      for (uint b = first; b <= last; ++b)
+        hout = AdvanceBlock(band[b], Eq[b], hout);
+
+      // a block below is needed once a cell next to it may be within k,
+      // its cells in the previous column are taken as the bottom cell above
+      // plus their distance to it
+      while (last + 1 < blocksTotal_ && band[last].score <= k + 1 &&
+             (!isGlobal_ || (last + 1) * kWordBits + 1 <= j + limit)) {
+        int previous = band[last].score - hout + int(kWordBits);
+        ++last;
+        band[last] = {~Word(0), 0, previous};
+        hout = AdvanceBlock(band[last], Eq[last], hout);
+      }
+      // blocks whose cells all exceed k are dropped
+      while (last > first && band[last].score >= k + int(kWordBits))
+        --last;
+      if (isGlobal_)
+        while (first < last && (first + 1) * kWordBits + limit < j)
+          ++first;
+      if (band[last].score >= k + int(kWordBits) ||
+          (isGlobal_ && (last + 1) * kWordBits + limit < j))
+        return kUnreachable;
+
+      if (columns != nullptr)
+        columns->Push(first, last, band);
+
+      if (!isGlobal_ && last + 1 == blocksTotal_) {
+        int distance = CellAt(band[last], (n_ - 1) % kWordBits);
+        if (distance < best && distance <= k) {
+          best = distance;
+          *end = j;
+        }
+      }
+    }
+
+    if (isGlobal_) {
+      if (last + 1 < blocksTotal_)
+        return kUnreachable;
+      int distance = CellAt(band[last], (n_ - 1) % kWordBits);
+      if (distance > k)
+        return kUnreachable;
+      *end = m_;
+      return distance;
+    }
+    return best;
+  }
+
+  // Traces the alignment ending in cell (n, end) back through the columns,
+  // appends its cigar and returns the target position it starts at
+  uint TraceBack(const Columns &columns, uint end, std::string *cigar) const {
+    auto cell = [&](uint i, uint j) {
+      if (i == 0)
+        return isGlobal_ ? int(j) : 0;
+      uint b = (i - 1) / kWordBits;
+      if (b < columns.first[j] || b > columns.last[j])
+        return kUnreachable;
+      return CellAt(columns.blocks[columns.begin[j] + b - columns.first[j]],
+                    (i - 1) % kWordBits);
+    };
+
+    std::vector<char> path;
+    uint i = n_, j = end;
+    while (true) {
+      if (i == 0) {
+        // the target may start anywhere in semiglobal alignments
+        if (!isGlobal_ || j == 0)
+          break;
+        j--;
+        path.push_back('D');
+        continue;
+      }
+      if (j == 0) {
+        i--;
+        path.push_back('I');
+        continue;
+      }
+
+      // same preference of moves as the traceback of Align
+      int current = cell(i, j);
+      int mismatch = query_[i - 1] == target_[j - 1] ? 0 : 1;
+      if (cell(i - 1, j - 1) + mismatch == current) {
+        i--;
+        j--;
+        path.push_back('M');
+      } else if (cell(i - 1, j) + 1 == current) {
+        i--;
+        path.push_back('I');
+      } else {
+        j--;
+        path.push_back('D');
+      }
+    }
+
+    std::reverse(path.begin(), path.end());
+    for (size_t k = 0, run = 1; k < path.size(); ++k, ++run) {
+      if (k + 1 == path.size() || path[k] != path[k + 1]) {
+        AppendInt(*cigar, run);
+        *cigar += path[k];
+        run = 0;
+      }
+    }
+    return j;
+  }
+
+private:
+  const char *query_;
+  const char *target_;
+  uint n_;
+  uint m_;
+  bool isGlobal_;
+  uint blocksTotal_;
+  // symbol of every base and the query rows each symbol is in, by blocks
+  std::vector<uint> symbol_;
+  std::vector<Word> Peq_;
+};
+
+} // namespace
+
+int EditDistance(const char *query, unsigned int query_len, const char *target,
+                 unsigned int target_len, AlignmentType type,
+                 std::string *cigar, unsigned int *target_begin,
+                 int max_distance, unsigned int *query_begin) {
+  if (type == AlignmentType::local)
+    throw std::invalid_argument("[crimson::EditDistance] error: local "
+                                "alignments have no edit distance");
+  const bool needsCigar = cigar != nullptr && target_begin != nullptr;
+  const bool isGlobal = type == AlignmentType::global;
+  // without local alignments, the whole query is aligned
+  if (needsCigar && query_begin != nullptr)
+    *query_begin = 0;
+
+  if (query_len == 0 || target_len == 0) {
+    uint distance = isGlobal ? query_len + target_len : query_len;
+    if (max_distance >= 0 && distance > uint(max_distance))
+      return -1;
+    if (needsCigar) {
+      if (query_len > 0) {
+        AppendInt(*cigar, query_len);
+        *cigar += 'I';
+      }
+      if (isGlobal && target_len > 0) {
+        AppendInt(*cigar, target_len);
+        *cigar += 'D';
+      }
+      *target_begin = 0;
+    }
+    return int(distance);
+  }
+
+  // every distance is at most the larger length, or the query length for a
+  // semiglobal alignment
+  const uint longest = isGlobal ? std::max(query_len, target_len) : query_len;
+  const uint shortest =
+      isGlobal ? std::max(query_len, target_len) -
+                     std::min(query_len, target_len)
+               : 0;
+  if (max_distance >= 0 && shortest > uint(max_distance))
+    return -1;
+
+  Myers myers(query, query_len, target, target_len, type);
+  Columns columns;
+  uint k = std::max(shortest, kWordBits);
+  if (max_distance >= 0)
+    k = std::min(k, uint(max_distance));
+  while (true) {
+    uint end = 0;
+    int distance = myers.Run(int(k), needsCigar ? &columns : nullptr, &end);
+    if (distance != kUnreachable) {
+      if (needsCigar)
+        *target_begin = myers.TraceBack(columns, end, cigar);
+      return distance;
+    }
+    if (max_distance >= 0 && k >= uint(max_distance))
+      return -1;
+    k = k >= longest ? longest : std::min(2 * k, longest);
+    if (max_distance >= 0)
+      k = std::min(k, uint(max_distance));
+  }
+}
+
+} // namespace crimson
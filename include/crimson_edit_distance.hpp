@@ -0,0 +1,28 @@
+#ifndef CRIMSON_EDIT_DISTANCE_HPP_
+#define CRIMSON_EDIT_DISTANCE_HPP_
+
+#include "crimson_alignment_engine.hpp"
+#include <string>
+
+namespace crimson {
+
+// Unit cost edit distance of the whole query to the whole target (global) or
+// to a substring of it (semiglobal), computed with Myers' bit-parallel
+// algorithm in blocks of 64 query rows. Only blocks which may hold cells up
+// to a distance limit are computed, and the limit is doubled until the
+// distance is found, so similar sequences take O(distance * target_len / 64)
+// time.
+//
+// The cigar, target_begin and query_begin are the same as those of Align
+// with match 0, mismatch -1 and gap -1, whose score is the negated distance.
+// Returns -1 if the distance exceeds max_distance, unless that is negative.
+// Throws std::invalid_argument for local alignments.
+int EditDistance(const char *query, unsigned int query_len, const char *target,
+                 unsigned int target_len, AlignmentType type,
+                 std::string *cigar = nullptr,
+                 unsigned int *target_begin = nullptr, int max_distance = -1,
+                 unsigned int *query_begin = nullptr);
+
+} // namespace crimson
+
+#endif // CRIMSON_EDIT_DISTANCE_HPP_
@@ -0,0 +1,276 @@
+#include "crimson_index_file.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crimson {
+
+namespace {
+
+constexpr char kMagic[8] = {'C', 'R', 'I', 'M', 'S', 'I', 'D', 'X'};
+
+// File header, every section offset is a multiple of 8 bytes:
+//   names       name of reference i at [name_begin[i], name_begin[i + 1])
+//   name_begin  references + 1 offsets into names
+//   base_begin  references + 1 offsets of the references into bases
+//   run_begin   references + 1 offsets of the references into runs
+//   runs        non-ACGT runs of every reference, as (begin, length)
+//   bases       all references, 4 bases per byte from the lowest bits up
+//   index       MinimizerIndex::Write output
+struct FileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t kmer_bytes;
+  std::uint64_t references;
+  std::uint64_t names;
+  std::uint64_t name_begin;
+  std::uint64_t base_begin;
+  std::uint64_t run_begin;
+  std::uint64_t runs;
+  std::uint64_t bases;
+  std::uint64_t index;
+  std::uint64_t size;
+};
+
+std::uint64_t Align8(std::uint64_t offset) { return (offset + 7) & ~7ull; }
+
+void Pad(std::ofstream &out, std::uint64_t offset) {
+  static const char zeros[8] = {};
+  std::uint64_t pos = static_cast<std::uint64_t>(out.tellp());
+  out.write(zeros, static_cast<std::streamsize>(offset - pos));
+}
+
+template <typename T> void WriteArray(std::ofstream &out, const T *data,
+                                      size_t size) {
+  out.write(reinterpret_cast<const char *>(data),
+            static_cast<std::streamsize>(size * sizeof(T)));
+}
+
+void Fail(const std::string &path, const char *reason) {
+  throw std::runtime_error("[crimson::IndexFile] error: " + path + ": " +
+                           reason);
+}
+
+} // namespace
+
+template <typename KmerT>
+void IndexFile::Write(const std::string &path,
+                      const MinimizerIndex<KmerT> &index,
+                      const std::vector<std::string_view> &names,
+                      const std::vector<const PackedSequence *> &sequences) {
+  const size_t refsTotal = sequences.size();
+
+  std::vector<std::uint64_t> nameBegin(1, 0), baseBegin(1, 0), runBegin(1, 0);
+  std::vector<Run> runs;
+  for (size_t i = 0; i < refsTotal; ++i) {
+    nameBegin.push_back(nameBegin.back() + names[i].size());
+    baseBegin.push_back(baseBegin.back() + sequences[i]->size());
+    runs.insert(runs.end(), sequences[i]->runs(),
+                sequences[i]->runs() + sequences[i]->num_runs());
+    runBegin.push_back(runs.size());
+  }
+
+  FileHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kIndexFileVersion;
+  header.kmer_bytes = sizeof(KmerT);
+  header.references = refsTotal;
+  header.names = Align8(sizeof(header));
+  header.name_begin = Align8(header.names + nameBegin.back());
+  header.base_begin = header.name_begin + 8 * (refsTotal + 1);
+  header.run_begin = header.base_begin + 8 * (refsTotal + 1);
+  header.runs = header.run_begin + 8 * (refsTotal + 1);
+  header.bases = Align8(header.runs + sizeof(Run) * runs.size());
+  header.index = Align8(header.bases + (baseBegin.back() + 3) / 4);
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out)
+    Fail(path, "can not be opened for writing");
+
+  WriteArray(out, &header, 1);
+  Pad(out, header.names);
+  for (std::string_view name : names)
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  Pad(out, header.name_begin);
+  WriteArray(out, nameBegin.data(), nameBegin.size());
+  WriteArray(out, baseBegin.data(), baseBegin.size());
+  WriteArray(out, runBegin.data(), runBegin.size());
+  WriteArray(out, runs.data(), runs.size());
+  Pad(out, header.bases);
+
+  // bases of consecutive references share bytes, so packing carries the
+  // partial byte over
+  std::vector<std::uint8_t> packed;
+  std::uint8_t byte = 0;
+  unsigned filled = 0;
+  for (const PackedSequence *sequence : sequences) {
+    for (size_t j = 0; j < sequence->size(); ++j) {
+      byte = static_cast<std::uint8_t>(byte | sequence->code(j)
+                                                  << (2 * filled));
+      if (++filled == 4) {
+        packed.push_back(byte);
+        byte = 0;
+        filled = 0;
+      }
+      if (packed.size() == (1u << 20)) {
+        WriteArray(out, packed.data(), packed.size());
+        packed.clear();
+      }
+    }
+  }
+  if (filled != 0)
+    packed.push_back(byte);
+  WriteArray(out, packed.data(), packed.size());
+  Pad(out, header.index);
+
+  index.Write(out);
+  header.size = static_cast<std::uint64_t>(out.tellp());
+  out.seekp(0);
+  WriteArray(out, &header, 1);
+
+  out.close();
+  if (!out)
+    Fail(path, "write failed");
+}
+
+template <typename KmerT>
+void IndexFile::Write(const std::string &path,
+                      const MinimizerIndex<KmerT> &index,
+                      const std::vector<std::string_view> &names,
+                      const std::vector<std::string_view> &sequences) {
+  std::vector<PackedSequence> packed;
+  std::vector<const PackedSequence *> packedSequences;
+  packed.reserve(sequences.size());
+  for (std::string_view sequence : sequences) {
+    packed.emplace_back(sequence);
+    packedSequences.push_back(&packed.back());
+  }
+  Write(path, index, names, packedSequences);
+}
+
+bool IndexFile::Detect(const std::string &path) {
+  char magic[sizeof(kMagic)];
+  std::ifstream in(path, std::ios::binary);
+  return in.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+IndexFile::IndexFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    Fail(path, "can not be opened");
+
+  struct stat status;
+  if (fstat(fd, &status) == -1) {
+    close(fd);
+    Fail(path, "can not be read");
+  }
+  mappingSize_ = static_cast<size_t>(status.st_size);
+
+  FileHeader header;
+  if (mappingSize_ < sizeof(header)) {
+    close(fd);
+    Fail(path, "is not an index file");
+  }
+
+  mapping_ = mmap(nullptr, mappingSize_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping_ == MAP_FAILED) {
+    mapping_ = nullptr;
+    Fail(path, "can not be mapped");
+  }
+
+  const char *data = static_cast<const char *>(mapping_);
+  std::memcpy(&header, data, sizeof(header));
+  try {
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+      Fail(path, "is not an index file");
+    if (header.version != kIndexFileVersion)
+      Fail(path, "index file version is not supported");
+
+    const std::uint64_t offsets = 8 * (header.references + 1);
+    if (header.size != mappingSize_ || header.references > mappingSize_ ||
+        header.names > header.name_begin ||
+        header.name_begin + offsets != header.base_begin ||
+        header.base_begin + offsets != header.run_begin ||
+        header.run_begin + offsets != header.runs ||
+        header.runs > header.bases || header.bases > header.index ||
+        header.index > header.size)
+      Fail(path, "index file is corrupted");
+
+    kmerBytes_ = header.kmer_bytes;
+    refsTotal_ = header.references;
+    names_ = data + header.names;
+    nameBegin_ =
+        reinterpret_cast<const std::uint64_t *>(data + header.name_begin);
+    baseBegin_ =
+        reinterpret_cast<const std::uint64_t *>(data + header.base_begin);
+    runBegin_ =
+        reinterpret_cast<const std::uint64_t *>(data + header.run_begin);
+    runs_ = reinterpret_cast<const Run *>(data + header.runs);
+    bases_ = reinterpret_cast<const std::uint8_t *>(data + header.bases);
+    index_ = data + header.index;
+    indexSize_ = header.size - header.index;
+
+    // references are read between consecutive offsets, so bounding the
+    // last one bounds them all only if none of them decreases
+    for (size_t i = 0; i < refsTotal_; ++i)
+      if (nameBegin_[i] > nameBegin_[i + 1] ||
+          baseBegin_[i] > baseBegin_[i + 1] || runBegin_[i] > runBegin_[i + 1])
+        Fail(path, "index file is corrupted");
+    if (nameBegin_[refsTotal_] > header.name_begin - header.names ||
+        (baseBegin_[refsTotal_] + 3) / 4 > header.index - header.bases ||
+        runBegin_[refsTotal_] * sizeof(Run) > header.bases - header.runs)
+      Fail(path, "index file is corrupted");
+  } catch (...) {
+    munmap(mapping_, mappingSize_);
+    throw;
+  }
+}
+
+IndexFile::~IndexFile() {
+  if (mapping_ != nullptr)
+    munmap(mapping_, mappingSize_);
+}
+
+std::string_view IndexFile::name(size_t i) const {
+  return std::string_view(
+      names_ + nameBegin_[i],
+      static_cast<size_t>(nameBegin_[i + 1] - nameBegin_[i]));
+}
+
+PackedSequence IndexFile::sequence(size_t i) const {
+  return PackedSequence::View(
+      bases_, static_cast<size_t>(baseBegin_[i]), length(i),
+      runs_ + runBegin_[i],
+      static_cast<size_t>(runBegin_[i + 1] - runBegin_[i]));
+}
+
+void IndexFile::Extract(size_t i, size_t begin, size_t end,
+                        std::string &out) const {
+  sequence(i).Unpack(begin, end, out);
+}
+
+template void IndexFile::Write<std::uint32_t>(
+    const std::string &, const MinimizerIndex<std::uint32_t> &,
+    const std::vector<std::string_view> &,
+    const std::vector<const PackedSequence *> &);
+template void IndexFile::Write<std::uint64_t>(
+    const std::string &, const MinimizerIndex<std::uint64_t> &,
+    const std::vector<std::string_view> &,
+    const std::vector<const PackedSequence *> &);
+template void IndexFile::Write<std::uint32_t>(
+    const std::string &, const MinimizerIndex<std::uint32_t> &,
+    const std::vector<std::string_view> &,
+    const std::vector<std::string_view> &);
+template void IndexFile::Write<std::uint64_t>(
+    const std::string &, const MinimizerIndex<std::uint64_t> &,
+    const std::vector<std::string_view> &,
+    const std::vector<std::string_view> &);
+
+} // namespace crimson
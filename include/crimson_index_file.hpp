@@ -0,0 +1,88 @@
+#ifndef CRIMSON_INDEX_FILE_HPP_
+#define CRIMSON_INDEX_FILE_HPP_
+
+#include "crimson_minimizer_engine.hpp"
+#include "crimson_packed_sequence.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crimson {
+
+constexpr std::uint32_t kIndexFileVersion = 2;
+
+// Index file holding a filtered minimizer index together with the names,
+// lengths and sequences of its references. Sequences are packed 2 bits per
+// base and every other character is restored as N from a list of runs.
+//
+// The file is mapped read-only and used in place, so opening it costs no
+// parsing and processes which open the same file share its pages.
+class IndexFile {
+public:
+  // Writes the index of the given references to path. Throws
+  // std::runtime_error if the file can not be written.
+  template <typename KmerT>
+  static void Write(const std::string &path, const MinimizerIndex<KmerT> &index,
+                    const std::vector<std::string_view> &names,
+                    const std::vector<const PackedSequence *> &sequences);
+
+  // Same as above for references given as text
+  template <typename KmerT>
+  static void Write(const std::string &path, const MinimizerIndex<KmerT> &index,
+                    const std::vector<std::string_view> &names,
+                    const std::vector<std::string_view> &sequences);
+
+  // Whether the file at path starts like an index file
+  static bool Detect(const std::string &path);
+
+  // Maps the file at path. Throws std::runtime_error if it can not be read
+  // or is not an index file of this version.
+  explicit IndexFile(const std::string &path);
+  ~IndexFile();
+
+  IndexFile(const IndexFile &) = delete;
+  IndexFile &operator=(const IndexFile &) = delete;
+
+  // Size of the k-mer type the index was built with
+  unsigned int kmer_bytes() const { return kmerBytes_; }
+
+  // Index over the mapped file, valid while the file is open
+  template <typename KmerT> MinimizerIndex<KmerT> Index() const {
+    return MinimizerIndex<KmerT>::View(index_, indexSize_);
+  }
+
+  size_t num_references() const { return refsTotal_; }
+  std::string_view name(size_t i) const;
+  size_t length(size_t i) const {
+    return static_cast<size_t>(baseBegin_[i + 1] - baseBegin_[i]);
+  }
+
+  // Packed bases of reference i, valid while the file is open
+  PackedSequence sequence(size_t i) const;
+
+  // Appends bases [begin, end) of reference i to out
+  void Extract(size_t i, size_t begin, size_t end, std::string &out) const;
+
+private:
+  using Run = PackedSequence::Run;
+
+  void *mapping_ = nullptr;
+  size_t mappingSize_ = 0;
+
+  unsigned int kmerBytes_ = 0;
+  size_t refsTotal_ = 0;
+  const std::uint64_t *nameBegin_ = nullptr;
+  const char *names_ = nullptr;
+  const std::uint64_t *baseBegin_ = nullptr;
+  const std::uint64_t *runBegin_ = nullptr;
+  const Run *runs_ = nullptr;
+  const std::uint8_t *bases_ = nullptr;
+  const char *index_ = nullptr;
+  size_t indexSize_ = 0;
+};
+
+} // namespace crimson
+
+#endif // CRIMSON_INDEX_FILE_HPP_
\ No newline at end of file
@@ -1,240 +1,1005 @@
 #include "crimson_minimizer_engine.hpp"
+#include "crimson_radix_sort.hpp"
 #include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <optional>
+#include <ostream>
 #include <queue>
 #include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
 namespace crimson {
 
-unsigned int CompressBase(char base, bool reverse = false) {
-  if (reverse) {
-    if (base == 'A')
-      base = 'T';
-    else if (base == 'C')
-      base = 'G';
-    else if (base == 'G')
-      base = 'C';
-    else if (base == 'T')
-      base = 'A';
-  }
-  if (base == 'A')
-    return 0;
-  else if (base == 'C')
-    return 1;
-  else if (base == 'G')
-    return 2;
-  else // if (base == 'T')
-    return 3;
-}
-
-bool MinKmerCmp(std::tuple<unsigned int, unsigned int, bool> a,
-                std::tuple<unsigned int, unsigned int, bool> b) {
-  using std::get;
-  return std::tuple(get<0>(a), -(int)get<1>(a), get<2>(a)) <
-         std::tuple(get<0>(b), -(int)get<1>(b), get<2>(b));
+namespace {
+
+// 2-bit codes of a packed base and of its complement, N is treated as T on
+// both strands
+constexpr unsigned char kForwardCodes[5] = {0, 1, 2, 3, 3};
+constexpr unsigned char kComplementCodes[5] = {3, 2, 1, 0, 3};
+
+// Codes of the bases of a text from a position on
+struct TextCursor {
+  const char *next;
+
+  unsigned char Next() {
+    return kPackCodes.code[static_cast<unsigned char>(*next++)];
+  }
+};
+
+TextCursor BasesFrom(const char *sequence, unsigned int pos) {
+  return {sequence + pos};
 }
 
-std::vector<std::tuple<unsigned int, unsigned int, bool>>
-Minimize(const char *sequence, unsigned int sequence_len, unsigned int kmer_len,
-         unsigned int window_len) {
-  using std::get;
-  using std::multiset;
-  using std::queue;
-  using std::tuple;
-  using std::vector;
-  typedef tuple<unsigned int, unsigned int, bool> uub;
+PackedSequence::Cursor BasesFrom(const PackedSequence &sequence,
+                                 unsigned int pos) {
+  return PackedSequence::Cursor(sequence, pos);
+}
 
-  vector<uub> ret;
+template <typename KmerT> void CheckKmerLen(unsigned int kmer_len) {
+  if (kmer_len > kMaxKmerLen<KmerT>)
+    throw std::invalid_argument(
+        "[crimson::Minimize] error: k-mer length " + std::to_string(kmer_len) +
+        " does not fit into " + std::to_string(sizeof(KmerT) * 8) +
+        "-bit k-mers");
+}
 
-  multiset<uub, decltype(&MinKmerCmp)> windowKmers(&MinKmerCmp);
-  queue<uub> kmerQueue;
-  unsigned curKmer = 0, curKmerRev = 0;
-  unsigned curMin, curMinI;
-  bool curMinOrigin;
+// Positions of index entries share 32 bits with their strand
+constexpr size_t kMaxReferenceLen = size_t(1) << 31;
 
-  std::cout << '\n';
+void CheckReferenceLen(size_t len) {
+  if (len >= kMaxReferenceLen)
+    throw std::invalid_argument(
+        "[crimson::MinimizerIndex] error: reference of " + std::to_string(len) +
+        " bases is too long, references are limited to 2^31 bases");
+}
 
-  for (unsigned i = 0; i < sequence_len; ++i) {
-    curKmer *= 4u;
-    curKmer += CompressBase(sequence[i]);
-    curKmer &= (1 << (kmer_len * 2)) - 1;
-    curKmerRev *= 4u;
-    curKmerRev += CompressBase(sequence[i], true);
-    curKmerRev &= (1 << (kmer_len * 2)) - 1;
+// Longest window whose ring buffer MinimizeWindows keeps on the stack
+constexpr unsigned int kStackWindowLen = 64;
+
+// Minimizers ahead of the current lookup whose buckets are prefetched, and
+// minimizers looked up at once when matches are gathered
+constexpr size_t kPrefetchDistance = 16;
+constexpr size_t kLookupBlock = 256;
+
+// Hint to load the cache line at address, which may be invalid
+inline void Prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address);
+#else
+  (void)address;
+#endif
+}
 
-    if (i < kmer_len - 1)
+// Last emitted minimizer, the next window always emits before it is set
+template <typename KmerT> struct WindowState {
+  KmerT kmer = 0;
+  unsigned int pos = 0;
+  bool origin = false;
+  bool started = false;
+};
+
+// Emits (kmer, pos, origin) of minimizers for windows whose last k-mer starts
+// in [pos_begin, pos_end), continuing from state, until emit returns false.
+// pos_begin has to be at least window_len - 1.
+//
+// Window minimum is kept in a monotone deque stored in a ring buffer of
+// window_len slots: k-mers are strictly increasing from front to back, so the
+// front is the smallest k-mer of the window, the rightmost one on ties
+template <typename KmerT, typename Sequence, typename Emit>
+void MinimizeWindows(const Sequence &sequence, unsigned int kmer_len,
+                     unsigned int window_len, unsigned int pos_begin,
+                     unsigned int pos_end, WindowState<KmerT> &state,
+                     Emit emit) {
+  struct WindowKmer {
+    KmerT kmer;
+    unsigned pos;
+    bool origin;
+  };
+
+  // the usual windows fit on the stack, so minimizing a read allocates
+  // nothing
+  WindowKmer stackWindow[kStackWindowLen];
+  std::vector<WindowKmer> heapWindow;
+  WindowKmer *window = stackWindow;
+  if (window_len > kStackWindowLen) {
+    heapWindow.resize(window_len);
+    window = heapWindow.data();
+  }
+  unsigned head = 0, size = 0;
+
+  const KmerT mask = kmer_len == kMaxKmerLen<KmerT>
+                         ? ~KmerT(0)
+                         : (KmerT(1) << (kmer_len * 2)) - 1;
+  // k-mer and its reverse complement, whose first base is the complement of
+  // the last base of the k-mer
+  KmerT curKmer = 0, curKmerRev = 0;
+  const unsigned int revShift = 2 * (kmer_len - 1);
+
+  const unsigned first = pos_begin - (window_len - 1);
+  const unsigned last = pos_end + kmer_len - 1;
+
+  auto bases = BasesFrom(sequence, first);
+  for (unsigned i = first; i < last; ++i) {
+    unsigned char code = bases.Next();
+    curKmer = ((curKmer << 2) | kForwardCodes[code]) & mask;
+    curKmerRev = (curKmerRev >> 2) |
+                 static_cast<KmerT>(KmerT(kComplementCodes[code]) << revShift);
+
+    if (i < first + kmer_len - 1)
       continue;
 
-    unsigned minCurKmer;
-    bool isOriginal;
+    unsigned pos = i - kmer_len + 1;
+    bool isOriginal = curKmer < curKmerRev;
+    KmerT minCurKmer = isOriginal ? curKmer : curKmerRev;
 
-    if (curKmer < curKmerRev) {
-      minCurKmer = curKmer;
-      isOriginal = true;
-    } else {
-      minCurKmer = curKmerRev;
-      isOriginal = false;
+    if (size > 0 && window[head].pos + window_len <= pos) {
+      head = head + 1 == window_len ? 0 : head + 1;
+      --size;
     }
+    while (size > 0) {
+      unsigned back = head + size - 1;
+      if (back >= window_len)
+        back -= window_len;
+      if (window[back].kmer < minCurKmer)
+        break;
+      --size;
+    }
+    unsigned tail = head + size;
+    if (tail >= window_len)
+      tail -= window_len;
+    window[tail] = {minCurKmer, pos, isOriginal};
+    ++size;
 
-    uub curKmerData = {minCurKmer, i - kmer_len + 1, isOriginal};
-
-    windowKmers.insert(curKmerData);
-    kmerQueue.push(curKmerData);
-
-    if (i < window_len + kmer_len - 2)
+    if (pos < pos_begin)
       continue;
 
-    uub setMin = *windowKmers.begin();
+    const WindowKmer &setMin = window[head];
 
-    if (i == window_len + kmer_len - 2 ||
-        i - kmer_len - curMinI + 1 >= window_len || get<0>(setMin) != curMin ||
-        get<2>(setMin) != curMinOrigin) {
-      curMin = get<0>(setMin);
-      curMinI = get<1>(setMin);
-      curMinOrigin = get<2>(setMin);
-      ret.push_back(setMin);
+    if (!state.started || pos - state.pos >= window_len ||
+        setMin.kmer != state.kmer || setMin.origin != state.origin) {
+      state.kmer = setMin.kmer;
+      state.pos = setMin.pos;
+      state.origin = setMin.origin;
+      state.started = true;
+      if (!emit(state.kmer, state.pos, state.origin))
+        return;
     }
-
-    windowKmers.erase(kmerQueue.front());
-    kmerQueue.pop();
   }
+}
 
-  return ret;
+// Runs fn(i) for every i in [0, n) on up to threads threads
+template <typename Fn> void ParallelFor(unsigned int threads, size_t n, Fn fn) {
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < n;)
+      fn(i);
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < std::min<size_t>(threads, n); ++i)
+    pool.emplace_back(worker);
+  worker();
+  for (std::thread &i : pool)
+    i.join();
 }
 
-unsigned int kmer_len_last, window_len_last;
+// Minimizers an index filter leaves out: the ones with more than
+// max_occurrences occurrences, and the most frequent ones down to the one
+// with count occurrences and kmer, in order of decreasing occurrences and
+// then k-mers
+template <typename KmerT> struct DropRule {
+  size_t max_occurrences = SIZE_MAX;
+  bool frequent = false;
+  size_t count = 0;
+  KmerT kmer = 0;
+
+  bool operator()(size_t occurrences, KmerT minimizer) const {
+    return occurrences > max_occurrences ||
+           (frequent && (occurrences > count ||
+                         (occurrences == count && minimizer >= kmer)));
+  }
+};
+
+// Rule of filter for minimizers whose numbers per occurrence count are given
+// by histogram. Only the minimizers with the occurrence count at which the
+// frequent ones end are selected among, given by kmers_with(count).
+template <typename KmerT, typename KmersWith>
+DropRule<KmerT> MakeDropRule(const IndexFilter &filter,
+                             const std::map<size_t, size_t> &histogram,
+                             KmersWith kmers_with) {
+  DropRule<KmerT> rule;
+  if (filter.max_occurrences != 0)
+    rule.max_occurrences = filter.max_occurrences;
+
+  size_t kmersTotal = 0;
+  for (const auto &i : histogram)
+    kmersTotal += i.second;
+  // the threshold is taken relative to the minimizers left in the index, as
+  // erasing them one by one from a hash table used to do
+  size_t removed = 0;
+  while (removed < kmersTotal &&
+         double(removed) < filter.frequency * double(kmersTotal - removed))
+    ++removed;
+  if (removed == 0)
+    return rule;
+
+  auto i = histogram.rbegin();
+  for (; i->second < removed; ++i)
+    removed -= i->second;
+  std::vector<KmerT> ties = kmers_with(i->first);
+  std::nth_element(ties.begin(), ties.begin() + long(removed - 1), ties.end(),
+                   std::greater<KmerT>());
+  rule.frequent = true;
+  rule.count = i->first;
+  rule.kmer = ties[removed - 1];
+  return rule;
+}
 
-size_t refsTotal;
+// Index build work split: windows per reference chunk when multithreaded,
+// and minimizer hash partitions which are sorted independently
+constexpr size_t kMinChunkLen = 1u << 16;
+constexpr size_t kMaxChunkLen = 1u << 24;
+constexpr unsigned int kPartitionBits = 8;
+constexpr size_t kPartitions = size_t(1) << kPartitionBits;
+
+// Minimizers of the text or packed sequence
+template <typename KmerT, typename Sequence>
+std::vector<std::tuple<KmerT, unsigned int, bool>>
+MinimizeSequence(const Sequence &sequence, unsigned int sequence_len,
+                 unsigned int kmer_len, unsigned int window_len) {
+  using std::tuple;
+  using std::vector;
+  typedef tuple<KmerT, unsigned int, bool> uub;
 
-std::unordered_map<unsigned int,
-                   std::vector<std::tuple<unsigned int, unsigned int, bool>>>
-    minLookup;
+  CheckKmerLen<KmerT>(kmer_len);
 
-void ResetData() { minLookup.clear(); }
+  vector<uub> ret;
 
-void Minimize(std::vector<const char *> sequence,
-              std::vector<unsigned int> sequence_len, unsigned int kmer_len,
-              unsigned int window_len) {
-  using std::get;
-  using std::multiset;
-  using std::pair;
-  using std::tuple;
-  using std::unordered_map;
-  using std::vector;
-  typedef tuple<unsigned int, unsigned int, bool> uub;
-  typedef vector<uub> vuub;
+  if (kmer_len == 0 || window_len == 0 ||
+      sequence_len < kmer_len + window_len - 1)
+    return ret;
 
-  kmer_len_last = kmer_len;
-  window_len_last = window_len;
-  refsTotal = sequence.size();
+  ret.reserve(2 * (sequence_len - kmer_len + 1) / (window_len + 1) + 1);
 
-  for (unsigned i = 0; i < sequence.size(); ++i) {
-    vuub mins = Minimize(sequence[i], sequence_len[i], kmer_len, window_len);
+  WindowState<KmerT> state;
+  MinimizeWindows(sequence, kmer_len, window_len, window_len - 1,
+                  sequence_len - kmer_len + 1, state,
+                  [&ret](KmerT kmer, unsigned int pos, bool origin) {
+                    ret.emplace_back(kmer, pos, origin);
+                    return true;
+                  });
 
-    std::reverse(mins.begin(), mins.end());
+  return ret;
+}
 
-    for (uub j : mins) {
-      minLookup[get<0>(j)].push_back({i, get<1>(j), get<2>(j)});
-    }
+} // namespace
+
+template <typename KmerT>
+std::vector<std::tuple<KmerT, unsigned int, bool>>
+Minimize(const char *sequence, unsigned int sequence_len, unsigned int kmer_len,
+         unsigned int window_len) {
+  return MinimizeSequence<KmerT>(sequence, sequence_len, kmer_len,
+                                 window_len);
+}
+
+template <typename KmerT>
+std::vector<std::tuple<KmerT, unsigned int, bool>>
+Minimize(const PackedSequence &sequence, unsigned int kmer_len,
+         unsigned int window_len) {
+  return MinimizeSequence<KmerT>(sequence, (unsigned)sequence.size(),
+                                 kmer_len, window_len);
+}
+
+template <typename KmerT>
+std::uint64_t MinimizerIndex<KmerT>::Hash(KmerT kmer) {
+  std::uint64_t x = kmer;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+template <typename KmerT>
+const typename MinimizerIndex<KmerT>::Bucket *
+MinimizerIndex<KmerT>::Find(KmerT kmer) const {
+  if (tableSize_ == 0)
+    return nullptr;
+  size_t mask = tableSize_ - 1;
+  for (size_t i = static_cast<size_t>(Hash(kmer)) & mask;; i = (i + 1) & mask) {
+    if (tableData_[i].count == 0)
+      return nullptr;
+    if (tableData_[i].kmer == kmer)
+      return &tableData_[i];
   }
 }
 
-void Filter(double frequency) {
-  std::vector<std::pair<unsigned, unsigned>> sizes;
-  for (auto i : minLookup) {
-    sizes.push_back({i.second.size(), i.first});
+template <typename KmerT>
+typename MinimizerIndex<KmerT>::Occurrences
+MinimizerIndex<KmerT>::Query(KmerT kmer) const {
+  const Bucket *bucket = Find(kmer);
+  if (bucket == nullptr)
+    return {nullptr, nullptr};
+  const IndexEntry *first = entriesData_ + bucket->begin;
+  return {first, first + bucket->count};
+}
+
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Query(const KmerT *kmers, size_t count,
+                                  Occurrences *occurrences) const {
+  if (tableSize_ == 0) {
+    std::fill_n(occurrences, count, Occurrences{nullptr, nullptr});
+    return;
   }
-  std::sort(sizes.begin(), sizes.end(),
-            std::greater<std::pair<unsigned, unsigned>>());
-  for (unsigned i = 0; i < frequency * double(minLookup.size()); ++i) {
-    minLookup.erase(sizes[i].second);
+  // the buckets of the next kPrefetchDistance k-mers and the entries found
+  // are loaded while later k-mers are probed, so their cache misses overlap
+  const size_t mask = tableSize_ - 1;
+  auto home = [&](KmerT kmer) {
+    return tableData_ + (static_cast<size_t>(Hash(kmer)) & mask);
+  };
+  for (size_t i = 0; i < count && i < kPrefetchDistance; ++i)
+    Prefetch(home(kmers[i]));
+  for (size_t i = 0; i < count; ++i) {
+    if (i + kPrefetchDistance < count)
+      Prefetch(home(kmers[i + kPrefetchDistance]));
+    occurrences[i] = Query(kmers[i]);
+    if (!occurrences[i].empty())
+      Prefetch(occurrences[i].first);
   }
 }
 
-bool operator<(const Overlap &x, const Overlap &y) {
-  if (x.reference_pos + kmer_len_last <= y.reference_pos &&
-      x.query_pos + kmer_len_last <= y.query_pos)
-    return true;
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Lookup(std::vector<BasicOverlap<KmerT>> &overlaps,
+                                   size_t *offsets) const {
+  const size_t minimizersTotal = overlaps.size();
+  KmerT kmers[kLookupBlock];
+  Occurrences found[kLookupBlock];
+  for (size_t begin = 0; begin < minimizersTotal; begin += kLookupBlock) {
+    const size_t size = std::min(kLookupBlock, minimizersTotal - begin);
+    for (size_t i = 0; i < size; ++i)
+      kmers[i] = overlaps[begin + i].kmer;
+    Query(kmers, size, found);
+    for (size_t i = 0; i < size; ++i) {
+      const BasicOverlap<KmerT> minimizer = overlaps[begin + i];
+      offsets[minimizer.reference_index + 1] += found[i].size();
+      for (const IndexEntry &j : found[i])
+        overlaps.push_back({minimizer.kmer, j.reference_index,
+                            minimizer.query_pos, j.position(),
+                            minimizer.is_original_query, j.is_original()});
+    }
+  }
+  overlaps.erase(overlaps.begin(),
+                 overlaps.begin() + static_cast<long>(minimizersTotal));
+}
 
-  if (x.reference_pos < y.reference_pos && x.query_pos < y.query_pos &&
-      y.reference_pos - x.reference_pos == y.query_pos - x.query_pos)
-    return true;
+// Rebuilds the table from entries grouped by kmers
+template <typename KmerT>
+void MinimizerIndex<KmerT>::BuildTable(const std::vector<KmerT> &kmers) {
+  kmersTotal_ = 0;
+  for (size_t i = 0; i < kmers.size(); ++i)
+    kmersTotal_ += i == 0 || kmers[i] != kmers[i - 1];
+
+  size_t capacity = 1;
+  while (3 * capacity < 4 * kmersTotal_)
+    capacity *= 2;
+  table_.assign(capacity, Bucket{0, 0, 0});
+
+  size_t mask = capacity - 1;
+  for (size_t i = 0, j; i < kmers.size(); i = j) {
+    for (j = i + 1; j < kmers.size() && kmers[j] == kmers[i]; ++j)
+      ;
+    size_t k = static_cast<size_t>(Hash(kmers[i])) & mask;
+    while (table_[k].count != 0)
+      k = (k + 1) & mask;
+    table_[k] = {kmers[i], static_cast<std::uint32_t>(i),
+                 static_cast<std::uint32_t>(j - i)};
+  }
 
-  return false;
+  tableData_ = table_.data();
+  tableSize_ = table_.size();
+  entriesData_ = entries_.data();
+  entriesSize_ = entries_.size();
 }
 
-std::vector<Overlap> Map(const char *sequence, unsigned int sequence_len) {
+namespace {
+
+// Binary layout written by Write: this header, followed by the table buckets
+// and the entries, both as they are laid out in memory
+struct IndexLayout {
+  std::uint32_t kmer_bytes;
+  std::uint32_t kmer_len;
+  std::uint32_t window_len;
+  std::uint32_t reserved;
+  std::uint64_t references;
+  std::uint64_t minimizers;
+  std::uint64_t buckets;
+  std::uint64_t entries;
+};
+
+} // namespace
+
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Write(std::ostream &out) const {
+  IndexLayout layout = {sizeof(KmerT), kmerLen_,    windowLen_,  0,
+                        refsTotal_,    kmersTotal_, tableSize_, entriesSize_};
+  out.write(reinterpret_cast<const char *>(&layout), sizeof(layout));
+  out.write(reinterpret_cast<const char *>(tableData_),
+            static_cast<std::streamsize>(tableSize_ * sizeof(Bucket)));
+  out.write(reinterpret_cast<const char *>(entriesData_),
+            static_cast<std::streamsize>(entriesSize_ * sizeof(IndexEntry)));
+}
+
+template <typename KmerT>
+MinimizerIndex<KmerT> MinimizerIndex<KmerT>::View(const char *data,
+                                                  size_t size) {
+  IndexLayout layout;
+  if (size < sizeof(layout))
+    throw std::invalid_argument("[crimson::MinimizerIndex] error: truncated "
+                                "index data");
+  std::memcpy(&layout, data, sizeof(layout));
+
+  if (layout.kmer_bytes != sizeof(KmerT))
+    throw std::invalid_argument(
+        "[crimson::MinimizerIndex] error: index data holds " +
+        std::to_string(8 * layout.kmer_bytes) + "-bit k-mers instead of " +
+        std::to_string(8 * sizeof(KmerT)) + "-bit ones");
+
+  const size_t tableBytes = layout.buckets * sizeof(Bucket);
+  const size_t entriesBytes = layout.entries * sizeof(IndexEntry);
+  if (layout.kmer_len == 0 || layout.kmer_len > kMaxKmerLen<KmerT> ||
+      layout.buckets == 0 || (layout.buckets & (layout.buckets - 1)) != 0 ||
+      layout.buckets > size || layout.entries > size ||
+      size - sizeof(layout) < tableBytes + entriesBytes ||
+      reinterpret_cast<std::uintptr_t>(data) % alignof(Bucket) != 0)
+    throw std::invalid_argument("[crimson::MinimizerIndex] error: malformed "
+                                "index data");
+
+  MinimizerIndex<KmerT> index;
+  index.kmerLen_ = layout.kmer_len;
+  index.windowLen_ = layout.window_len;
+  index.refsTotal_ = layout.references;
+  index.kmersTotal_ = layout.minimizers;
+  index.tableData_ = reinterpret_cast<const Bucket *>(data + sizeof(layout));
+  index.tableSize_ = layout.buckets;
+  index.entriesData_ =
+      reinterpret_cast<const IndexEntry *>(data + sizeof(layout) + tableBytes);
+  index.entriesSize_ = layout.entries;
+
+  // lookups trust every bucket to lie within the entries, and probe until
+  // they reach an empty one
+  bool hasEmpty = false;
+  for (size_t i = 0; i < index.tableSize_; ++i) {
+    const Bucket &bucket = index.tableData_[i];
+    hasEmpty |= bucket.count == 0;
+    if (bucket.count != 0 && static_cast<std::uint64_t>(bucket.begin) +
+                                     bucket.count >
+                                 layout.entries)
+      throw std::invalid_argument("[crimson::MinimizerIndex] error: index "
+                                  "data has buckets beyond its entries");
+  }
+  if (!hasEmpty)
+    throw std::invalid_argument("[crimson::MinimizerIndex] error: index "
+                                "data has no empty bucket");
+  return index;
+}
+
+// Each reference is split into chunks of windows that are minimized in
+// parallel. A chunk starts without knowing the last minimizer emitted before
+// it, so its beginning is recomputed from the true state of the previous chunk
+// until both runs emit the same position, after which they are identical.
+// Occurrences are then scattered by minimizer hash into thread-local
+// partitions, and every partition is radix sorted on its own. Occurrence
+// counts of the sorted partitions decide what the filter leaves out, after
+// which the rest is written out.
+template <typename KmerT>
+MinimizerIndex<KmerT>::MinimizerIndex(
+    const std::vector<const PackedSequence *> &sequence,
+    unsigned int kmer_len, unsigned int window_len, unsigned int threads,
+    const IndexFilter &filter) {
   using std::get;
-  using std::multiset;
   using std::pair;
   using std::tuple;
-  using std::unordered_map;
   using std::vector;
-  typedef tuple<unsigned int, unsigned int, bool> uub;
+  typedef tuple<KmerT, unsigned int, bool> uub;
+  typedef pair<KmerT, IndexEntry> Occurrence;
+
+  CheckKmerLen<KmerT>(kmer_len);
+  for (const PackedSequence *i : sequence)
+    CheckReferenceLen(i->size());
+
+  kmerLen_ = kmer_len;
+  windowLen_ = window_len;
+  refsTotal_ = sequence.size();
+  threads = std::max(threads, 1u);
+
+  struct Chunk {
+    unsigned int reference;
+    unsigned int pos_begin;
+    unsigned int pos_end;
+    vector<uub> mins;
+  };
+
+  size_t windowsTotal = 0;
+  auto sequence_len = [&sequence](unsigned int i) {
+    return static_cast<unsigned int>(sequence[i]->size());
+  };
+  for (unsigned i = 0; i < sequence.size(); ++i) {
+    if (kmer_len > 0 && window_len > 0 &&
+        sequence_len(i) >= kmer_len + window_len - 1)
+      windowsTotal += sequence_len(i) - kmer_len - window_len + 2;
+  }
 
-  unsigned kmer_len = kmer_len_last;
-  unsigned window_len = window_len_last;
+  size_t chunkLen = windowsTotal;
+  if (threads > 1) {
+    chunkLen = std::min<size_t>(
+        std::max<size_t>(windowsTotal / (4 * threads), kMinChunkLen),
+        kMaxChunkLen);
+  }
+  chunkLen = std::max<size_t>({chunkLen, window_len, 1});
 
-  auto queryMins = Minimize(sequence, sequence_len, kmer_len, window_len);
+  vector<Chunk> chunks;
+  for (unsigned i = 0; i < sequence.size(); ++i) {
+    if (kmer_len == 0 || window_len == 0 ||
+        sequence_len(i) < kmer_len + window_len - 1)
+      continue;
+    unsigned posEnd = sequence_len(i) - kmer_len + 1;
+    for (unsigned j = window_len - 1; j < posEnd;) {
+      unsigned next = (unsigned)std::min<size_t>(posEnd, j + chunkLen);
+      chunks.push_back({i, j, next, {}});
+      j = next;
+    }
+  }
 
-  vector<vector<Overlap>> lis(refsTotal), overlaps(refsTotal);
+  ParallelFor(threads, chunks.size(), [&](size_t i) {
+    Chunk &chunk = chunks[i];
+    WindowState<KmerT> state;
+    MinimizeWindows(*sequence[chunk.reference], kmer_len, window_len,
+                    chunk.pos_begin, chunk.pos_end, state,
+                    [&chunk](KmerT kmer, unsigned int pos, bool origin) {
+                      chunk.mins.emplace_back(kmer, pos, origin);
+                      return true;
+                    });
+  });
+
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    Chunk &chunk = chunks[i];
+    const Chunk &prevChunk = chunks[i - 1];
+    if (prevChunk.reference != chunk.reference || prevChunk.mins.empty())
+      continue;
 
-  vector<vector<int>> ind(refsTotal), prev(refsTotal);
+    WindowState<KmerT> state;
+    state.kmer = get<0>(prevChunk.mins.back());
+    state.pos = get<1>(prevChunk.mins.back());
+    state.origin = get<2>(prevChunk.mins.back());
+    state.started = true;
+
+    vector<uub> fixed;
+    size_t sync = chunk.mins.size();
+    MinimizeWindows(
+        *sequence[chunk.reference], kmer_len, window_len, chunk.pos_begin,
+        chunk.pos_end, state, [&](KmerT kmer, unsigned int pos, bool origin) {
+          fixed.emplace_back(kmer, pos, origin);
+          auto it = std::lower_bound(
+              chunk.mins.begin(), chunk.mins.end(), pos,
+              [](const uub &x, unsigned int y) { return get<1>(x) < y; });
+          if (it != chunk.mins.end() && get<1>(*it) == pos) {
+            sync = (size_t)std::distance(chunk.mins.begin(), it);
+            return false;
+          }
+          return true;
+        });
+    if (sync != chunk.mins.size())
+      fixed.insert(fixed.end(), chunk.mins.begin() + (long)sync + 1,
+                   chunk.mins.end());
+    chunk.mins.swap(fixed);
+  }
 
-  vector<unsigned> jInd(refsTotal);
+  // occurrences of a minimizer are ordered by increasing reference and
+  // decreasing position, so every thread scatters a contiguous range of
+  // chunks taken in that order
+  vector<size_t> order;
+  for (size_t i = 0, j; i < chunks.size(); i = j) {
+    for (j = i; j < chunks.size() && chunks[j].reference == chunks[i].reference;
+         ++j)
+      ;
+    for (size_t k = j; k > i; --k)
+      order.push_back(k - 1);
+  }
 
-  for (uub i : queryMins) {
-    for (uub j : minLookup[get<0>(i)]) {
-      // if (get<2>(i) != get<2>(j))
-      //   continue;
-      Overlap curOverlap = {get<0>(i), get<0>(j), get<1>(i),
-                            get<1>(j), get<2>(i), get<2>(j)};
-      overlaps[get<0>(j)].push_back(curOverlap);
-      auto lisPos = std::lower_bound(lis[get<0>(j)].begin(),
-                                     lis[get<0>(j)].end(), curOverlap);
-      unsigned lisPosInd =
-          (unsigned)std::distance(lis[get<0>(j)].begin(), lisPos);
-      if (lisPos != lis[get<0>(j)].end()) {
-        *lisPos = curOverlap;
-        ind[get<0>(j)][lisPosInd] = (int)jInd[get<0>(j)];
-        prev[get<0>(j)].push_back(lisPosInd ? ind[get<0>(j)][lisPosInd - 1]
-                                            : -1);
-      } else {
-        lis[get<0>(j)].push_back(curOverlap);
-        ind[get<0>(j)].push_back((int)jInd[get<0>(j)]);
-        prev[get<0>(j)].push_back(lisPosInd ? ind[get<0>(j)][lisPosInd - 1]
-                                            : -1);
+  size_t occurrencesTotal = 0;
+  for (const Chunk &i : chunks)
+    occurrencesTotal += i.mins.size();
+
+  vector<size_t> rangeBegin(threads + 1, order.size());
+  rangeBegin[0] = 0;
+  for (size_t i = 0, t = 1, cumm = 0; i < order.size() && t < threads; ++i) {
+    cumm += chunks[order[i]].mins.size();
+    while (t < threads && cumm * threads >= occurrencesTotal * t)
+      rangeBegin[t++] = i + 1;
+  }
+
+  vector<vector<vector<Occurrence>>> local(
+      threads, vector<vector<Occurrence>>(kPartitions));
+
+  ParallelFor(threads, threads, [&](size_t t) {
+    for (size_t i = rangeBegin[t]; i < rangeBegin[t + 1]; ++i) {
+      Chunk &chunk = chunks[order[i]];
+      for (auto j = chunk.mins.rbegin(); j != chunk.mins.rend(); ++j) {
+        KmerT kmer = get<0>(*j);
+        local[t][Hash(kmer) >> (64 - kPartitionBits)]
+            .push_back(
+                {kmer, {chunk.reference,
+                        get<1>(*j) << 1 | (get<2>(*j) ? 1u : 0u)}});
       }
-      ++jInd[get<0>(j)];
+      vector<uub>().swap(chunk.mins);
     }
-  }
+  });
 
-  size_t maxLis = 0;
-  unsigned maxLisI;
+  vector<size_t> partitionBegin(kPartitions + 1, 0);
+  for (size_t p = 0; p < kPartitions; ++p) {
+    partitionBegin[p + 1] = partitionBegin[p];
+    for (unsigned t = 0; t < threads; ++t)
+      partitionBegin[p + 1] += local[t][p].size();
+  }
 
-  for (unsigned i = 0; i < refsTotal; ++i) {
-    if (maxLis < lis[i].size()) {
-      maxLis = lis[i].size();
-      maxLisI = i;
+  // partitions are sorted before any is written out, so the occurrences of
+  // every minimizer are counted and the filtered ones are never stored
+  vector<vector<Occurrence>> partitions(kPartitions);
+  vector<std::map<size_t, size_t>> histograms(kPartitions);
+  const bool frequent = filter.frequency > 0.0;
+  ParallelFor(threads, kPartitions, [&](size_t p) {
+    vector<Occurrence> &partition = partitions[p];
+    partition.reserve(partitionBegin[p + 1] - partitionBegin[p]);
+    for (unsigned t = 0; t < threads; ++t) {
+      partition.insert(partition.end(), local[t][p].begin(),
+                       local[t][p].end());
+      vector<Occurrence>().swap(local[t][p]);
     }
+    vector<Occurrence> buffer;
+    RadixSort(partition, buffer, 2 * kmer_len,
+              [](const Occurrence &x) { return x.first; });
+    if (!frequent)
+      return;
+    for (size_t i = 0, j; i < partition.size(); i = j) {
+      for (j = i + 1;
+           j < partition.size() && partition[j].first == partition[i].first;
+           ++j)
+        ;
+      ++histograms[p][j - i];
+    }
+  });
+
+  std::map<size_t, size_t> histogram;
+  for (const std::map<size_t, size_t> &i : histograms)
+    for (const auto &j : i)
+      histogram[j.first] += j.second;
+  DropRule<KmerT> drop =
+      MakeDropRule<KmerT>(filter, histogram, [&](size_t count) {
+        vector<KmerT> ret;
+        for (const vector<Occurrence> &partition : partitions)
+          for (size_t i = 0, j; i < partition.size(); i = j) {
+            for (j = i + 1; j < partition.size() &&
+                            partition[j].first == partition[i].first;
+                 ++j)
+              ;
+            if (j - i == count)
+              ret.push_back(partition[i].first);
+          }
+        return ret;
+      });
+
+  ParallelFor(threads, kPartitions, [&](size_t p) {
+    vector<Occurrence> &partition = partitions[p];
+    size_t kept = 0;
+    for (size_t i = 0, j; i < partition.size(); i = j) {
+      for (j = i + 1;
+           j < partition.size() && partition[j].first == partition[i].first;
+           ++j)
+        ;
+      if (drop(j - i, partition[i].first))
+        continue;
+      std::copy(partition.begin() + long(i), partition.begin() + long(j),
+                partition.begin() + long(kept));
+      kept += j - i;
+    }
+    partition.resize(kept);
+  });
+
+  for (size_t p = 0; p < kPartitions; ++p)
+    partitionBegin[p + 1] = partitionBegin[p] + partitions[p].size();
+
+  // buckets address their entries with 32-bit offsets
+  if (partitionBegin[kPartitions] > UINT32_MAX)
+    throw std::invalid_argument(
+        "[crimson::MinimizerIndex] error: " +
+        std::to_string(partitionBegin[kPartitions]) +
+        " entries do not fit into an index, which holds up to 2^32 - 1");
+
+  vector<KmerT> kmers(partitionBegin[kPartitions]);
+  entries_.resize(partitionBegin[kPartitions]);
+  ParallelFor(threads, kPartitions, [&](size_t p) {
+    for (size_t i = 0; i < partitions[p].size(); ++i) {
+      kmers[partitionBegin[p] + i] = partitions[p][i].first;
+      entries_[partitionBegin[p] + i] = partitions[p][i].second;
+    }
+    vector<Occurrence>().swap(partitions[p]);
+  });
+
+  BuildTable(kmers);
+}
+
+template <typename KmerT>
+MinimizerIndex<KmerT>::MinimizerIndex(
+    const std::vector<const char *> &sequence,
+    const std::vector<unsigned int> &sequence_len, unsigned int kmer_len,
+    unsigned int window_len, unsigned int threads, const IndexFilter &filter) {
+  std::vector<PackedSequence> packed;
+  std::vector<const PackedSequence *> packedSequences;
+  packed.reserve(sequence.size());
+  for (size_t i = 0; i < sequence.size(); ++i) {
+    packed.emplace_back(std::string_view(sequence[i], sequence_len[i]));
+    packedSequences.push_back(&packed.back());
   }
+  *this = MinimizerIndex(packedSequences, kmer_len, window_len, threads,
+                         filter);
+}
+
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Filter(const IndexFilter &filter) {
+  std::map<size_t, size_t> histogram;
+  for (size_t i = 0; i < tableSize_; ++i)
+    if (tableData_[i].count != 0)
+      ++histogram[tableData_[i].count];
+  DropRule<KmerT> drop =
+      MakeDropRule<KmerT>(filter, histogram, [this](size_t count) {
+        std::vector<KmerT> ret;
+        for (size_t i = 0; i < tableSize_; ++i)
+          if (tableData_[i].count == count)
+            ret.push_back(tableData_[i].kmer);
+        return ret;
+      });
+
+  // kept entries are compacted in place in the order they are stored in,
+  // as the constructor would have written them
+  if (entries_.data() != entriesData_)
+    entries_.assign(entriesData_, entriesData_ + entriesSize_);
+  std::vector<KmerT> kmers(entries_.size());
+  std::vector<bool> kept(entries_.size(), false);
+  for (size_t i = 0; i < tableSize_; ++i) {
+    const Bucket &bucket = tableData_[i];
+    if (bucket.count == 0 || drop(bucket.count, bucket.kmer))
+      continue;
+    std::fill_n(kmers.begin() + bucket.begin, bucket.count, bucket.kmer);
+    std::fill_n(kept.begin() + bucket.begin, bucket.count, true);
+  }
+  size_t keptTotal = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (!kept[i])
+      continue;
+    kmers[keptTotal] = kmers[i];
+    entries_[keptTotal++] = entries_[i];
+  }
+  kmers.resize(keptTotal);
+  entries_.resize(keptTotal);
+  entries_.shrink_to_fit();
+  BuildTable(kmers);
+}
+
+template <typename KmerT> void MinimizerIndex<KmerT>::Filter(double frequency) {
+  Filter(IndexFilter{frequency, 0});
+}
 
-  vector<Overlap> ret;
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>>
+MinimizerIndex<KmerT>::Map(const char *sequence,
+                           unsigned int sequence_len) const {
+  return Chain(Minimize<KmerT>(sequence, sequence_len, kmerLen_, windowLen_));
+}
+
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>>
+MinimizerIndex<KmerT>::Map(const PackedSequence &sequence) const {
+  return Chain(Minimize<KmerT>(sequence, kmerLen_, windowLen_));
+}
 
-  for (int i = (int)ind[maxLisI].back(); i != -1;
-       i = prev[maxLisI][(unsigned)i]) {
-    ret.push_back(overlaps[maxLisI][(unsigned)i]);
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Overlaps(
+    const std::vector<const PackedSequence *> &sequences,
+    std::vector<BasicOverlap<KmerT>> &overlaps,
+    std::vector<size_t> &offsets) const {
+  overlaps.clear();
+  offsets.assign(sequences.size() + 1, 0);
+
+  // minimizers of all sequences are put first in overlaps, with the number
+  // of their sequence in place of the reference, and looked up after all of
+  // them are found, which keeps the minimizing loop apart from the scattered
+  // reads of the index
+  for (size_t i = 0; i < sequences.size(); ++i) {
+    const PackedSequence &sequence = *sequences[i];
+    const unsigned int sequenceLen =
+        static_cast<unsigned int>(sequence.size());
+    if (kmerLen_ == 0 || windowLen_ == 0 ||
+        sequenceLen < kmerLen_ + windowLen_ - 1)
+      continue;
+    const unsigned int index = static_cast<unsigned int>(i);
+    WindowState<KmerT> state;
+    MinimizeWindows(sequence, kmerLen_, windowLen_, windowLen_ - 1,
+                    sequenceLen - kmerLen_ + 1, state,
+                    [&](KmerT kmer, unsigned int pos, bool origin) {
+                      overlaps.push_back({kmer, index, pos, 0, origin, false});
+                      return true;
+                    });
   }
+  Lookup(overlaps, offsets.data());
+  for (size_t i = 1; i < offsets.size(); ++i)
+    offsets[i] += offsets[i - 1];
+}
+
+template <typename KmerT>
+void MinimizerIndex<KmerT>::Overlaps(
+    const PackedSequence &sequence,
+    std::vector<BasicOverlap<KmerT>> &overlaps) const {
+  overlaps.clear();
+  const unsigned int sequenceLen = static_cast<unsigned int>(sequence.size());
+  if (kmerLen_ == 0 || windowLen_ == 0 ||
+      sequenceLen < kmerLen_ + windowLen_ - 1)
+    return;
+
+  WindowState<KmerT> state;
+  MinimizeWindows(sequence, kmerLen_, windowLen_, windowLen_ - 1,
+                  sequenceLen - kmerLen_ + 1, state,
+                  [&](KmerT kmer, unsigned int pos, bool origin) {
+                    overlaps.push_back({kmer, 0, pos, 0, origin, false});
+                    return true;
+                  });
+  size_t offsets[2] = {};
+  Lookup(overlaps, offsets);
+}
+
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>>
+MinimizerIndex<KmerT>::Overlaps(const PackedSequence &sequence) const {
+  std::vector<BasicOverlap<KmerT>> ret;
+  Overlaps(sequence, ret);
+  return ret;
+}
+
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>> MinimizerIndex<KmerT>::Chain(
+    const std::vector<std::tuple<KmerT, unsigned int, bool>> &queryMins)
+    const {
+  using std::get;
+  using std::vector;
+  typedef BasicOverlap<KmerT> Overlap;
+
+  const unsigned kmer_len = kmerLen_;
+
+  // overlaps chain if they do not overlap or lie on the same diagonal
+  auto chainCmp = [kmer_len](const Overlap &x, const Overlap &y) {
+    if (x.reference_pos + kmer_len <= y.reference_pos &&
+        x.query_pos + kmer_len <= y.query_pos)
+      return true;
+
+    if (x.reference_pos < y.reference_pos && x.query_pos < y.query_pos &&
+        y.reference_pos - x.reference_pos == y.query_pos - x.query_pos)
+      return true;
+
+    return false;
+  };
+
+  // matches are grouped by reference, in query order within each, so only
+  // the references hit are chained
+  vector<Overlap> overlaps, buffer;
+  for (const auto &i : queryMins)
+    overlaps.push_back({get<0>(i), 0, get<1>(i), 0, get<2>(i), false});
+  size_t offsets[2] = {};
+  Lookup(overlaps, offsets);
+  RadixSort(overlaps, buffer, BitWidth(refsTotal_),
+            [](const Overlap &x) { return x.reference_index; });
+
+  vector<Overlap> lis, ret;
+  vector<int> ind, prev;
+  for (size_t begin = 0, end; begin < overlaps.size(); begin = end) {
+    for (end = begin + 1;
+         end < overlaps.size() &&
+         overlaps[end].reference_index == overlaps[begin].reference_index;
+         ++end)
+      ;
+
+    lis.clear();
+    ind.clear();
+    prev.clear();
+    for (size_t i = begin; i < end; ++i) {
+      const Overlap &curOverlap = overlaps[i];
+      auto lisPos =
+          std::lower_bound(lis.begin(), lis.end(), curOverlap, chainCmp);
+      unsigned lisPosInd = (unsigned)std::distance(lis.begin(), lisPos);
+      if (lisPos != lis.end()) {
+        *lisPos = curOverlap;
+        ind[lisPosInd] = (int)(i - begin);
+      } else {
+        lis.push_back(curOverlap);
+        ind.push_back((int)(i - begin));
+      }
+      prev.push_back(lisPosInd ? ind[lisPosInd - 1] : -1);
+    }
 
-  std::reverse(ret.begin(), ret.end());
+    // the first reference with the longest chain is taken
+    if (lis.size() <= ret.size())
+      continue;
+    ret.clear();
+    for (int i = ind.back(); i != -1; i = prev[(unsigned)i])
+      ret.push_back(overlaps[begin + (unsigned)i]);
+    std::reverse(ret.begin(), ret.end());
+  }
 
   return ret;
 }
 
-} // namespace crimson
\ No newline at end of file
+// Lookup table used by the free functions below
+template <typename KmerT> MinimizerIndex<KmerT> minIndex;
+
+void ResetData() {
+  minIndex<std::uint32_t> = {};
+  minIndex<std::uint64_t> = {};
+}
+
+template <typename KmerT>
+void Minimize(std::vector<const char *> sequence,
+              std::vector<unsigned int> sequence_len, unsigned int kmer_len,
+              unsigned int window_len, unsigned int threads) {
+  minIndex<KmerT> = MinimizerIndex<KmerT>(sequence, sequence_len, kmer_len,
+                                          window_len, threads);
+}
+
+template <typename KmerT> void Filter(double frequency) {
+  minIndex<KmerT>.Filter(frequency);
+}
+
+template <typename KmerT>
+std::vector<BasicOverlap<KmerT>> Map(const char *sequence,
+                                     unsigned int sequence_len) {
+  return minIndex<KmerT>.Map(sequence, sequence_len);
+}
+
+template class MinimizerIndex<std::uint32_t>;
+template class MinimizerIndex<std::uint64_t>;
+
+template std::vector<std::tuple<std::uint32_t, unsigned int, bool>>
+Minimize<std::uint32_t>(const char *, unsigned int, unsigned int, unsigned int);
+template std::vector<std::tuple<std::uint64_t, unsigned int, bool>>
+Minimize<std::uint64_t>(const char *, unsigned int, unsigned int, unsigned int);
+template std::vector<std::tuple<std::uint32_t, unsigned int, bool>>
+Minimize<std::uint32_t>(const PackedSequence &, unsigned int, unsigned int);
+template std::vector<std::tuple<std::uint64_t, unsigned int, bool>>
+Minimize<std::uint64_t>(const PackedSequence &, unsigned int, unsigned int);
+
+template void Minimize<std::uint32_t>(std::vector<const char *>,
+                                      std::vector<unsigned int>, unsigned int,
+                                      unsigned int, unsigned int);
+template void Minimize<std::uint64_t>(std::vector<const char *>,
+                                      std::vector<unsigned int>, unsigned int,
+                                      unsigned int, unsigned int);
+
+template void Filter<std::uint32_t>(double);
+template void Filter<std::uint64_t>(double);
+
+template std::vector<BasicOverlap<std::uint32_t>>
+Map<std::uint32_t>(const char *, unsigned int);
+template std::vector<BasicOverlap<std::uint64_t>>
+Map<std::uint64_t>(const char *, unsigned int);
+
+} // namespace crimson
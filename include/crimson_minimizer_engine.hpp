@@ -1,23 +1,33 @@
 #ifndef CRIMSON_MINIMIZER_ENGINE_HPP_
 #define CRIMSON_MINIMIZER_ENGINE_HPP_
 
+#include "crimson_packed_sequence.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 namespace crimson {
 
-std::vector<std::tuple<unsigned int, unsigned int, bool>>
+// K-mers are packed 2 bits per base into KmerT, instantiated for
+// std::uint32_t (k <= 16) and std::uint64_t (k <= 32)
+template <typename KmerT>
+constexpr unsigned int kMaxKmerLen = sizeof(KmerT) * 4;
+
+template <typename KmerT = unsigned int>
+std::vector<std::tuple<KmerT, unsigned int, bool>>
 Minimize(const char *sequence, unsigned int sequence_len, unsigned int kmer_len,
          unsigned int window_len);
 
-void Minimize(std::vector<const char *> sequence,
-              std::vector<unsigned int> sequence_len, unsigned int kmer_len,
-              unsigned int window_len);
-
-void Filter(double frequency);
+// Same minimizers of a packed sequence, decoded a byte at a time
+template <typename KmerT = unsigned int>
+std::vector<std::tuple<KmerT, unsigned int, bool>>
+Minimize(const PackedSequence &sequence, unsigned int kmer_len,
+         unsigned int window_len);
 
-struct Overlap {
-  unsigned kmer;
+template <typename KmerT> struct BasicOverlap {
+  KmerT kmer;
   unsigned reference_index;
   unsigned query_pos;
   unsigned reference_pos;
@@ -25,9 +35,162 @@ struct Overlap {
   bool is_original_reference;
 };
 
+using Overlap = BasicOverlap<unsigned int>;
+
+// Reference occurrence of a minimizer: reference index, and position with
+// the strand in its lowest bit, so positions are limited to 2^31
+struct IndexEntry {
+  std::uint32_t reference_index;
+  std::uint32_t position_strand;
+
+  unsigned int position() const { return position_strand >> 1; }
+  bool is_original() const { return position_strand & 1u; }
+};
+
+// Minimizers left out of an index: the given fraction of the most frequent
+// ones, taken in order of decreasing occurrences and then k-mers, and every
+// one with more than max_occurrences occurrences unless it is 0
+struct IndexFilter {
+  double frequency = 0.0;
+  size_t max_occurrences = 0;
+};
+
+// Minimizer lookup table of a set of reference sequences. It is built by the
+// constructor and optionally filtered, after which it is only read, so const
+// member functions are safe to call concurrently. Several indexes, also with
+// different k-mer and window lengths, can coexist.
+//
+// Entries are stored in one array grouped by minimizer, and an open addressing
+// table (linear probing, load factor at most 3/4) maps each minimizer to its
+// range of entries.
+template <typename KmerT> class MinimizerIndex {
+public:
+  // Contiguous entries of a single minimizer
+  struct Occurrences {
+    const IndexEntry *first;
+    const IndexEntry *last;
+
+    const IndexEntry *begin() const { return first; }
+    const IndexEntry *end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+  };
+
+  MinimizerIndex() = default;
+  MinimizerIndex(const MinimizerIndex &) = delete;
+  MinimizerIndex &operator=(const MinimizerIndex &) = delete;
+  MinimizerIndex(MinimizerIndex &&) = default;
+  MinimizerIndex &operator=(MinimizerIndex &&) = default;
+
+  // Indexes minimizers of all sequences on up to threads threads. The ones
+  // the filter leaves out are never stored. Throws std::invalid_argument if
+  // a sequence has 2^31 bases or more, or the index would hold more than
+  // 2^32 - 1 entries.
+  MinimizerIndex(const std::vector<const PackedSequence *> &sequence,
+                 unsigned int kmer_len, unsigned int window_len,
+                 unsigned int threads = 1, const IndexFilter &filter = {});
+
+  // Same index of sequences given as text, which are packed first
+  MinimizerIndex(const std::vector<const char *> &sequence,
+                 const std::vector<unsigned int> &sequence_len,
+                 unsigned int kmer_len, unsigned int window_len,
+                 unsigned int threads = 1, const IndexFilter &filter = {});
+
+  // Removes the minimizers the filter leaves out from a built index, which
+  // then equals one built with the filter
+  void Filter(const IndexFilter &filter);
+  // Removes the given fraction of the most frequent minimizers
+  void Filter(double frequency);
+
+  Occurrences Query(KmerT kmer) const;
+  // Occurrences of count k-mers, whose lookups are prefetched a few k-mers
+  // ahead so that their cache misses overlap
+  void Query(const KmerT *kmers, size_t count,
+             Occurrences *occurrences) const;
+
+  // Writes the index in a binary layout which View reads back
+  void Write(std::ostream &out) const;
+
+  // Index over data written by Write, for example in a mapped file, which
+  // is used in place and has to outlive the index. Its buckets are checked
+  // once, which reads the whole table. Throws std::invalid_argument if the
+  // data is not an index of KmerT k-mers.
+  static MinimizerIndex View(const char *data, size_t size);
+
+  // Longest chain of minimizer matches between the sequence and a reference
+  std::vector<BasicOverlap<KmerT>> Map(const char *sequence,
+                                       unsigned int sequence_len) const;
+  std::vector<BasicOverlap<KmerT>> Map(const PackedSequence &sequence) const;
+
+  // Every match of a minimizer of the sequence with the index, in query
+  // order, which ChainOverlaps chains on both strands
+  std::vector<BasicOverlap<KmerT>>
+  Overlaps(const PackedSequence &sequence) const;
+  // Same matches put in overlaps, whose memory is reused
+  void Overlaps(const PackedSequence &sequence,
+                std::vector<BasicOverlap<KmerT>> &overlaps) const;
+  // Matches of a batch of sequences, whose minimizers are all looked up
+  // together. The matches of sequences[i] are the ones from
+  // overlaps[offsets[i]] up to overlaps[offsets[i + 1]].
+  void Overlaps(const std::vector<const PackedSequence *> &sequences,
+                std::vector<BasicOverlap<KmerT>> &overlaps,
+                std::vector<size_t> &offsets) const;
+
+  unsigned int kmer_len() const { return kmerLen_; }
+  unsigned int window_len() const { return windowLen_; }
+  size_t num_references() const { return refsTotal_; }
+  size_t num_minimizers() const { return kmersTotal_; }
+  size_t num_entries() const { return entriesSize_; }
+
+private:
+  struct Bucket {
+    KmerT kmer;
+    std::uint32_t begin;
+    std::uint32_t count; // 0 marks an empty bucket
+  };
+
+  static std::uint64_t Hash(KmerT kmer);
+  const Bucket *Find(KmerT kmer) const;
+  void BuildTable(const std::vector<KmerT> &kmers);
+  // Replaces the minimizers in overlaps, whose reference_index holds the
+  // number i of their sequence, by their matches in the same order, and
+  // adds the number of matches of sequence i to offsets[i + 1]
+  void Lookup(std::vector<BasicOverlap<KmerT>> &overlaps,
+              size_t *offsets) const;
+  // Longest chain of matches of the query minimizers
+  std::vector<BasicOverlap<KmerT>>
+  Chain(const std::vector<std::tuple<KmerT, unsigned int, bool>> &queryMins)
+      const;
+
+  unsigned int kmerLen_ = 0;
+  unsigned int windowLen_ = 0;
+  size_t refsTotal_ = 0;
+  size_t kmersTotal_ = 0;
+  // arrays of a built index
+  std::vector<Bucket> table_;
+  std::vector<IndexEntry> entries_;
+  // arrays used by lookups, either the ones above or ones given to View
+  const Bucket *tableData_ = nullptr;
+  size_t tableSize_ = 0;
+  const IndexEntry *entriesData_ = nullptr;
+  size_t entriesSize_ = 0;
+};
+
+// The functions below keep a single global index per KmerT
+
+// Builds the lookup table of all sequences on up to threads threads
+template <typename KmerT = unsigned int>
+void Minimize(std::vector<const char *> sequence,
+              std::vector<unsigned int> sequence_len, unsigned int kmer_len,
+              unsigned int window_len, unsigned int threads = 1);
+
+template <typename KmerT = unsigned int> void Filter(double frequency);
+
 void ResetData();
 
-std::vector<Overlap> Map(const char *sequence, unsigned int sequence_len);
+template <typename KmerT = unsigned int>
+std::vector<BasicOverlap<KmerT>> Map(const char *sequence,
+                                     unsigned int sequence_len);
 
 } // namespace crimson
 
@@ -0,0 +1,280 @@
+#include "crimson_output.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace crimson {
+
+namespace {
+
+// Header of a BGZF block up to its size: a gzip member with the BC extra
+// field, which holds the block size minus one
+constexpr unsigned char kBgzfHeader[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0,
+                                           255, 6, 0, 66, 67, 2, 0, 0, 0};
+constexpr size_t kBgzfHeaderSize = sizeof(kBgzfHeader);
+constexpr size_t kBgzfFooterSize = 8;
+constexpr size_t kBgzfMaxBlockSize = 1u << 16;
+// data of a block, which stays within the block size even if it does not
+// compress, as htslib takes it
+constexpr size_t kBgzfBlockData = 0xff00;
+
+constexpr unsigned char kBgzfEof[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255,
+                                        6,  0,   66, 67, 2, 0, 27, 0, 3, 0,
+                                        0,  0,   0,  0,  0, 0, 0,  0};
+
+void PutLittleEndian(unsigned char *out, std::uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i, value >>= 8)
+    out[i] = static_cast<unsigned char>(value & 0xFF);
+}
+
+// Name up to its first white space
+std::string_view SamName(std::string_view name) {
+  return name.substr(0, std::min(name.find(' '), name.find('\t')));
+}
+
+void AppendField(std::string &out, std::string_view field) {
+  out += '\t';
+  if (field.empty())
+    out += '*';
+  else
+    out += field;
+}
+
+void AppendIntTag(std::string &out, const char *tag, int value) {
+  out += '\t';
+  out += tag;
+  out += ":i:";
+  AppendInt(out, value);
+}
+
+void AppendTypeTags(std::string &out, char type, int score) {
+  out += "\ttp:A:";
+  out += type;
+  AppendIntTag(out, "s1", score);
+}
+
+// Deflate stream of raw blocks, ended when it goes out of scope
+struct Deflater {
+  z_stream stream = {};
+
+  explicit Deflater(int level) {
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error(
+          "[crimson::AppendBgzf] error: unable to initialize zlib");
+  }
+  ~Deflater() { deflateEnd(&stream); }
+  Deflater(const Deflater &) = delete;
+  Deflater &operator=(const Deflater &) = delete;
+};
+
+} // namespace
+
+CigarLengths MeasureCigar(std::string_view cigar) {
+  CigarLengths ret;
+  unsigned int len = 0;
+  for (char c : cigar) {
+    if (c >= '0' && c <= '9') {
+      len = len * 10 + static_cast<unsigned int>(c - '0');
+      continue;
+    }
+    if (c == 'M') {
+      ret.query += len;
+      ret.target += len;
+      ret.matches += len;
+    } else if (c == 'I') {
+      ret.query += len;
+    } else if (c == 'D') {
+      ret.target += len;
+    }
+    ret.columns += len;
+    len = 0;
+  }
+  return ret;
+}
+
+unsigned int CigarEditDistance(std::string_view cigar, const char *query,
+                               const char *target, unsigned int *mismatches) {
+  unsigned int gaps = 0, mismatched = 0, len = 0;
+  for (char c : cigar) {
+    if (c >= '0' && c <= '9') {
+      len = len * 10 + static_cast<unsigned int>(c - '0');
+      continue;
+    }
+    if (c == 'M') {
+      for (unsigned int i = 0; i < len; ++i)
+        mismatched += query[i] != target[i];
+      query += len;
+      target += len;
+    } else {
+      gaps += len;
+      if (c == 'I')
+        query += len;
+      else if (c == 'D')
+        target += len;
+    }
+    len = 0;
+  }
+  if (mismatches != nullptr)
+    *mismatches = mismatched;
+  return gaps + mismatched;
+}
+
+void AppendPaf(const PafRecord &record, std::string &out) {
+  out += record.query_name;
+  out += '\t';
+  AppendInt(out, record.query_len);
+  out += '\t';
+  AppendInt(out, record.query_begin);
+  out += '\t';
+  AppendInt(out, record.query_end);
+  out += record.is_reverse ? "\t-\t" : "\t+\t";
+  out += record.target_name;
+  out += '\t';
+  AppendInt(out, record.target_len);
+  out += '\t';
+  AppendInt(out, record.target_begin);
+  out += '\t';
+  AppendInt(out, record.target_end);
+  out += '\t';
+  AppendInt(out, record.matches);
+  out += '\t';
+  AppendInt(out, record.block_len);
+  out += '\t';
+  AppendInt(out, record.mapq);
+  AppendTypeTags(out, record.type, record.score);
+  if (record.edit_distance >= 0)
+    AppendIntTag(out, "NM", record.edit_distance);
+  if (!record.cigar.empty()) {
+    out += "\tcg:Z:";
+    out += record.cigar;
+  }
+  out += '\n';
+}
+
+void AppendSam(const SamRecord &record, std::string &out) {
+  out += SamName(record.query_name);
+  out += '\t';
+  AppendInt(out, record.flag);
+  AppendField(out, SamName(record.target_name));
+  out += '\t';
+  AppendInt(out, record.target_name.empty() ? 0 : record.position + 1);
+  out += '\t';
+  AppendInt(out, record.mapq);
+  out += '\t';
+  if (record.cigar.empty()) {
+    out += '*';
+  } else {
+    if (record.clip_begin > 0) {
+      AppendInt(out, record.clip_begin);
+      out += 'S';
+    }
+    out += record.cigar;
+    if (record.clip_end > 0) {
+      AppendInt(out, record.clip_end);
+      out += 'S';
+    }
+  }
+  out += "\t*\t0\t0";
+  AppendField(out, record.sequence);
+  AppendField(out, record.sequence.empty() ? std::string_view()
+                                           : record.quality);
+  if (record.edit_distance >= 0)
+    AppendIntTag(out, "NM", record.edit_distance);
+  if (record.type != 0)
+    AppendTypeTags(out, record.type, record.score);
+  out += '\n';
+}
+
+void AppendSamHeader(const std::vector<std::string_view> &target_names,
+                     const std::vector<size_t> &target_lens,
+                     std::string_view version, std::string_view command_line,
+                     std::string &out) {
+  out += "@HD\tVN:1.6\tSO:unsorted\tGO:query\n";
+  for (size_t i = 0; i < target_names.size(); ++i) {
+    out += "@SQ\tSN:";
+    out += SamName(target_names[i]);
+    out += "\tLN:";
+    AppendInt(out, target_lens[i]);
+    out += '\n';
+  }
+  out += "@PG\tID:crimson_mapper\tPN:crimson_mapper\tVN:";
+  out += version;
+  out += "\tCL:";
+  out += command_line;
+  out += '\n';
+}
+
+void AppendBgzf(std::string_view data, std::string &out, int level) {
+  Deflater deflater(level);
+  z_stream &stream = deflater.stream;
+  for (size_t begin = 0; begin < data.size(); begin += kBgzfBlockData) {
+    const size_t len = std::min(kBgzfBlockData, data.size() - begin);
+    const size_t blockBegin = out.size();
+    out.resize(blockBegin + kBgzfMaxBlockSize);
+    unsigned char *block = reinterpret_cast<unsigned char *>(&out[blockBegin]);
+    std::memcpy(block, kBgzfHeader, kBgzfHeaderSize);
+
+    deflateReset(&stream);
+    const Bytef *in = reinterpret_cast<const Bytef *>(data.data() + begin);
+    stream.next_in = const_cast<Bytef *>(in);
+    stream.avail_in = static_cast<uInt>(len);
+    stream.next_out = block + kBgzfHeaderSize;
+    stream.avail_out = static_cast<uInt>(kBgzfMaxBlockSize - kBgzfHeaderSize -
+                                         kBgzfFooterSize);
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+      throw std::runtime_error(
+          "[crimson::AppendBgzf] error: block does not fit its size");
+
+    const size_t compressedLen = stream.total_out;
+    const size_t blockSize = kBgzfHeaderSize + compressedLen + kBgzfFooterSize;
+    PutLittleEndian(block + 16, static_cast<std::uint32_t>(blockSize - 1), 2);
+    unsigned char *footer = block + kBgzfHeaderSize + compressedLen;
+    uLong crc = crc32(crc32(0, nullptr, 0), in, static_cast<uInt>(len));
+    PutLittleEndian(footer, static_cast<std::uint32_t>(crc), 4);
+    PutLittleEndian(footer + 4, static_cast<std::uint32_t>(len), 4);
+    out.resize(blockBegin + blockSize);
+  }
+}
+
+void AppendBgzfEof(std::string &out) {
+  out.append(reinterpret_cast<const char *>(kBgzfEof), sizeof(kBgzfEof));
+}
+
+OutputWriter::OutputWriter(std::FILE *file, bool bgzf)
+    : file_(file), bgzf_(bgzf) {
+  buffer_.reserve(kBlockSize);
+}
+
+void OutputWriter::Write(std::string_view data) {
+  // large pieces are written as they are, small ones gathered into a block
+  if (buffer_.size() + data.size() > kBlockSize)
+    Flush();
+  if (data.size() >= kBlockSize) {
+    if (std::fwrite(data.data(), 1, data.size(), file_) != data.size())
+      throw std::runtime_error("[crimson::OutputWriter] error: unable to "
+                               "write output");
+    return;
+  }
+  buffer_ += data;
+}
+
+void OutputWriter::Close() {
+  if (bgzf_)
+    AppendBgzfEof(buffer_);
+  Flush();
+  if (std::fflush(file_) != 0)
+    throw std::runtime_error("[crimson::OutputWriter] error: unable to "
+                             "write output");
+}
+
+void OutputWriter::Flush() {
+  if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+    throw std::runtime_error("[crimson::OutputWriter] error: unable to "
+                             "write output");
+  buffer_.clear();
+}
+
+} // namespace crimson
@@ -0,0 +1,136 @@
+#ifndef CRIMSON_OUTPUT_HPP_
+#define CRIMSON_OUTPUT_HPP_
+
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crimson {
+
+// Appends the decimal digits of value to out
+template <typename Int> void AppendInt(std::string &out, Int value) {
+  char buffer[24];
+  char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+  out.append(buffer, end);
+}
+
+// Lengths of the alignment a cigar of M, I and D runs describes, and its
+// M and total columns
+struct CigarLengths {
+  unsigned int query = 0;
+  unsigned int target = 0;
+  unsigned int matches = 0;
+  unsigned int columns = 0;
+};
+
+CigarLengths MeasureCigar(std::string_view cigar);
+
+// Mismatched columns and gap bases of the alignment of query and target
+// the cigar describes, and the mismatched columns alone in mismatches if
+// given, which leave the matching bases when taken from the M columns
+unsigned int CigarEditDistance(std::string_view cigar, const char *query,
+                               const char *target,
+                               unsigned int *mismatches = nullptr);
+
+// Mapping as a PAF line. Query positions are on the query itself.
+struct PafRecord {
+  std::string_view query_name;
+  unsigned int query_len = 0;
+  unsigned int query_begin = 0;
+  unsigned int query_end = 0;
+  bool is_reverse = false;
+  std::string_view target_name;
+  size_t target_len = 0;
+  unsigned int target_begin = 0;
+  unsigned int target_end = 0;
+  // columns of equal bases, and all columns of the alignment
+  unsigned int matches = 0;
+  unsigned int block_len = 0;
+  unsigned int mapq = 0;
+  // tp:A and s1:i tags, the type is P for primary and supplementary
+  // mappings and S for secondary ones
+  char type = 0;
+  int score = 0;
+  // NM:i tag if not negative, and cg:Z tag if not empty
+  int edit_distance = -1;
+  std::string_view cigar;
+};
+
+// Appends the line of record to out
+void AppendPaf(const PafRecord &record, std::string &out);
+
+// SAM flags of mappings
+constexpr unsigned int kSamUnmapped = 4;
+constexpr unsigned int kSamReverse = 16;
+constexpr unsigned int kSamSecondary = 256;
+constexpr unsigned int kSamSupplementary = 2048;
+
+// Mapping as a SAM line. Empty fields are written as *, and the sequence
+// and qualities are on the strand of the target.
+struct SamRecord {
+  std::string_view query_name;
+  unsigned int flag = 0;
+  std::string_view target_name;
+  // leftmost target position, from 0
+  unsigned int position = 0;
+  unsigned int mapq = 0;
+  // cigar between soft clips of the bases it leaves out
+  unsigned int clip_begin = 0;
+  std::string_view cigar;
+  unsigned int clip_end = 0;
+  std::string_view sequence;
+  std::string_view quality;
+  // NM:i tag if not negative, and tp:A and s1:i tags unless type is 0
+  int edit_distance = -1;
+  char type = 0;
+  int score = 0;
+};
+
+// Appends the line of record to out. Names are cut at the first white
+// space, as SAM does not allow it.
+void AppendSam(const SamRecord &record, std::string &out);
+
+// Appends the header of SAM output of mappings to the given targets
+void AppendSamHeader(const std::vector<std::string_view> &target_names,
+                     const std::vector<size_t> &target_lens,
+                     std::string_view version, std::string_view command_line,
+                     std::string &out);
+
+// Compresses data into BGZF blocks, gzip members of at most 64 KiB which
+// can be decompressed independently, and appends them to out. Data can thus
+// be compressed in pieces by several threads and the pieces concatenated.
+// level is a zlib level, -1 for its default. Throws std::runtime_error if
+// zlib fails.
+void AppendBgzf(std::string_view data, std::string &out, int level = -1);
+
+// Appends the empty block which ends BGZF files
+void AppendBgzfEof(std::string &out);
+
+// Writes output to a file, which it does not close, in writes of at least
+// kBlockSize bytes. BGZF output, whose pieces are already compressed, is
+// ended with the end of file block. Throws std::runtime_error if the file
+// can not be written.
+class OutputWriter {
+public:
+  static constexpr size_t kBlockSize = 1u << 20;
+
+  OutputWriter(std::FILE *file, bool bgzf);
+
+  void Write(std::string_view data);
+  // Writes out what is buffered and ends BGZF output
+  void Close();
+
+private:
+  void Flush();
+
+  std::FILE *file_;
+  bool bgzf_;
+  std::string buffer_;
+};
+
+} // namespace crimson
+
+#endif // CRIMSON_OUTPUT_HPP_
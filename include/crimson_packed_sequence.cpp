@@ -0,0 +1,96 @@
+#include "crimson_packed_sequence.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace crimson {
+
+namespace {
+
+// Text of the 4 bases of every packed byte
+struct UnpackTable {
+  char bases[256][4];
+  constexpr UnpackTable() : bases() {
+    for (unsigned i = 0; i < 256; ++i)
+      for (unsigned j = 0; j < 4; ++j)
+        bases[i][j] = "ACGT"[(i >> (2 * j)) & 3];
+  }
+};
+
+constexpr UnpackTable kUnpackTable;
+
+} // namespace
+
+PackedSequence::Cursor::Cursor(const PackedSequence &sequence, size_t pos)
+    : next_(sequence.bases_ + (sequence.offset_ + pos) / 4), pos_(pos) {
+  const unsigned int skipped = (sequence.offset_ + pos) % 4;
+  if (skipped != 0) {
+    byte_ = static_cast<unsigned char>(*next_++ >> (2 * skipped));
+    left_ = 4 - skipped;
+  }
+  runsEnd_ = sequence.runs_ + sequence.runsSize_;
+  run_ = std::upper_bound(
+      sequence.runs_, runsEnd_, pos,
+      [](size_t x, const Run &y) { return x < size_t(y.begin) + y.len; });
+}
+
+PackedSequence::PackedSequence(std::string_view sequence)
+    : ownBases_((sequence.size() + 3) / 4), size_(sequence.size()) {
+  for (size_t i = 0; i < sequence.size(); ++i) {
+    unsigned char code =
+        kPackCodes.code[static_cast<unsigned char>(sequence[i])];
+    if (code == kPackedN) {
+      if (!ownRuns_.empty() &&
+          size_t(ownRuns_.back().begin) + ownRuns_.back().len == i)
+        ++ownRuns_.back().len;
+      else
+        ownRuns_.push_back({static_cast<std::uint32_t>(i), 1});
+      continue;
+    }
+    ownBases_[i / 4] =
+        static_cast<std::uint8_t>(ownBases_[i / 4] | code << (2 * (i % 4)));
+  }
+  bases_ = ownBases_.data();
+  runs_ = ownRuns_.data();
+  runsSize_ = ownRuns_.size();
+}
+
+PackedSequence PackedSequence::View(const std::uint8_t *bases, size_t offset,
+                                    size_t size, const Run *runs,
+                                    size_t runs_size) {
+  PackedSequence ret;
+  ret.bases_ = bases;
+  ret.offset_ = offset;
+  ret.size_ = size;
+  ret.runs_ = runs;
+  ret.runsSize_ = runs_size;
+  return ret;
+}
+
+void PackedSequence::Unpack(size_t begin, size_t end, std::string &out) const {
+  const size_t outBegin = out.size();
+  out.resize(outBegin + end - begin);
+  char *text = &out[outBegin];
+
+  // bases up to a byte boundary one at a time, then whole bytes
+  size_t pos = offset_ + begin;
+  const size_t last = offset_ + end;
+  for (; pos < last && pos % 4 != 0; ++pos)
+    *text++ = "ACGT"[(bases_[pos / 4] >> (2 * (pos % 4))) & 3];
+  for (; pos + 4 <= last; pos += 4, text += 4)
+    std::memcpy(text, kUnpackTable.bases[bases_[pos / 4]], 4);
+  for (; pos < last; ++pos)
+    *text++ = "ACGT"[(bases_[pos / 4] >> (2 * (pos % 4))) & 3];
+
+  const Run *runsEnd = runs_ + runsSize_;
+  const Run *run = std::upper_bound(
+      runs_, runsEnd, begin,
+      [](size_t x, const Run &y) { return x < size_t(y.begin) + y.len; });
+  for (; run != runsEnd && run->begin < end; ++run) {
+    size_t runBegin = std::max<size_t>(run->begin, begin);
+    size_t runEnd = std::min<size_t>(size_t(run->begin) + run->len, end);
+    std::fill(out.begin() + long(outBegin + runBegin - begin),
+              out.begin() + long(outBegin + runEnd - begin), 'N');
+  }
+}
+
+} // namespace crimson
@@ -0,0 +1,119 @@
+#ifndef CRIMSON_PACKED_SEQUENCE_HPP_
+#define CRIMSON_PACKED_SEQUENCE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crimson {
+
+// Code of characters which are not ACGT
+constexpr unsigned char kPackedN = 4;
+
+// 2-bit code of ACGT in either case, kPackedN for every other character
+struct PackCodes {
+  unsigned char code[256];
+  constexpr PackCodes() : code() {
+    for (unsigned i = 0; i < 256; ++i)
+      code[i] = kPackedN;
+    code['A'] = code['a'] = 0;
+    code['C'] = code['c'] = 1;
+    code['G'] = code['g'] = 2;
+    code['T'] = code['t'] = 3;
+  }
+};
+
+inline constexpr PackCodes kPackCodes;
+
+// Nucleotide sequence packed 2 bits per base, 4 bases per byte from the
+// lowest bits up, in a quarter of the memory of its text. Every character
+// which is not ACGT is kept as an N in a list of runs, and packed as A.
+// Sequences either own their bases or view ones stored elsewhere, such as
+// in a mapped index file.
+class PackedSequence {
+public:
+  // Maximal run of N bases [begin, begin + len)
+  struct Run {
+    std::uint32_t begin;
+    std::uint32_t len;
+  };
+
+  // Codes of the bases from a position on, kPackedN in N runs, decoded a
+  // byte at a time
+  class Cursor {
+  public:
+    Cursor(const PackedSequence &sequence, size_t pos);
+
+    unsigned char Next() {
+      if (left_ == 0) {
+        byte_ = *next_++;
+        left_ = 4;
+      }
+      unsigned char code = byte_ & 3;
+      byte_ = static_cast<unsigned char>(byte_ >> 2);
+      --left_;
+
+      const size_t pos = pos_++;
+      while (run_ != runsEnd_ && pos >= size_t(run_->begin) + run_->len)
+        ++run_;
+      return run_ != runsEnd_ && pos >= run_->begin ? kPackedN : code;
+    }
+
+  private:
+    const std::uint8_t *next_;
+    unsigned char byte_ = 0;
+    unsigned int left_ = 0;
+    size_t pos_;
+    const Run *run_;
+    const Run *runsEnd_;
+  };
+
+  PackedSequence() = default;
+  explicit PackedSequence(std::string_view sequence);
+
+  PackedSequence(const PackedSequence &) = delete;
+  PackedSequence &operator=(const PackedSequence &) = delete;
+  PackedSequence(PackedSequence &&) = default;
+  PackedSequence &operator=(PackedSequence &&) = default;
+
+  // Sequence of the size bases from base offset of bases on, with the N
+  // runs given, which both have to outlive it
+  static PackedSequence View(const std::uint8_t *bases, size_t offset,
+                             size_t size, const Run *runs, size_t runs_size);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // 2-bit code of base i, A in N runs
+  unsigned char code(size_t i) const {
+    const size_t pos = offset_ + i;
+    return (bases_[pos / 4] >> (2 * (pos % 4))) & 3;
+  }
+
+  const Run *runs() const { return runs_; }
+  size_t num_runs() const { return runsSize_; }
+
+  // Appends bases [begin, end) to out as ACGT and N
+  void Unpack(size_t begin, size_t end, std::string &out) const;
+
+  // Bytes the sequence owns
+  size_t capacity() const {
+    return ownBases_.capacity() + ownRuns_.capacity() * sizeof(Run);
+  }
+
+private:
+  std::vector<std::uint8_t> ownBases_;
+  std::vector<Run> ownRuns_;
+  // bases and runs in use, either the ones above or ones given to View
+  const std::uint8_t *bases_ = nullptr;
+  size_t offset_ = 0;
+  size_t size_ = 0;
+  const Run *runs_ = nullptr;
+  size_t runsSize_ = 0;
+};
+
+} // namespace crimson
+
+#endif // CRIMSON_PACKED_SEQUENCE_HPP_
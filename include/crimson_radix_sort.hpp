@@ -0,0 +1,61 @@
+#ifndef CRIMSON_RADIX_SORT_HPP_
+#define CRIMSON_RADIX_SORT_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace crimson {
+
+// Number of bits needed to hold x
+inline unsigned int BitWidth(std::uint64_t x) {
+  unsigned int ret = 0;
+  for (; x != 0; x >>= 1)
+    ++ret;
+  return ret;
+}
+
+// Fewer items than this are insertion sorted, for which the buckets of
+// every pass would cost more than the sort
+constexpr size_t kRadixSortMinSize = 64;
+
+// Stable LSD radix sort of items by the lowest key_bits bits of key(item),
+// one byte per pass, with buffer as scratch space of the size of items.
+// Passes in which every item falls in the same bucket are skipped.
+template <typename T, typename Key>
+void RadixSort(std::vector<T> &items, std::vector<T> &buffer,
+               unsigned int key_bits, Key key) {
+  if (items.size() < kRadixSortMinSize) {
+    const std::uint64_t mask =
+        key_bits >= 64 ? ~std::uint64_t(0)
+                       : (std::uint64_t(1) << key_bits) - 1;
+    for (size_t i = 1; i < items.size(); ++i) {
+      T item = items[i];
+      const std::uint64_t itemKey = key(item) & mask;
+      size_t j = i;
+      for (; j > 0 && (key(items[j - 1]) & mask) > itemKey; --j)
+        items[j] = items[j - 1];
+      items[j] = item;
+    }
+    return;
+  }
+
+  buffer.resize(items.size());
+  for (unsigned shift = 0; shift < key_bits; shift += 8) {
+    size_t count[257] = {};
+    for (const T &item : items)
+      ++count[((key(item) >> shift) & 0xFF) + 1];
+    if (*std::max_element(count + 1, count + 257) == items.size())
+      continue;
+    for (unsigned i = 1; i < 257; ++i)
+      count[i] += count[i - 1];
+    for (const T &item : items)
+      buffer[count[(key(item) >> shift) & 0xFF]++] = item;
+    items.swap(buffer);
+  }
+}
+
+} // namespace crimson
+
+#endif // CRIMSON_RADIX_SORT_HPP_
@@ -0,0 +1,92 @@
+#include "crimson_thread_pool.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace crimson {
+
+namespace {
+
+// Index of the pool queue owned by the calling thread, if it is a worker
+thread_local const ThreadPool *workerPool = nullptr;
+thread_local unsigned int workerId = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  threads = std::max(threads, 1u);
+  for (unsigned int i = 0; i < threads; ++i)
+    queues_.emplace_back(new Queue());
+  for (unsigned int i = 0; i < threads; ++i)
+    threads_.emplace_back(&ThreadPool::Run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  for (std::thread &i : threads_)
+    i.join();
+}
+
+void ThreadPool::Push(std::function<void()> task) {
+  unsigned int id = workerPool == this
+                        ? workerId
+                        : nextQueue_++ % static_cast<unsigned int>(
+                                             queues_.size());
+  {
+    std::lock_guard<std::mutex> lock(queues_[id]->mutex);
+    queues_[id]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++pending_;
+  }
+  condition_.notify_one();
+}
+
+bool ThreadPool::Pop(unsigned int id, std::function<void()> *task) {
+  {
+    Queue &own = *queues_[id];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    Queue &other = *queues_[(id + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(other.mutex);
+    if (!other.tasks.empty()) {
+      *task = std::move(other.tasks.front());
+      other.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Run(unsigned int id) {
+  workerPool = this;
+  workerId = id;
+  std::function<void()> task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+      if (pending_ == 0)
+        return;
+      --pending_;
+    }
+    // a pending task is reserved for this worker, it may still be sitting in
+    // a deque that is being pushed to
+    while (!Pop(id, &task))
+      std::this_thread::yield();
+    task();
+    task = nullptr;
+  }
+}
+
+} // namespace crimson
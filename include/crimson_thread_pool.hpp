@@ -0,0 +1,116 @@
+#ifndef CRIMSON_THREAD_POOL_HPP_
+#define CRIMSON_THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace crimson {
+
+// Fixed set of workers with one task deque each. Tasks submitted from a
+// worker go to the back of its own deque, other tasks are spread round robin.
+// A worker takes tasks from the back of its own deque and, once it runs dry,
+// steals from the front of the others.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned int NumThreads() const {
+    return static_cast<unsigned int>(threads_.size());
+  }
+
+  template <typename F, typename... Args>
+  std::future<std::invoke_result_t<F, Args...>> Submit(F &&f,
+                                                       Args &&...args) {
+    using Result = std::invoke_result_t<F, Args...>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<Result> ret = task->get_future();
+    Push([task]() { (*task)(); });
+    return ret;
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void Push(std::function<void()> task);
+  bool Pop(unsigned int id, std::function<void()> *task);
+  void Run(unsigned int id);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  size_t pending_ = 0;
+  bool stop_ = false;
+  std::atomic<unsigned int> nextQueue_{0};
+};
+
+// Queue of at most capacity items passed between threads. Push blocks while
+// the queue is full and Pop while it is empty. Once the queue is closed,
+// Push fails and Pop fails after the remaining items are taken.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_)
+      return false;
+    items_.push_back(std::move(item));
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  bool Pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+      return false;
+    *item = std::move(items_.front());
+    items_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    notFull_.notify_all();
+    notEmpty_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+  std::deque<T> items_;
+  size_t capacity_;
+  bool closed_ = false;
+};
+
+} // namespace crimson
+
+#endif // CRIMSON_THREAD_POOL_HPP_
@@ -0,0 +1,163 @@
+#include "crimson_alignment_engine.hpp"
+#include "crimson_edit_distance.hpp"
+#include "crimson_thread_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// every allocation of the benchmark is counted
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ret = std::malloc(size == 0 ? 1 : size))
+    return ret;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+const char *kTypeNames[] = {"global", "local", "semiglobal"};
+const char *kLevelNames[] = {"scalar", "sse4.1", "avx2", "avx512"};
+
+// Pair of sequences which differ in about every tenth base
+void RandomPair(unsigned int len, std::string &query, std::string &target) {
+  std::mt19937 rng(len);
+  target.resize(len);
+  for (char &c : target)
+    c = "ACGT"[rng() % 4];
+  query = target;
+  for (unsigned int i = 0; i < len / 10; ++i)
+    query[rng() % len] = "ACGT"[rng() % 4];
+}
+
+// Seconds taken by repeats runs of align
+template <typename AlignFunction>
+double Time(unsigned int repeats, AlignFunction align) {
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int r = 0; r < repeats; ++r) {
+    std::string cigar;
+    unsigned int target_begin = 0;
+    align(&cigar, &target_begin);
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Alignments per second and allocations per alignment of many short pairs
+// aligned by the given number of threads, as the gaps between minimizer
+// matches are, with or without a workspace per thread
+void AlignShortPairs(unsigned int threads, bool withWorkspace) {
+  using namespace crimson;
+
+  constexpr unsigned int kPairs = 1000, kTasks = 64, kLen = 150;
+  std::string query, target;
+  RandomPair(kLen, query, target);
+
+  ThreadPool pool(threads);
+  const size_t allocationsBefore = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::future<void>> tasks;
+  for (unsigned int t = 0; t < kTasks; ++t) {
+    tasks.push_back(pool.Submit([&]() {
+      thread_local AlignmentWorkspace workspace;
+      thread_local std::string cigar;
+      unsigned int target_begin = 0;
+      for (unsigned int r = 0; r < kPairs; ++r) {
+        cigar.clear();
+        if (withWorkspace)
+          Align(workspace, query.c_str(), kLen, target.c_str(), kLen,
+                AlignmentType::global, 3, -5, -4, &cigar, &target_begin);
+        else
+          Align(query.c_str(), kLen, target.c_str(), kLen,
+                AlignmentType::global, 3, -5, -4, &cigar, &target_begin);
+      }
+    }));
+  }
+  for (std::future<void> &i : tasks)
+    i.get();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  const double alignments = double(kPairs) * kTasks;
+  printf("%-7u %-9s %12.0f %12.2f\n", threads,
+         withWorkspace ? "yes" : "no", alignments / seconds,
+         double(allocations.load() - allocationsBefore) / alignments);
+}
+
+} // namespace
+
+// Reports cell updates per second of the scalar and every vectorized
+// alignment kernel the host supports and of the edit distance, then the
+// throughput and allocations of short alignments on up to the given number
+// of threads, usage: crimson_align_bench [length] [repeats] [threads]
+int main(int argc, char **argv) {
+  using namespace crimson;
+
+  unsigned int len = argc > 1 ? (unsigned)std::stoi(argv[1]) : 2000;
+  unsigned int repeats = argc > 2 ? (unsigned)std::stoi(argv[2]) : 3;
+  unsigned int maxThreads = argc > 3 ? (unsigned)std::stoi(argv[3]) : 8;
+
+  std::string query, target;
+  RandomPair(len, query, target);
+  const double cells = double(len) * len * repeats;
+
+  printf("%u x %u bases, %u repeats, Gcells/s\n", len, len, repeats);
+  printf("%-11s %-7s %10s %10s\n", "type", "kernel", "score", "cigar");
+  for (AlignmentType type : {AlignmentType::global, AlignmentType::local,
+                             AlignmentType::semiglobal}) {
+    for (SimdLevel level : {SimdLevel::none, SimdLevel::sse41,
+                            SimdLevel::avx2, SimdLevel::avx512}) {
+      if (level > HostSimdLevel())
+        break;
+      double seconds[2];
+      for (int withCigar = 0; withCigar < 2; ++withCigar) {
+        seconds[withCigar] = Time(repeats, [&](std::string *cigar,
+                                               unsigned int *target_begin) {
+          AlignVectorized(query.c_str(), len, target.c_str(), len, type, 3, -5,
+                          -4, level, withCigar ? cigar : nullptr,
+                          withCigar ? target_begin : nullptr);
+        });
+      }
+      printf("%-11s %-7s %10.3f %10.3f\n", kTypeNames[int(type)],
+             kLevelNames[int(level)], cells / seconds[0] / 1e9,
+             cells / seconds[1] / 1e9);
+    }
+
+    // unit cost alignments of the bit-parallel edit distance
+    if (type == AlignmentType::local)
+      continue;
+    double seconds[2];
+    for (int withCigar = 0; withCigar < 2; ++withCigar) {
+      seconds[withCigar] = Time(repeats, [&](std::string *cigar,
+                                             unsigned int *target_begin) {
+        EditDistance(query.c_str(), len, target.c_str(), len, type,
+                     withCigar ? cigar : nullptr,
+                     withCigar ? target_begin : nullptr);
+      });
+    }
+    printf("%-11s %-7s %10.3f %10.3f\n", kTypeNames[int(type)], "myers",
+           cells / seconds[0] / 1e9, cells / seconds[1] / 1e9);
+  }
+
+  printf("\n150 x 150 base global alignments with a cigar\n");
+  printf("%-7s %-9s %12s %12s\n", "threads", "workspace", "aligns/s",
+         "allocs/align");
+  for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+    for (bool withWorkspace : {false, true})
+      AlignShortPairs(threads, withWorkspace);
+
+  return 0;
+}
@@ -0,0 +1,554 @@
+#include "crimson_alignment_engine.hpp"
+#include "crimson_chaining_engine.hpp"
+#include "crimson_edit_distance.hpp"
+#include "crimson_minimizer_engine.hpp"
+#include "crimson_packed_sequence.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using KmerT = std::uint32_t;
+
+// minimizers and filter of the mapper by default
+constexpr unsigned int kKmerLen = 15;
+constexpr unsigned int kWindowLen = 10;
+constexpr double kFilterFrequency = 0.001;
+
+// costs and band of the mapper by default
+constexpr int kMatch = 3, kMismatch = -5, kGap = -4;
+constexpr unsigned int kBandWidth = 64;
+
+// Reference and reads simulated for the benchmarks, set by --sim_* flags
+struct SimulationOptions {
+  unsigned int references = 4;
+  size_t reference_len = 2000000;
+  // fraction of each reference made of diverged copies of other parts of it
+  double repeat_fraction = 0.02;
+  unsigned int reads = 200;
+  // mean read length, of a gamma distribution with shape 2 as nanopore
+  // read lengths roughly follow
+  unsigned int read_len = 5000;
+  // errors per template base, the fraction of them which are indels rather
+  // than substitutions, and the fraction of indels which are deletions
+  double error_rate = 0.1;
+  double indel_fraction = 0.6;
+  double deletion_fraction = 0.55;
+  unsigned int seed = 1;
+};
+
+SimulationOptions simulation;
+
+// Generator whose numbers are the same on every platform, unlike those of
+// the standard distributions, so a seed always simulates the same data
+class Random {
+public:
+  explicit Random(std::uint64_t seed) : engine_(seed) {}
+
+  // Uniform in [0, n)
+  size_t Below(size_t n) { return static_cast<size_t>(engine_() % n); }
+  // Uniform in [0, 1)
+  double Uniform() { return double(engine_() >> 11) * 0x1.0p-53; }
+  char Base() { return "ACGT"[engine_() & 3]; }
+  // Gamma distributed with shape 2, as the sum of two exponentials
+  double Gamma2(double mean) {
+    return -mean / 2 * (std::log1p(-Uniform()) + std::log1p(-Uniform()));
+  }
+
+private:
+  std::mt19937_64 engine_;
+};
+
+std::string ReverseComplement(std::string_view sequence) {
+  std::string ret(sequence.rbegin(), sequence.rend());
+  for (char &c : ret)
+    c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+  return ret;
+}
+
+// Reference of random bases in which repeat_fraction of the bases are
+// copies of other parts with about one substitution in a hundred bases
+std::string SimulateReference(size_t len, Random &random) {
+  constexpr size_t kRepeatLen = 2000;
+  std::string ret(len, 'A');
+  for (char &c : ret)
+    c = random.Base();
+  if (len < 2 * kRepeatLen)
+    return ret;
+  const size_t repeats =
+      static_cast<size_t>(simulation.repeat_fraction * double(len)) /
+      kRepeatLen;
+  for (size_t r = 0; r < repeats; ++r) {
+    const size_t from = random.Below(len - kRepeatLen);
+    const size_t to = random.Below(len - kRepeatLen);
+    std::string copy = ret.substr(from, kRepeatLen);
+    for (size_t i = 0; i < kRepeatLen / 100; ++i)
+      copy[random.Below(kRepeatLen)] = random.Base();
+    ret.replace(to, kRepeatLen, copy);
+  }
+  return ret;
+}
+
+// Read sequenced from source with the errors of the simulation. Indels
+// span one base or, less and less often, a few.
+std::string SimulateErrors(std::string_view source, Random &random) {
+  std::string ret;
+  ret.reserve(source.size() + source.size() / 8);
+  for (size_t i = 0; i < source.size(); ++i) {
+    if (random.Uniform() >= simulation.error_rate) {
+      ret += source[i];
+      continue;
+    }
+    if (random.Uniform() >= simulation.indel_fraction) {
+      char base;
+      do
+        base = random.Base();
+      while (base == source[i]);
+      ret += base;
+      continue;
+    }
+    const bool deletion = random.Uniform() < simulation.deletion_fraction;
+    unsigned int len = 1;
+    while (random.Uniform() < 0.3)
+      ++len;
+    if (deletion) {
+      i += len - 1;
+    } else {
+      for (unsigned int j = 0; j < len; ++j)
+        ret += random.Base();
+      ret += source[i];
+    }
+  }
+  return ret;
+}
+
+// Simulated references and the reads sampled from them, on both strands
+struct Dataset {
+  std::vector<std::string> references;
+  std::vector<crimson::PackedSequence> packedReferences;
+  std::vector<const crimson::PackedSequence *> referencePointers;
+  std::vector<std::string> reads;
+  std::vector<crimson::PackedSequence> packedReads;
+  size_t readBases = 0;
+};
+
+// Dataset of the simulation, simulated on first use
+const Dataset &GetDataset() {
+  static const std::unique_ptr<Dataset> dataset = [] {
+    auto ret = std::make_unique<Dataset>();
+    Random random(simulation.seed);
+    for (unsigned int i = 0; i < simulation.references; ++i)
+      ret->references.push_back(
+          SimulateReference(simulation.reference_len, random));
+    for (const std::string &i : ret->references)
+      ret->packedReferences.emplace_back(i);
+    for (const crimson::PackedSequence &i : ret->packedReferences)
+      ret->referencePointers.push_back(&i);
+
+    for (unsigned int i = 0; i < simulation.reads; ++i) {
+      const std::string &reference =
+          ret->references[random.Below(ret->references.size())];
+      const size_t len = std::clamp<size_t>(
+          static_cast<size_t>(random.Gamma2(simulation.read_len)), 100,
+          reference.size());
+      const size_t begin = random.Below(reference.size() - len + 1);
+      std::string read = SimulateErrors(
+          std::string_view(reference).substr(begin, len), random);
+      if (random.Below(2) == 1)
+        read = ReverseComplement(read);
+      ret->readBases += read.size();
+      ret->reads.push_back(std::move(read));
+    }
+    for (const std::string &i : ret->reads)
+      ret->packedReads.emplace_back(i);
+    return ret;
+  }();
+  return *dataset;
+}
+
+// Filtered index of the references as the mapper builds it, built on first
+// use
+const crimson::MinimizerIndex<KmerT> &GetIndex() {
+  static const crimson::MinimizerIndex<KmerT> index(
+      GetDataset().referencePointers, kKmerLen, kWindowLen, 1,
+      crimson::IndexFilter{kFilterFrequency, 0});
+  return index;
+}
+
+// Read of len template bases aligned to the reference part it was sampled
+// from, and the chained minimizer matches between them as the mapper
+// anchors its alignments with
+struct AlignmentPair {
+  std::string query;
+  std::string target;
+  std::vector<crimson::AlignmentAnchor> anchors;
+};
+
+const AlignmentPair &GetPair(unsigned int len) {
+  static std::map<unsigned int, AlignmentPair> pairs;
+  auto it = pairs.find(len);
+  if (it != pairs.end())
+    return it->second;
+
+  AlignmentPair &ret = pairs[len];
+  const std::string &reference = GetDataset().references[0];
+  Random random(std::uint64_t(simulation.seed) * 1000003 + len);
+  len = static_cast<unsigned int>(std::min<size_t>(len, reference.size()));
+  ret.target = reference.substr(random.Below(reference.size() - len + 1), len);
+  ret.query = SimulateErrors(ret.target, random);
+
+  crimson::PackedSequence target(ret.target), query(ret.query);
+  crimson::MinimizerIndex<KmerT> index({&target}, kKmerLen, kWindowLen);
+  crimson::ChainingWorkspace<KmerT> workspace;
+  index.Overlaps(query, workspace.overlaps());
+  auto chains = crimson::ChainOverlaps(workspace, kKmerLen,
+                                       (unsigned)ret.query.size());
+  for (const crimson::BasicChain<KmerT> &chain : chains) {
+    if (chain.is_reverse)
+      continue;
+    for (const crimson::BasicOverlap<KmerT> &i : chain.matches)
+      ret.anchors.push_back({i.query_pos, i.reference_pos});
+    break;
+  }
+  return ret;
+}
+
+// Query bases, and for full matrices cells, aligned per second
+void SetAlignmentCounters(benchmark::State &state, const AlignmentPair &pair,
+                          bool fullMatrix) {
+  state.counters["bases"] = benchmark::Counter(
+      double(pair.query.size()), benchmark::Counter::kIsIterationInvariantRate);
+  if (fullMatrix)
+    state.counters["cells"] = benchmark::Counter(
+        double(pair.query.size()) * double(pair.target.size()),
+        benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void SetReadCounters(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  state.counters["reads"] =
+      benchmark::Counter(double(dataset.reads.size()),
+                         benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["bases"] =
+      benchmark::Counter(double(dataset.readBases),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Minimizers of every read, from its text
+void BM_Minimize(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  for (auto _ : state)
+    for (const std::string &i : dataset.reads)
+      benchmark::DoNotOptimize(crimson::Minimize<KmerT>(
+          i.c_str(), (unsigned)i.size(), kKmerLen, kWindowLen));
+  SetReadCounters(state);
+}
+BENCHMARK(BM_Minimize)->Unit(benchmark::kMillisecond);
+
+// Minimizers of every read, from its packed bases
+void BM_MinimizePacked(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  for (auto _ : state)
+    for (const crimson::PackedSequence &i : dataset.packedReads)
+      benchmark::DoNotOptimize(
+          crimson::Minimize<KmerT>(i, kKmerLen, kWindowLen));
+  SetReadCounters(state);
+}
+BENCHMARK(BM_MinimizePacked)->Unit(benchmark::kMillisecond);
+
+// Index of the references on the given number of threads, unfiltered and
+// with the filter applied while it is built
+void BM_BuildIndex(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  crimson::IndexFilter filter;
+  if (state.range(1) != 0)
+    filter.frequency = kFilterFrequency;
+  for (auto _ : state) {
+    crimson::MinimizerIndex<KmerT> index(dataset.referencePointers, kKmerLen,
+                                         kWindowLen,
+                                         (unsigned)state.range(0), filter);
+    benchmark::DoNotOptimize(index.num_entries());
+  }
+  state.counters["bases"] = benchmark::Counter(
+      double(simulation.references) * double(simulation.reference_len),
+      benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_BuildIndex)
+    ->ArgNames({"threads", "filtered"})
+    ->ArgsProduct({{1, 4}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Filter of a built index. Every iteration builds the index again, which
+// is not timed, so the iterations are few.
+void BM_Filter(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  for (auto _ : state) {
+    state.PauseTiming();
+    crimson::MinimizerIndex<KmerT> index(dataset.referencePointers, kKmerLen,
+                                         kWindowLen);
+    state.ResumeTiming();
+    index.Filter(kFilterFrequency);
+    benchmark::DoNotOptimize(index.num_entries());
+  }
+}
+BENCHMARK(BM_Filter)->Iterations(5)->Unit(benchmark::kMillisecond);
+
+// Chains of every read, from the lookup of its minimizers in the filtered
+// index, as the mapper finds them
+void BM_Map(benchmark::State &state) {
+  const Dataset &dataset = GetDataset();
+  const crimson::MinimizerIndex<KmerT> &index = GetIndex();
+  crimson::ChainingWorkspace<KmerT> workspace;
+  for (auto _ : state) {
+    for (const crimson::PackedSequence &i : dataset.packedReads) {
+      index.Overlaps(i, workspace.overlaps());
+      benchmark::DoNotOptimize(crimson::ChainOverlaps(
+          workspace, kKmerLen, (unsigned)i.size()));
+    }
+  }
+  SetReadCounters(state);
+}
+BENCHMARK(BM_Map)->Unit(benchmark::kMillisecond);
+
+// Full alignment of the given type with a cigar
+void BM_Align(benchmark::State &state, crimson::AlignmentType type) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  crimson::AlignmentWorkspace workspace;
+  std::string cigar;
+  unsigned int target_begin = 0;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::Align(
+        workspace, pair.query.c_str(), (unsigned)pair.query.size(),
+        pair.target.c_str(), (unsigned)pair.target.size(), type, kMatch,
+        kMismatch, kGap, &cigar, &target_begin));
+  }
+  SetAlignmentCounters(state, pair, true);
+}
+BENCHMARK_CAPTURE(BM_Align, global, crimson::AlignmentType::global)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Align, local, crimson::AlignmentType::local)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Align, semiglobal, crimson::AlignmentType::semiglobal)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+
+// Global alignment with a cigar in the memory of checkpoint rows
+void BM_AlignCheckpointed(benchmark::State &state) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  const auto blockRows =
+      static_cast<unsigned int>(std::sqrt(double(pair.query.size())));
+  std::string cigar;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::AlignCheckpointed(
+        pair.query.c_str(), (unsigned)pair.query.size(), pair.target.c_str(),
+        (unsigned)pair.target.size(), crimson::AlignmentType::global, kMatch,
+        kMismatch, kGap, blockRows, &cigar));
+  }
+  SetAlignmentCounters(state, pair, true);
+}
+BENCHMARK(BM_AlignCheckpointed)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+
+// Alignment of the given type in the band around the minimizer matches
+void BM_AlignBanded(benchmark::State &state, crimson::AlignmentType type) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  crimson::AlignmentWorkspace workspace;
+  std::string cigar;
+  unsigned int target_begin = 0;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::AlignBanded(
+        workspace, pair.query.c_str(), (unsigned)pair.query.size(),
+        pair.target.c_str(), (unsigned)pair.target.size(), type, kMatch,
+        kMismatch, kGap, pair.anchors, kBandWidth, &cigar, &target_begin));
+  }
+  SetAlignmentCounters(state, pair, false);
+}
+BENCHMARK_CAPTURE(BM_AlignBanded, global, crimson::AlignmentType::global)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_AlignBanded, local, crimson::AlignmentType::local)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_AlignBanded, semiglobal,
+                  crimson::AlignmentType::semiglobal)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+
+// Global alignment of the gaps between the minimizer matches
+void BM_AlignPiecewise(benchmark::State &state) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  crimson::AlignmentWorkspace workspace;
+  std::string cigar;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::AlignPiecewise(
+        workspace, pair.query.c_str(), (unsigned)pair.query.size(),
+        pair.target.c_str(), (unsigned)pair.target.size(), kMatch, kMismatch,
+        kGap, pair.anchors, kKmerLen, kBandWidth, &cigar));
+  }
+  SetAlignmentCounters(state, pair, false);
+}
+BENCHMARK(BM_AlignPiecewise)
+    ->Arg(1000)
+    ->Arg(20000)
+    ->Unit(benchmark::kMillisecond);
+
+// X-drop extension from the start of the pair
+void BM_ExtendAlignment(benchmark::State &state) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  crimson::AlignmentWorkspace workspace;
+  std::string cigar;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::ExtendAlignment(
+        workspace, pair.query.c_str(), (unsigned)pair.query.size(),
+        pair.target.c_str(), (unsigned)pair.target.size(), kMatch, kMismatch,
+        kGap, 200, 400, false, &cigar));
+  }
+  SetAlignmentCounters(state, pair, false);
+}
+BENCHMARK(BM_ExtendAlignment)
+    ->Arg(1000)
+    ->Arg(20000)
+    ->Unit(benchmark::kMillisecond);
+
+// Unit cost alignment of the given type with a cigar
+void BM_EditDistance(benchmark::State &state, crimson::AlignmentType type) {
+  const AlignmentPair &pair = GetPair((unsigned)state.range(0));
+  std::string cigar;
+  unsigned int target_begin = 0;
+  for (auto _ : state) {
+    cigar.clear();
+    benchmark::DoNotOptimize(crimson::EditDistance(
+        pair.query.c_str(), (unsigned)pair.query.size(), pair.target.c_str(),
+        (unsigned)pair.target.size(), type, &cigar, &target_begin));
+  }
+  SetAlignmentCounters(state, pair, true);
+}
+BENCHMARK_CAPTURE(BM_EditDistance, global, crimson::AlignmentType::global)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_EditDistance, semiglobal,
+                  crimson::AlignmentType::semiglobal)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+
+// Flags of the simulation, which are recorded in the context of the output
+struct SimulationFlag {
+  const char *name;
+  void (*parse)(const char *value);
+  std::string (*print)();
+};
+
+template <typename T, T SimulationOptions::*Field>
+SimulationFlag MakeFlag(const char *name) {
+  return {name,
+          [](const char *value) {
+            if constexpr (std::is_floating_point_v<T>)
+              simulation.*Field = std::stod(value);
+            else
+              simulation.*Field = static_cast<T>(std::stoull(value));
+          },
+          [] { return std::to_string(simulation.*Field); }};
+}
+
+const SimulationFlag kSimulationFlags[] = {
+    MakeFlag<unsigned int, &SimulationOptions::references>("references"),
+    MakeFlag<size_t, &SimulationOptions::reference_len>("reference_len"),
+    MakeFlag<double, &SimulationOptions::repeat_fraction>("repeat_fraction"),
+    MakeFlag<unsigned int, &SimulationOptions::reads>("reads"),
+    MakeFlag<unsigned int, &SimulationOptions::read_len>("read_len"),
+    MakeFlag<double, &SimulationOptions::error_rate>("error_rate"),
+    MakeFlag<double, &SimulationOptions::indel_fraction>("indel_fraction"),
+    MakeFlag<double, &SimulationOptions::deletion_fraction>(
+        "deletion_fraction"),
+    MakeFlag<unsigned int, &SimulationOptions::seed>("seed"),
+};
+
+void PrintHelp() {
+  printf("crimson_bench [--sim_<name>=<value>...] [benchmark flags]\n\n"
+         "Benchmarks the mapper on simulated references and nanopore-like "
+         "reads.\nSimulation flags and their defaults:\n");
+  for (const SimulationFlag &i : kSimulationFlags)
+    printf("  --sim_%s=%s\n", i.name, i.print().c_str());
+  printf("\nResults are written as JSON with --benchmark_format=json, or to a "
+         "file with\n--benchmark_out=<file>.\n\n");
+  benchmark::PrintDefaultHelp();
+}
+
+} // namespace
+
+// Benchmarks the steps of the mapper on a reference and reads simulated
+// from the --sim_* flags, which are deterministic for a seed, usage:
+// crimson_bench --sim_reads=1000 --benchmark_out=bench.json
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv, PrintHelp);
+
+  int unparsed = 1;
+  for (int i = 1; i < argc; ++i) {
+    const SimulationFlag *flag = nullptr;
+    const char *value = nullptr;
+    for (const SimulationFlag &j : kSimulationFlags) {
+      const size_t len = std::strlen(j.name);
+      if (std::strncmp(argv[i], "--sim_", 6) == 0 &&
+          std::strncmp(argv[i] + 6, j.name, len) == 0 &&
+          argv[i][6 + len] == '=') {
+        flag = &j;
+        value = argv[i] + 7 + len;
+      }
+    }
+    if (flag == nullptr) {
+      argv[unparsed++] = argv[i];
+      continue;
+    }
+    try {
+      flag->parse(value);
+    } catch (const std::exception &) {
+      fprintf(stderr, "[crimson_bench] error: invalid value of --sim_%s\n",
+              flag->name);
+      return 1;
+    }
+  }
+  argc = unparsed;
+  if (simulation.references == 0 || simulation.reference_len < 100) {
+    fprintf(stderr, "[crimson_bench] error: references need at least 100 "
+                    "bases\n");
+    return 1;
+  }
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  for (const SimulationFlag &i : kSimulationFlags)
+    benchmark::AddCustomContext(std::string("sim_") + i.name, i.print());
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,21 +1,37 @@
 #include "bioparser/fasta_parser.hpp"
 #include "bioparser/fastq_parser.hpp"
 #include "crimson_alignment_engine.hpp"
+#include "crimson_chaining_engine.hpp"
+#include "crimson_edit_distance.hpp"
+#include "crimson_index_file.hpp"
 #include "crimson_minimizer_engine.hpp"
+#include "crimson_output.hpp"
+#include "crimson_packed_sequence.hpp"
+#include "crimson_thread_pool.hpp"
 #include "include/crimson_mapperConfig.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <getopt.h>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include <zlib.h>
 
 void help() {
   printf(R"((--version - show version
@@ -25,12 +41,846 @@ void help() {
 -m <int> - match cost (default: 3)
 -n <int> - mismatch cost (default: -5)
 -g <int> - gap cost (default: -4)
--k <int> - k-mer size (default: 15)
+-o <int>[,<int>] - gap open cost, gaps of length l then cost o + l * e
+                   instead of l * g, and with a second pair of costs the
+                   higher of both, so long gaps cost less (default: 0)
+-e <int>[,<int>] - gap extension cost (default: 0)
+-x <int> - X-drop of the extension of global alignments from the ends of the
+           minimizer matches into the rest of the fragment with -c, 0 to
+           not extend them (default: 0)
+-z <int> - Z-drop of alignments with -c, which are split at diverged regions
+           into supplementary mappings and whose extension stops at them,
+           0 to turn it off (default: 400)
+-b <int> - alignment band width around the minimizer matches (default: 64)
+-k <int> - k-mer size, at most 32 (default: 15)
 -w <int> - window size (default: 10)
--f <int> - k-mer frequency threshold (default: 0.001)
+-f <float> - fraction of the most frequent minimizers left out of the index
+             (default: 0.001)
+-t <int> - number of threads (default: 1)
+-N <int> - secondary mappings output per primary or supplementary one,
+           which cover most of its part of the fragment with at least 0.8
+           of its chain score (default: 5)
+-d <file> - save the reference index to file and exit, the file can then be
+            given in place of the reference, which fixes -k, -w, -f and
+            --max-occ
+--unordered - output mappings as soon as they are ready instead of in input order
+--identity - estimate the identity of mappings from their edit distance
+             instead of aligning them, and report it in the NM tag
+--piecewise - align only the gaps between minimizer matches with -c, globally
+--max-occ <int> - leave minimizers with more occurrences in the references
+                  out of the index, 0 to keep them (default: 0)
+--sam - output SAM instead of PAF, which implies -c
+--bgzf - compress the output with BGZF on the mapping threads, which gzip,
+         bgzip and samtools read
+With -m 0 -n -1 -g -1 global and semiglobal alignments are computed as edit
+distances, which is much faster.
 ))");
 }
 
+using seqsize_t = std::uint32_t;
+
+// Parsed sequence, whose bases are packed as they are parsed
+struct Sequence {
+  std::string name;
+  crimson::PackedSequence data;
+  std::string quality;
+  Sequence(const char *name, seqsize_t nameLen, const char *data,
+           seqsize_t dataLen)
+      : name(name, nameLen), data(std::string_view(data, dataLen)) {}
+  Sequence(const char *name, seqsize_t nameLen, const char *data,
+           seqsize_t dataLen, const char *quality, seqsize_t qualityLen)
+      : name(name, nameLen), data(std::string_view(data, dataLen)) {
+    if (storeQuality)
+      this->quality.assign(quality, qualityLen);
+  }
+
+  // Whether FASTQ qualities are kept, they are dropped while parsing
+  // unless the output needs them
+  static inline bool storeQuality = false;
+};
+
+// Parser of a FASTA or FASTQ file, either of which can be gzip compressed,
+// told apart by the first character of the file. Throws
+// std::invalid_argument if the file can not be opened or has neither format.
+std::unique_ptr<bioparser::Parser<Sequence>>
+CreateParser(const std::string &path) {
+  gzFile file = gzopen(path.c_str(), "r");
+  if (file == nullptr)
+    throw std::invalid_argument("[crimson_mapper] error: unable to open file " +
+                                path);
+  int first;
+  do {
+    first = gzgetc(file);
+  } while (first != -1 && std::isspace(first));
+  gzclose(file);
+
+  if (first == '>')
+    return bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(path);
+  if (first == '@')
+    return bioparser::Parser<Sequence>::Create<bioparser::FastqParser>(path);
+  throw std::invalid_argument("[crimson_mapper] error: file " + path +
+                              " is neither FASTA nor FASTQ");
+}
+
+// Parses "<int>" or "<int>,<int>" into costs, returns whether a second cost
+// was given
+bool ParseCostPair(const char *arg, int (&costs)[2]) {
+  const char *comma = std::strchr(arg, ',');
+  costs[0] = std::stoi(arg);
+  if (comma == nullptr)
+    return false;
+  costs[1] = std::stoi(comma + 1);
+  return true;
+}
+
+struct MapperOptions {
+  bool calcAlignment = false;
+  crimson::AlignmentType alignType = crimson::AlignmentType::global;
+  int matchCost = 3;
+  int mismatchCost = -5;
+  int gapCost = -4;
+  // affine gaps if either is set, dual affine gaps with the second ones
+  int gapOpen[2] = {0, 0};
+  int gapExtend[2] = {0, 0};
+  unsigned int bandWidth = 64;
+  // extension of global alignments past the minimizer matches
+  int xDrop = 0;
+  int zDrop = 400;
+  unsigned int KmerSize = 15;
+  unsigned int windowSize = 10;
+  crimson::IndexFilter filter = {0.001, 0};
+  unsigned int threads = 1;
+  bool unorderedOutput = false;
+  bool identityOnly = false;
+  bool piecewise = false;
+  bool samOutput = false;
+  bool bgzfOutput = false;
+  crimson::ChainOptions chaining;
+
+  // scores of the edit distance, for which the bit-parallel aligner is used
+  bool IsUnitCost() const {
+    return matchCost == 0 && mismatchCost == -1 && gapCost == -1 &&
+           gapOpen[0] == 0 && gapExtend[0] == 0 &&
+           alignType != crimson::AlignmentType::local;
+  }
+  std::string indexOutput;
+  // command line for the SAM header
+  std::string commandLine;
+};
+
+// Reference sequences, either parsed from FASTA or read from an index file
+struct References {
+  std::vector<std::unique_ptr<Sequence>> parsed;
+  std::unique_ptr<crimson::IndexFile> file;
+
+  size_t size() const { return file ? file->num_references() : parsed.size(); }
+  std::string_view name(size_t i) const {
+    return file ? file->name(i) : std::string_view(parsed[i]->name);
+  }
+  size_t length(size_t i) const {
+    return file ? file->length(i) : parsed[i]->data.size();
+  }
+  // Bases [begin, end) of reference i, unpacked into buffer
+  const char *Bases(size_t i, size_t begin, size_t end,
+                    std::string &buffer) const {
+    buffer.clear();
+    if (file)
+      file->Extract(i, begin, end, buffer);
+    else
+      parsed[i]->data.Unpack(begin, end, buffer);
+    return buffer.c_str();
+  }
+};
+
+constexpr size_t kBatchBases = 1u << 20;
+// bases of the fragments whose minimizers are looked up in the index at once
+constexpr size_t kLookupBases = 1u << 16;
+// Fragments are parsed in batches of about kParseBytes of input, of which
+// at most kLiveBatches are held at once. Each task of a batch formats the
+// mappings of about kBatchBases fragment bases into a piece of output, and
+// at most kOutputPieces pieces, as many as the tasks of a batch, wait for
+// the writer. Besides the index, the pipeline thus holds at most two
+// batches of input, 512 MiB, and the output of at most three batches.
+constexpr std::uint64_t kParseBytes = 256ull << 20;
+constexpr size_t kLiveBatches = 2;
+constexpr size_t kOutputPieces = kParseBytes / kBatchBases;
+
+// Length statistics of fragments, gathered as they are parsed. Lengths are
+// counted per distinct value, so N50 needs no list of all fragments.
+struct FragmentStats {
+  size_t count = 0;
+  std::uint64_t totalLen = 0;
+  seqsize_t minLen = 0;
+  seqsize_t maxLen = 0;
+  std::map<seqsize_t, size_t> lenCounts;
+
+  void Add(seqsize_t len) {
+    minLen = count == 0 ? len : std::min(minLen, len);
+    maxLen = std::max(maxLen, len);
+    ++count;
+    totalLen += len;
+    ++lenCounts[len];
+  }
+
+  double AverageLen() const {
+    return count == 0 ? 0.0 : double(totalLen) / double(count);
+  }
+
+  seqsize_t N50() const {
+    std::uint64_t cummLen = 0;
+    for (auto i = lenCounts.rbegin(); i != lenCounts.rend(); ++i) {
+      cummLen += std::uint64_t(i->first) * i->second;
+      if (double(cummLen) >= ceil(double(totalLen) / 2.0))
+        return i->first;
+    }
+    return 0;
+  }
+};
+
+// Sets out to the reverse complement of bases
+void ReverseComplement(std::string_view bases, std::string &out) {
+  out.resize(bases.size());
+  std::transform(bases.rbegin(), bases.rend(), out.begin(), [](char c) {
+    switch (c) {
+    case 'A':
+      return 'T';
+    case 'C':
+      return 'G';
+    case 'G':
+      return 'C';
+    case 'T':
+      return 'A';
+    default:
+      return 'N';
+    }
+  });
+}
+
+// Appends the PAF or SAM line of a mapping of the chain of the kind, from
+// the fragment bases [q_begin, q_end) on the strand of the chain to the
+// reference bases [t_begin, t_end), aligned as the cigar describes if given
+template <typename KmerT>
+void AppendMapping(const Sequence &frag,
+                   const crimson::BasicChain<KmerT> &chain,
+                   crimson::ChainKind kind, const std::string &query,
+                   std::string_view quality, unsigned int q_begin,
+                   unsigned int q_end, unsigned int t_begin,
+                   unsigned int t_end, const std::string *cigar,
+                   const References &refs, const MapperOptions &options,
+                   std::string &out) {
+  using std::string;
+  using namespace crimson;
+
+  unsigned int j = chain.reference_index;
+  std::string_view refName = refs.name(j);
+  const unsigned int fragLen = (unsigned)frag.data.size();
+  const bool isSecondary = kind == ChainKind::secondary;
+  // primary and supplementary mappings are both of type P, as in minimap2
+  const char type = isSecondary ? 'S' : 'P';
+
+  CigarLengths cigarLengths;
+  unsigned int mismatches = 0;
+  int editDistance = -1;
+  if (cigar != nullptr) {
+    cigarLengths = MeasureCigar(*cigar);
+    string target;
+    editDistance = static_cast<int>(
+        CigarEditDistance(*cigar, query.c_str() + q_begin,
+                          refs.Bases(j, t_begin, t_end, target), &mismatches));
+  }
+
+  if (options.samOutput) {
+    // secondary mappings leave out the sequence, which other lines give
+    SamRecord record;
+    record.query_name = frag.name;
+    record.flag = (chain.is_reverse ? kSamReverse : 0) |
+                  (isSecondary ? kSamSecondary
+                   : kind == ChainKind::supplementary
+                       ? kSamSupplementary
+                       : 0);
+    record.target_name = refName;
+    record.position = t_begin;
+    record.mapq = chain.mapq;
+    record.clip_begin = q_begin;
+    record.cigar = *cigar;
+    record.clip_end = fragLen - q_end;
+    if (!isSecondary) {
+      record.sequence = query;
+      record.quality = quality;
+    }
+    record.edit_distance = editDistance;
+    record.type = type;
+    record.score = chain.score;
+    AppendSam(record, out);
+    return;
+  }
+
+  // PAF gives query positions on the fragment itself
+  PafRecord record;
+  record.query_name = frag.name;
+  record.query_len = fragLen;
+  record.query_begin = chain.is_reverse ? fragLen - q_end : q_begin;
+  record.query_end = chain.is_reverse ? fragLen - q_begin : q_end;
+  record.is_reverse = chain.is_reverse;
+  record.target_name = refName;
+  record.target_len = refs.length(j);
+  record.target_begin = t_begin;
+  record.target_end = t_end;
+  record.mapq = chain.mapq;
+  record.type = type;
+  record.score = chain.score;
+
+  if (cigar != nullptr) {
+    record.matches = cigarLengths.matches - mismatches;
+    record.block_len = cigarLengths.columns;
+    record.edit_distance = editDistance;
+    record.cigar = *cigar;
+  } else if (options.identityOnly) {
+    // the block is taken as long as the longer sequence, so identity is one
+    // minus the distance per base of it
+    string target;
+    AlignmentType alignType = options.alignType == AlignmentType::local
+                                  ? AlignmentType::global
+                                  : options.alignType;
+    unsigned int lenQ = q_end - q_begin;
+    unsigned int lenT = t_end - t_begin;
+    unsigned int blockLen = std::max(lenQ, lenT);
+    int distance =
+        EditDistance(query.c_str() + q_begin, lenQ,
+                     refs.Bases(j, t_begin, t_end, target), lenT, alignType);
+    record.matches = blockLen - static_cast<unsigned int>(distance);
+    record.block_len = blockLen;
+    record.edit_distance = distance;
+  } else {
+    unsigned int lenQ = q_end - q_begin;
+    unsigned int lenT = t_end - t_begin;
+    unsigned int minLen = std::min(lenQ, lenT);
+    record.matches = minLen / 2;
+    record.block_len = lenQ + lenT - minLen / 2;
+  }
+  AppendPaf(record, out);
+}
+
+// Appends the PAF or SAM lines of a chain of fragment matches to out, aligning
+// it with the buffers of workspace. query and quality hold the bases and
+// qualities of the fragment on the strand of the chain when it is aligned.
+template <typename KmerT>
+void MapChain(const Sequence &frag, const crimson::BasicChain<KmerT> &chain,
+              const std::string &query, std::string_view quality,
+              unsigned int KmerSize, const References &refs,
+              const MapperOptions &options,
+              crimson::AlignmentWorkspace &workspace, std::string &out) {
+  using std::string;
+  using std::vector;
+  using namespace crimson;
+
+  const vector<BasicOverlap<KmerT>> &overlaps = chain.matches;
+  BasicOverlap<KmerT> firstOverlap = overlaps[0];
+  BasicOverlap<KmerT> lastOverlap = overlaps.back();
+  unsigned int j = chain.reference_index;
+
+  // positions on the strand of the chain until the line is written
+  unsigned int q_begin = firstOverlap.query_pos;
+  unsigned int q_end = lastOverlap.query_pos + KmerSize;
+  unsigned int t_begin = firstOverlap.reference_pos;
+  unsigned int t_end = lastOverlap.reference_pos + KmerSize;
+
+  // start of the alignment past the chain start, where local and
+  // semiglobal alignments may skip bases
+  string cigar;
+  unsigned int target_begin = 0, query_begin = 0;
+  if (options.calcAlignment) {
+    string target;
+    const char *targetBases = refs.Bases(j, t_begin, t_end, target);
+
+    if (options.IsUnitCost()) {
+      EditDistance(query.c_str() + q_begin, q_end - q_begin, targetBases,
+                   t_end - t_begin, options.alignType, &cigar, &target_begin,
+                   -1, &query_begin);
+    } else {
+      // the band follows the chain of minimizer matches
+      vector<AlignmentAnchor> anchors;
+      anchors.reserve(overlaps.size());
+      for (const BasicOverlap<KmerT> &i : overlaps)
+        anchors.push_back({i.query_pos - q_begin, i.reference_pos - t_begin});
+
+      if (options.piecewise) {
+        // the matches pin both ends, so the alignment is global
+        AlignPiecewise(workspace, query.c_str() + q_begin, q_end - q_begin,
+                       targetBases, t_end - t_begin, options.matchCost,
+                       options.mismatchCost, options.gapCost, anchors,
+                       KmerSize, options.bandWidth, &cigar,
+                       options.gapOpen[0], options.gapExtend[0],
+                       options.gapOpen[1], options.gapExtend[1]);
+      } else {
+        AlignBanded(workspace, query.c_str() + q_begin, q_end - q_begin,
+                    targetBases, t_end - t_begin, options.alignType,
+                    options.matchCost, options.mismatchCost, options.gapCost,
+                    anchors, options.bandWidth, &cigar, &target_begin,
+                    options.gapOpen[0], options.gapExtend[0],
+                    options.gapOpen[1], options.gapExtend[1], &query_begin);
+      }
+    }
+
+    // the chain pins both ends of global alignments, from which they are
+    // extended into the rest of the fragment
+    if (options.xDrop > 0 &&
+        (options.piecewise || options.alignType == AlignmentType::global)) {
+      // the reference is taken a quarter longer than the fragment tails,
+      // which leaves room for gaps
+      unsigned int tailBegin =
+          t_begin - std::min(t_begin, q_begin + q_begin / 4);
+      unsigned int queryExtent = 0, targetExtent = 0;
+      ExtendAlignment(workspace, query.c_str(), q_begin,
+                      refs.Bases(j, tailBegin, t_begin, target),
+                      t_begin - tailBegin, options.matchCost,
+                      options.mismatchCost, options.gapCost, options.xDrop,
+                      options.zDrop, true, &cigar, &queryExtent,
+                      &targetExtent, nullptr, options.gapOpen[0],
+                      options.gapExtend[0], options.gapOpen[1],
+                      options.gapExtend[1]);
+      q_begin -= queryExtent;
+      t_begin -= targetExtent;
+
+      unsigned int queryTail = (unsigned)query.size() - q_end;
+      unsigned int tailEnd = (unsigned)std::min<size_t>(
+          refs.length(j), t_end + queryTail + queryTail / 4);
+      ExtendAlignment(workspace, query.c_str() + q_end, queryTail,
+                      refs.Bases(j, t_end, tailEnd, target), tailEnd - t_end,
+                      options.matchCost, options.mismatchCost,
+                      options.gapCost, options.xDrop, options.zDrop, false,
+                      &cigar, &queryExtent, &targetExtent, nullptr,
+                      options.gapOpen[0], options.gapExtend[0],
+                      options.gapOpen[1], options.gapExtend[1]);
+      q_end += queryExtent;
+      t_end += targetExtent;
+    }
+  }
+
+  if (!options.calcAlignment) {
+    AppendMapping(frag, chain, chain.kind, query, quality, q_begin, q_end,
+                  t_begin, t_end, nullptr, refs, options, out);
+    return;
+  }
+
+  // the alignment is split where its score drops by more than the Z-drop,
+  // and its best part keeps the kind of the chain while the others are
+  // supplementary, or secondary for secondary chains
+  q_begin += query_begin;
+  t_begin += target_begin;
+  string target;
+  const char *targetBases =
+      refs.Bases(j, t_begin, t_begin + MeasureCigar(cigar).target, target);
+  const vector<AlignmentPart> parts =
+      SplitAtZDrops(cigar, query.c_str() + q_begin, targetBases,
+                    options.matchCost, options.mismatchCost, options.gapCost,
+                    options.zDrop, options.gapOpen[0], options.gapExtend[0],
+                    options.gapOpen[1], options.gapExtend[1]);
+  size_t bestPart = 0;
+  for (size_t k = 1; k < parts.size(); ++k)
+    if (parts[k].score > parts[bestPart].score)
+      bestPart = k;
+  for (size_t k = 0; k < parts.size(); ++k) {
+    const AlignmentPart &part = parts[k];
+    CigarLengths lengths = MeasureCigar(part.cigar);
+    unsigned int partQBegin = q_begin + part.query_begin;
+    unsigned int partTBegin = t_begin + part.target_begin;
+    ChainKind kind = k == bestPart || chain.kind == ChainKind::secondary
+                         ? chain.kind
+                         : ChainKind::supplementary;
+    AppendMapping(frag, chain, kind, query, quality, partQBegin,
+                  partQBegin + lengths.query, partTBegin,
+                  partTBegin + lengths.target, &part.cigar, refs, options,
+                  out);
+  }
+}
+
+// Maps a single fragment and appends the PAF or SAM lines of its chains to
+// out, which for SAM is a line of the unmapped fragment if it has none. Its
+// matches, which the caller puts into chain_workspace, are chained with the
+// buffers of chain_workspace and aligned with the buffers of workspace.
+template <typename KmerT>
+void MapFragment(const Sequence &frag,
+                 const crimson::MinimizerIndex<KmerT> &index,
+                 const References &refs, const MapperOptions &options,
+                 crimson::ChainingWorkspace<KmerT> &chain_workspace,
+                 crimson::AlignmentWorkspace &workspace, std::string &out) {
+  using std::string;
+  using namespace crimson;
+
+  const unsigned int KmerSize = index.kmer_len();
+  std::vector<BasicChain<KmerT>> chains =
+      ChainOverlaps(chain_workspace, KmerSize, (unsigned)frag.data.size(),
+                    options.chaining);
+
+  // bases and qualities of the fragment for the aligner and SAM, unpacked
+  // into buffers of the worker, and reversed for chains on the reverse
+  // strand
+  thread_local string fragBases, fragBasesRev, qualityRev;
+  fragBases.clear();
+  fragBasesRev.clear();
+  qualityRev.clear();
+  if (chains.empty()) {
+    if (options.samOutput) {
+      frag.data.Unpack(0, frag.data.size(), fragBases);
+      SamRecord record;
+      record.query_name = frag.name;
+      record.flag = kSamUnmapped;
+      record.sequence = fragBases;
+      record.quality = frag.quality;
+      AppendSam(record, out);
+    }
+    return;
+  }
+  if (options.calcAlignment || options.identityOnly) {
+    frag.data.Unpack(0, frag.data.size(), fragBases);
+    if (std::any_of(chains.begin(), chains.end(),
+                    [](const BasicChain<KmerT> &i) { return i.is_reverse; })) {
+      ReverseComplement(fragBases, fragBasesRev);
+      qualityRev.assign(frag.quality.rbegin(), frag.quality.rend());
+    }
+  }
+
+  for (const BasicChain<KmerT> &chain : chains) {
+    if (chain.is_reverse)
+      MapChain(frag, chain, fragBasesRev, qualityRev, KmerSize, refs, options,
+               workspace, out);
+    else
+      MapChain(frag, chain, fragBases, frag.quality, KmerSize, refs, options,
+               workspace, out);
+  }
+}
+
+// Filtered index of the references with k-mers packed into KmerT, which has
+// to hold at least 2 * KmerSize bits. An index file is used as it is.
+template <typename KmerT>
+crimson::MinimizerIndex<KmerT> LoadIndex(const References &refs,
+                                         const MapperOptions &options) {
+  using std::vector;
+
+  if (refs.file)
+    return refs.file->Index<KmerT>();
+
+  vector<const crimson::PackedSequence *> refSequences;
+  for (const std::unique_ptr<Sequence> &i : refs.parsed)
+    refSequences.push_back(&i->data);
+
+  return crimson::MinimizerIndex<KmerT>(refSequences, options.KmerSize,
+                                        options.windowSize, options.threads,
+                                        options.filter);
+}
+
+// Indexes the parsed references and writes the index file
+template <typename KmerT>
+void SaveIndex(const References &refs, const MapperOptions &options) {
+  std::vector<std::string_view> names;
+  std::vector<const crimson::PackedSequence *> sequences;
+  for (const std::unique_ptr<Sequence> &i : refs.parsed) {
+    names.push_back(i->name);
+    sequences.push_back(&i->data);
+  }
+  crimson::IndexFile::Write(options.indexOutput, LoadIndex<KmerT>(refs, options),
+                            names, sequences);
+}
+
+// Time spent by each pipeline stage working and blocked on its queues
+struct PipelineStats {
+  std::atomic<std::int64_t> parsing{0};
+  std::atomic<std::int64_t> parserStalled{0};
+  std::atomic<std::int64_t> mapping{0};
+  std::atomic<std::int64_t> mapperWaiting{0};
+  std::atomic<std::int64_t> mapperStalled{0};
+  std::atomic<std::int64_t> writing{0};
+  std::atomic<std::int64_t> writerWaiting{0};
+  double elapsed = 0;
+
+  void Print(unsigned int threads) const {
+    auto seconds = [](const std::atomic<std::int64_t> &x) {
+      return double(x.load()) * 1e-9;
+    };
+    fprintf(stderr, "Pipeline statistics (%.2f s)\n", elapsed);
+    fprintf(stderr, "Parser: busy %.2f s, stalled on mapper %.2f s\n",
+            seconds(parsing), seconds(parserStalled));
+    fprintf(stderr,
+            "Mapper: %u threads %.1f%% busy, waiting for parser %.2f s, "
+            "stalled on writer %.2f s\n",
+            threads,
+            elapsed > 0 ? 100.0 * seconds(mapping) / (elapsed * threads) : 0.0,
+            seconds(mapperWaiting), seconds(mapperStalled));
+    fprintf(stderr, "Writer: busy %.2f s, waiting for mapper %.2f s\n\n",
+            seconds(writing), seconds(writerWaiting));
+  }
+};
+
+// Adds the lifetime of the timer in nanoseconds to total
+class ScopedTimer {
+public:
+  explicit ScopedTimer(std::atomic<std::int64_t> &total)
+      : total_(total), begin_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    total_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - begin_)
+                  .count();
+  }
+
+private:
+  std::atomic<std::int64_t> &total_;
+  std::chrono::steady_clock::time_point begin_;
+};
+
+using FragmentBatch = std::vector<std::unique_ptr<Sequence>>;
+
+// Batch of parsed fragments and the pieces of output of the tasks which map
+// it
+struct MappedBatch {
+  FragmentBatch frags;
+  std::vector<std::future<std::string>> pieces;
+};
+
+// Submits the tasks which map a batch of parsed fragments to the thread pool.
+// Fragments are grouped into tasks of roughly kBatchBases bases, which the
+// thread pool balances between workers. Each task formats its mappings into
+// a piece of the output, which it compresses if the output is BGZF, and
+// passes it to the writer as soon as it is done if the output is unordered.
+template <typename KmerT>
+void MapBatch(MappedBatch &batch, const crimson::MinimizerIndex<KmerT> &index,
+              const References &refs, const MapperOptions &options,
+              crimson::ThreadPool &pool,
+              crimson::BoundedQueue<std::string> &output,
+              PipelineStats &stats) {
+  using std::string;
+  using std::vector;
+
+  const FragmentBatch &parsedFrags = batch.frags;
+  for (size_t i = 0, j; i < parsedFrags.size(); i = j) {
+    size_t bases = 0;
+    for (j = i; j < parsedFrags.size() && (j == i || bases < kBatchBases);
+         ++j)
+      bases += parsedFrags[j]->data.size();
+
+    batch.pieces.push_back(pool.Submit([&, i, j]() {
+      // every worker keeps its chaining and alignment buffers for all of
+      // its tasks
+      thread_local crimson::ChainingWorkspace<KmerT> chainWorkspace;
+      thread_local crimson::AlignmentWorkspace workspace;
+      // matches of the fragments whose lookups are batched
+      thread_local vector<const crimson::PackedSequence *> lookupFrags;
+      thread_local vector<crimson::BasicOverlap<KmerT>> lookupOverlaps;
+      thread_local vector<size_t> lookupOffsets;
+      string out;
+      {
+        ScopedTimer timer(stats.mapping);
+        for (size_t k = i, l; k < j; k = l) {
+          size_t lookupBases = 0;
+          lookupFrags.clear();
+          for (l = k; l < j && (l == k || lookupBases < kLookupBases); ++l) {
+            lookupBases += parsedFrags[l]->data.size();
+            lookupFrags.push_back(&parsedFrags[l]->data);
+          }
+          index.Overlaps(lookupFrags, lookupOverlaps, lookupOffsets);
+
+          for (size_t m = k; m < l; ++m) {
+            chainWorkspace.overlaps().assign(
+                lookupOverlaps.begin() +
+                    static_cast<long>(lookupOffsets[m - k]),
+                lookupOverlaps.begin() +
+                    static_cast<long>(lookupOffsets[m - k + 1]));
+            MapFragment<KmerT>(*parsedFrags[m], index, refs, options,
+                               chainWorkspace, workspace, out);
+          }
+        }
+        // every task compresses its own piece of the output
+        if (options.bgzfOutput) {
+          string compressed;
+          crimson::AppendBgzf(out, compressed);
+          out.swap(compressed);
+        }
+      }
+      if (options.unorderedOutput) {
+        ScopedTimer timer(stats.mapperStalled);
+        output.Push(std::move(out));
+        out.clear();
+      }
+      return out;
+    }));
+  }
+}
+
+// Waits for the tasks of a batch and passes their pieces of the output to
+// the writer in input order, unless the output is unordered
+void FinishBatch(MappedBatch &batch, const MapperOptions &options,
+                 crimson::BoundedQueue<std::string> &output,
+                 PipelineStats &stats) {
+  for (std::future<std::string> &i : batch.pieces) {
+    std::string out = i.get();
+    if (!options.unorderedOutput) {
+      ScopedTimer timer(stats.mapperStalled);
+      output.Push(std::move(out));
+    }
+  }
+}
+
+// Waits for the tasks of a batch without taking their results, so its
+// fragments can be freed
+void AbandonBatch(MappedBatch &batch) {
+  for (std::future<std::string> &i : batch.pieces)
+    if (i.valid())
+      i.wait();
+}
+
+// Maps every fragment of the given files with k-mers packed into KmerT.
+// Parsing, mapping and writing form a pipeline connected by bounded queues:
+// while the pool maps one batch of about kParseBytes, the parser thread
+// fills the next one and the writer thread prints the finished mappings.
+// The parser takes one of kLiveBatches slots before it parses a batch, and
+// the mapper gives it back once the batch is mapped and freed, so the parsed
+// queue, which has room for every live batch, never blocks. The output queue
+// holds kOutputPieces pieces. The tasks of a batch are submitted before the
+// previous batch is waited for, so the pool does not run dry between
+// batches, while the parser waits for a slot.
+template <typename KmerT>
+void MapFragments(const References &refs,
+                  const std::vector<std::string> &fragFilenames,
+                  const MapperOptions &options, FragmentStats &fragStats,
+                  PipelineStats &stats) {
+  using std::string;
+  using std::unique_ptr;
+  using namespace crimson;
+
+  const MinimizerIndex<KmerT> index = LoadIndex<KmerT>(refs, options);
+  ThreadPool pool(options.threads);
+
+  auto begin = std::chrono::steady_clock::now();
+  BoundedQueue<char> slots(kLiveBatches);
+  BoundedQueue<FragmentBatch> parsed(kLiveBatches);
+  BoundedQueue<string> output(kOutputPieces);
+
+  std::exception_ptr parserError;
+  std::thread parser([&]() {
+    try {
+      for (const string &fragFilename : fragFilenames) {
+        unique_ptr<bioparser::Parser<Sequence>> fragParser =
+            CreateParser(fragFilename);
+        while (true) {
+          {
+            ScopedTimer timer(stats.parserStalled);
+            if (!slots.Push(0))
+              return;
+          }
+          FragmentBatch parsedFrags;
+          {
+            ScopedTimer timer(stats.parsing);
+            parsedFrags = fragParser->Parse(kParseBytes, false);
+            for (const unique_ptr<Sequence> &i : parsedFrags)
+              fragStats.Add((seqsize_t)i->data.size());
+          }
+          if (parsedFrags.empty()) {
+            char slot;
+            slots.Pop(&slot);
+            break;
+          }
+          if (!parsed.Push(std::move(parsedFrags)))
+            return;
+        }
+      }
+    } catch (...) {
+      parserError = std::current_exception();
+    }
+    parsed.Close();
+  });
+
+  // the writer only writes out the pieces mapping tasks formatted, and
+  // stops the pipeline if it can not
+  std::exception_ptr writerError;
+  std::thread writer([&]() {
+    try {
+      OutputWriter outputWriter(stdout, options.bgzfOutput);
+      if (options.samOutput) {
+        string header;
+        std::vector<std::string_view> names;
+        std::vector<size_t> lengths;
+        for (size_t i = 0; i < refs.size(); ++i) {
+          names.push_back(refs.name(i));
+          lengths.push_back(refs.length(i));
+        }
+        string version = std::to_string(crimson_mapper_VERSION_MAJOR) + "." +
+                         std::to_string(crimson_mapper_VERSION_MINOR) + "." +
+                         std::to_string(crimson_mapper_VERSION_PATCH);
+        AppendSamHeader(names, lengths, version, options.commandLine, header);
+        if (options.bgzfOutput) {
+          string compressed;
+          AppendBgzf(header, compressed);
+          header.swap(compressed);
+        }
+        outputWriter.Write(header);
+      }
+
+      string out;
+      while (true) {
+        {
+          ScopedTimer timer(stats.writerWaiting);
+          if (!output.Pop(&out))
+            break;
+        }
+        ScopedTimer timer(stats.writing);
+        outputWriter.Write(out);
+      }
+      outputWriter.Close();
+    } catch (...) {
+      writerError = std::current_exception();
+      output.Close();
+      parsed.Close();
+      slots.Close();
+    }
+  });
+
+  // batch whose tasks are finishing, and the next one
+  std::unique_ptr<MappedBatch> previous, next;
+  std::exception_ptr mapperError;
+  try {
+    while (true) {
+      next = std::make_unique<MappedBatch>();
+      bool isParsed;
+      {
+        ScopedTimer timer(stats.mapperWaiting);
+        isParsed = parsed.Pop(&next->frags);
+      }
+      if (isParsed)
+        MapBatch<KmerT>(*next, index, refs, options, pool, output, stats);
+      if (previous) {
+        FinishBatch(*previous, options, output, stats);
+        previous.reset();
+        char slot;
+        slots.Pop(&slot);
+      }
+      if (!isParsed)
+        break;
+      previous = std::move(next);
+    }
+  } catch (...) {
+    mapperError = std::current_exception();
+    parsed.Close();
+    slots.Close();
+    // tasks still read their fragments
+    for (MappedBatch *i : {previous.get(), next.get()})
+      if (i != nullptr)
+        AbandonBatch(*i);
+  }
+
+  output.Close();
+  writer.join();
+  parser.join();
+  stats.elapsed = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - begin)
+                      .count();
+  if (writerError)
+    std::rethrow_exception(writerError);
+  if (mapperError)
+    std::rethrow_exception(mapperError);
+  if (parserError)
+    std::rethrow_exception(parserError);
+}
+
 void version() {
   printf("v%d.%d.%d\n", crimson_mapper_VERSION_MAJOR,
          crimson_mapper_VERSION_MINOR, crimson_mapper_VERSION_PATCH);
@@ -38,29 +888,29 @@ void version() {
 
 int main(int argc, char **argv) {
   using std::cerr;
-  using std::cout;
   using std::string;
   using std::unique_ptr;
   using std::vector;
-  using seqsize_t = std::uint32_t;
   using namespace crimson;
 
   int opt;
   const struct option longOptions[] = {{"help", no_argument, 0, 0},
-                                       {"version", no_argument, 0, 0}};
+                                       {"version", no_argument, 0, 0},
+                                       {"unordered", no_argument, 0, 0},
+                                       {"identity", no_argument, 0, 0},
+                                       {"piecewise", no_argument, 0, 0},
+                                       {"max-occ", required_argument, 0, 0},
+                                       {"sam", no_argument, 0, 0},
+                                       {"bgzf", no_argument, 0, 0},
+                                       {0, 0, 0, 0}};
   int optionIndex;
 
-  bool calcAlignment = false;
-  AlignmentType alignType = AlignmentType::global;
-  int matchCost = 3;
-  int mismatchCost = -5;
-  int gapCost = -4;
-  unsigned int KmerSize = 15;
-  unsigned int windowSize = 10;
-  double freqThreshold = 0.001;
+  MapperOptions options;
+  // costs given for the second piece of dual affine gaps
+  bool hasGapOpen2 = false, hasGapExtend2 = false;
 
-  while ((opt = getopt_long(argc, argv, "hca:m:n:g:k:w:f:", longOptions,
-                            &optionIndex)) != -1) {
+  while ((opt = getopt_long(argc, argv, "hca:m:n:g:o:e:x:z:b:k:w:f:t:d:N:",
+                            longOptions, &optionIndex)) != -1) {
     if (opt == 0) {
       string curLongOpt = longOptions[optionIndex].name;
       if (curLongOpt == "help") {
@@ -69,37 +919,87 @@ int main(int argc, char **argv) {
       } else if (curLongOpt == "version") {
         version();
         return 0;
+      } else if (curLongOpt == "unordered") {
+        options.unorderedOutput = true;
+      } else if (curLongOpt == "identity") {
+        options.identityOnly = true;
+      } else if (curLongOpt == "piecewise") {
+        options.piecewise = true;
+      } else if (curLongOpt == "max-occ") {
+        options.filter.max_occurrences =
+            (size_t)std::max(std::stoll(optarg), 0ll);
+      } else if (curLongOpt == "sam") {
+        options.samOutput = true;
+      } else if (curLongOpt == "bgzf") {
+        options.bgzfOutput = true;
       }
     } else if (opt == 'h') {
       help();
       return 0;
     } else if (opt == 'c') {
-      calcAlignment = true;
+      options.calcAlignment = true;
     } else if (opt == 'a') {
-      cout << "[" << optarg << "]\n";
       if (std::strcmp(optarg, "global") == 0) {
-        alignType = AlignmentType::global;
+        options.alignType = AlignmentType::global;
       } else if (std::strcmp(optarg, "local") == 0) {
-        alignType = AlignmentType::local;
+        options.alignType = AlignmentType::local;
       } else if (std::strcmp(optarg, "semiglobal") == 0) {
-        alignType = AlignmentType::semiglobal;
+        options.alignType = AlignmentType::semiglobal;
       }
     } else if (opt == 'm') {
-      matchCost = std::stoi(optarg);
+      options.matchCost = std::stoi(optarg);
     } else if (opt == 'n') {
-      mismatchCost = std::stoi(optarg);
+      options.mismatchCost = std::stoi(optarg);
     } else if (opt == 'g') {
-      gapCost = std::stoi(optarg);
+      options.gapCost = std::stoi(optarg);
+    } else if (opt == 'o') {
+      hasGapOpen2 = ParseCostPair(optarg, options.gapOpen);
+    } else if (opt == 'e') {
+      hasGapExtend2 = ParseCostPair(optarg, options.gapExtend);
+    } else if (opt == 'x') {
+      options.xDrop = std::max(std::stoi(optarg), 0);
+    } else if (opt == 'z') {
+      options.zDrop = std::max(std::stoi(optarg), 0);
+    } else if (opt == 'b') {
+      options.bandWidth = (unsigned)std::max(std::stoi(optarg), 1);
     } else if (opt == 'k') {
-      KmerSize = (unsigned)std::stoi(optarg);
+      options.KmerSize = (unsigned)std::stoi(optarg);
     } else if (opt == 'w') {
-      windowSize = (unsigned)std::stoi(optarg);
+      options.windowSize = (unsigned)std::stoi(optarg);
     } else if (opt == 'f') {
-      freqThreshold = std::stod(optarg);
+      options.filter.frequency = std::stod(optarg);
+    } else if (opt == 't') {
+      options.threads = (unsigned)std::max(std::stoi(optarg), 1);
+    } else if (opt == 'd') {
+      options.indexOutput = optarg;
+    } else if (opt == 'N') {
+      options.chaining.max_secondary = (unsigned)std::max(std::stoi(optarg), 0);
     }
   }
 
-  if (optind >= argc - 1) {
+  // SAM lines need alignments, and give the qualities of fragments
+  if (options.samOutput)
+    options.calcAlignment = true;
+  for (int i = 0; i < argc; ++i) {
+    if (i > 0)
+      options.commandLine += ' ';
+    options.commandLine += argv[i];
+  }
+
+  // a single cost is shared by both pieces of dual affine gaps
+  if (hasGapOpen2 && !hasGapExtend2)
+    options.gapExtend[1] = options.gapExtend[0];
+  if (hasGapExtend2 && !hasGapOpen2)
+    options.gapOpen[1] = options.gapOpen[0];
+
+  if (options.KmerSize == 0 ||
+      options.KmerSize > kMaxKmerLen<std::uint64_t>) {
+    fprintf(stderr, "[crimson_mapper] error: k-mer size has to be in [1, %u]\n",
+            kMaxKmerLen<std::uint64_t>);
+    return 1;
+  }
+
+  if (optind >= argc - (options.indexOutput.empty() ? 1 : 0)) {
     fprintf(stderr,
             "[crimson_mapper] error: mandatory file arguments not provided");
     return 0;
@@ -110,138 +1010,75 @@ int main(int argc, char **argv) {
   ++optindI;
   vector<string> fragFilenames(argv + optindI, argv + argc);
 
-  struct Sequence {
-    const char *name;
-    seqsize_t nameLen;
-    const char *data;
-    seqsize_t dataLen;
-    Sequence(const char *name, seqsize_t nameLen, const char *data,
-             seqsize_t dataLen)
-        : name(name), nameLen(nameLen), data(data), dataLen(dataLen) {}
-  };
-
-  auto refParser =
-      bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(refFilename);
-
-  const vector<unique_ptr<Sequence>> parsedRef =
-      refParser->Parse(UINT64_MAX, false);
-
-  // TODO support FASTQ
-
-  vector<unique_ptr<Sequence>> parsedFrags;
-  for (const string &fragFilename : fragFilenames) {
-    unique_ptr<bioparser::Parser<Sequence>> fragParser =
-        bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(
-            fragFilename);
-    vector<unique_ptr<Sequence>> parsedFrag =
-        fragParser->Parse(UINT64_MAX, false);
-    parsedFrags.insert(parsedFrags.end(),
-                       std::make_move_iterator(parsedFrag.begin()),
-                       std::make_move_iterator(parsedFrag.end()));
-  }
-
-  const size_t refCnt = parsedRef.size();
-  const size_t fragCnt = parsedFrags.size();
-
-  vector<seqsize_t> fragLens(fragCnt);
-
-  for (size_t i = 0; i < fragCnt; ++i) {
-    fragLens[i] = parsedFrags[i]->dataLen;
+  References refs;
+  bool wideKmers = options.KmerSize > kMaxKmerLen<std::uint32_t>;
+  if (IndexFile::Detect(refFilename)) {
+    if (!options.indexOutput.empty()) {
+      fprintf(stderr, "[crimson_mapper] error: reference is already an index "
+                      "file\n");
+      return 1;
+    }
+    try {
+      refs.file = std::make_unique<IndexFile>(refFilename);
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
+    wideKmers = refs.file->kmer_bytes() == sizeof(std::uint64_t);
+  } else {
+    try {
+      refs.parsed = CreateParser(refFilename)->Parse(UINT64_MAX, false);
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
   }
 
-  const seqsize_t fragTotalLen =
-      std::accumulate(fragLens.begin(), fragLens.end(), 0u);
-  const seqsize_t fragMinLen =
-      *std::min_element(fragLens.begin(), fragLens.end());
-  const seqsize_t fragMaxLen =
-      *std::max_element(fragLens.begin(), fragLens.end());
-  double fragAvgLen = double(fragTotalLen) / double(fragCnt);
-  seqsize_t fragN50 = 0;
-
-  sort(fragLens.begin(), fragLens.end(), std::greater<seqsize_t>());
-  seqsize_t fragCummLen = 0;
-  for (size_t i = 0; i < fragLens.size(); ++i) {
-    fragCummLen += fragLens[i];
-    if (fragCummLen >= ceil(fragTotalLen / 2.0)) {
-      fragN50 = fragLens[i];
-      break;
+  if (!options.indexOutput.empty()) {
+    try {
+      if (wideKmers)
+        SaveIndex<std::uint64_t>(refs, options);
+      else
+        SaveIndex<std::uint32_t>(refs, options);
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
     }
+    return 0;
   }
 
   fprintf(stderr, "Reference genome statistics\n");
-  fprintf(stderr, "Name: %.*s\n", parsedRef[0]->nameLen, parsedRef[0]->name);
-  cerr << "Length: " << parsedRef[0]->dataLen << "\n\n";
-
-  fprintf(stderr, "Fragment statistics\n");
-  fprintf(stderr, "Number of fragments: %zd\n", fragCnt);
-  cerr << "Total length: " << fragTotalLen << "\n";
-  fprintf(stderr, "Average length: %f\n", fragAvgLen);
-  cerr << "N50 length: " << fragN50 << "\n";
-  cerr << "Minimal length: " << fragMinLen << "\n";
-  cerr << "Maximal length: " << fragMaxLen << "\n\n";
-
-  vector<const char *> refSequences;
-  vector<unsigned int> refSeqLens;
-  for (size_t i = 0; i < refCnt; ++i) {
-    refSequences.push_back(parsedRef[i]->data);
-    refSeqLens.push_back(parsedRef[i]->dataLen);
-  }
-
-  Minimize(refSequences, refSeqLens, KmerSize, windowSize);
-  Filter(freqThreshold);
-
-  // TODO parallelize
-
-  for (size_t i = 0; i < fragCnt; i++) {
-    vector<Overlap> overlaps =
-        Map(parsedFrags[i]->data, parsedFrags[i]->dataLen);
-    Overlap firstOverlap = overlaps[0];
-    Overlap lastOverlap = overlaps.back();
-    unsigned int j = firstOverlap.reference_index;
-
-    unsigned int q_begin = firstOverlap.query_pos;
-    unsigned int q_end = lastOverlap.query_pos + KmerSize;
-    unsigned int t_begin = firstOverlap.reference_pos;
-    unsigned int t_end = lastOverlap.reference_pos + KmerSize;
-
-    printf("%.*s\t%d\t%d\t%d\t%c\t%.*s\t%d\t%d\t%d", parsedFrags[i]->nameLen,
-           parsedFrags[i]->name, parsedFrags[i]->dataLen, q_begin, q_end, '+',
-           parsedRef[j]->nameLen, parsedRef[j]->name, parsedRef[j]->dataLen,
-           t_begin, t_end);
-
-    if (calcAlignment) {
-      string cigar;
-      unsigned int target_begin;
-
-      Align(parsedFrags[i]->data + q_begin, q_end - q_begin,
-            parsedRef[j]->data + t_begin, t_end - t_begin, alignType, matchCost,
-            mismatchCost, gapCost, &cigar, &target_begin);
-
-      int curSum = 0, mSum = 0, totalSum = 0;
-      for (unsigned i = 0; i < cigar.size(); ++i) {
-        if (cigar[i] == 'M') {
-          mSum += curSum;
-          totalSum += curSum;
-          curSum = 0;
-        } else if (std::isdigit(cigar[i])) {
-          curSum *= 10;
-          curSum += cigar[i] - '0';
-        } else {
-          totalSum += curSum;
-          curSum = 0;
-        }
-      }
+  fprintf(stderr, "Name: %.*s\n", (int)refs.name(0).size(),
+          refs.name(0).data());
+  cerr << "Length: " << refs.length(0) << "\n\n";
 
-      printf("\t%d\t%d\t%d\tcg:Z:", mSum, totalSum, 255);
-      cout << cigar;
+  // references are parsed without qualities, fragments keep them for SAM
+  Sequence::storeQuality = options.samOutput;
+  FragmentStats fragStats;
+  PipelineStats pipelineStats;
+  try {
+    if (wideKmers) {
+      MapFragments<std::uint64_t>(refs, fragFilenames, options, fragStats,
+                                  pipelineStats);
     } else {
-      unsigned int lenQ = q_end - q_begin;
-      unsigned int lenT = t_end - t_begin;
-      unsigned int minLen = std::min(lenQ, lenT);
-      printf("\t%d\t%d\t%d", minLen / 2, lenQ + lenT - minLen / 2, 255);
+      MapFragments<std::uint32_t>(refs, fragFilenames, options, fragStats,
+                                  pipelineStats);
     }
-    printf("\n");
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
   }
+  fflush(stdout);
+
+  fprintf(stderr, "Fragment statistics\n");
+  fprintf(stderr, "Number of fragments: %zd\n", fragStats.count);
+  cerr << "Total length: " << fragStats.totalLen << "\n";
+  fprintf(stderr, "Average length: %f\n", fragStats.AverageLen());
+  cerr << "N50 length: " << fragStats.N50() << "\n";
+  cerr << "Minimal length: " << fragStats.minLen << "\n";
+  cerr << "Maximal length: " << fragStats.maxLen << "\n\n";
+
+  pipelineStats.Print(options.threads);
 
   return 0;
 }
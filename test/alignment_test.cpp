@@ -1,5 +1,8 @@
 #include "crimson_alignment_engine.hpp"
+#include <cctype>
 #include <gtest/gtest.h>
+#include <random>
+#include <string>
 
 class AlignTest : public ::testing::Test {
 protected:
@@ -71,4 +74,748 @@ TEST_F(AlignTest, Local) {
     std::cerr << cigar << '\n';
     fprintf(stderr, "%d\n", target_begin);
   }
-}
\ No newline at end of file
+}
+
+TEST_F(AlignTest, Checkpointed) {
+  std::mt19937 rng(3);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+  const crimson::AlignmentType types[] = {crimson::AlignmentType::global,
+                                          crimson::AlignmentType::local,
+                                          crimson::AlignmentType::semiglobal};
+
+  for (unsigned t = 0; t < 60; ++t) {
+    std::string target = randomSequence(1 + (unsigned)rng() % 300);
+    std::string query = target.substr(rng() % target.size());
+    for (unsigned i = 0; i < query.size() / 10; ++i)
+      query[rng() % query.size()] = "ACGT"[rng() % 4];
+    query += randomSequence((unsigned)rng() % 20);
+    // linear, affine and dual affine gaps
+    bool affine = t % 3 != 0, dual = t % 3 == 2;
+    int gap_open = affine ? -4 : 0, gap_extend = affine ? -1 : 0;
+    int gap_open2 = dual ? -12 : 0, gap_extend2 = dual ? -1 : 0;
+    if (dual)
+      gap_extend = -2;
+    auto gapScore = [&](unsigned len) {
+      if (!affine)
+        return -2 * int(len);
+      int score = gap_open + int(len) * gap_extend;
+      return dual ? std::max(score, gap_open2 + int(len) * gap_extend2)
+                  : score;
+    };
+
+    for (crimson::AlignmentType type : types) {
+      std::string expectedCigar;
+      unsigned int expectedBegin = 0;
+      int expected = crimson::AlignCheckpointed(
+          query.c_str(), (unsigned)query.size(), target.c_str(),
+          (unsigned)target.size(), type, 2, -3, -2, (unsigned)query.size(),
+          &expectedCigar, &expectedBegin, gap_open, gap_extend, gap_open2,
+          gap_extend2);
+      EXPECT_EQ(crimson::Align(query.c_str(), (unsigned)query.size(),
+                               target.c_str(), (unsigned)target.size(), type,
+                               2, -3, -2, nullptr, nullptr, gap_open,
+                               gap_extend, gap_open2, gap_extend2),
+                expected);
+
+      for (unsigned block_rows : {1u, 2u, 7u, 16u}) {
+        std::string cigar;
+        unsigned int target_begin = 0;
+        int score = crimson::AlignCheckpointed(
+            query.c_str(), (unsigned)query.size(), target.c_str(),
+            (unsigned)target.size(), type, 2, -3, -2, block_rows, &cigar,
+            &target_begin, gap_open, gap_extend, gap_open2, gap_extend2);
+        EXPECT_EQ(score, expected);
+        EXPECT_EQ(cigar, expectedCigar);
+        EXPECT_EQ(target_begin, expectedBegin);
+      }
+
+      // the query begin of local alignments is not reported
+      if (type == crimson::AlignmentType::local)
+        continue;
+      // the cigar accounts for the score and spans the aligned parts, with
+      // every run of gaps scored as one gap
+      int score = 0;
+      unsigned queryPos = 0, targetPos = expectedBegin, len = 0;
+      for (char c : expectedCigar) {
+        if (isdigit(c)) {
+          len = len * 10 + unsigned(c - '0');
+          continue;
+        }
+        if (c != 'M')
+          score += gapScore(len);
+        for (; len > 0; --len) {
+          if (c == 'M')
+            score += query[queryPos++] == target[targetPos++] ? 2 : -3;
+          else if (c == 'I')
+            ++queryPos;
+          else
+            ++targetPos;
+        }
+      }
+      EXPECT_EQ(score, expected);
+      EXPECT_EQ(queryPos, query.size());
+      if (type == crimson::AlignmentType::global) {
+        EXPECT_EQ(targetPos, target.size());
+      }
+    }
+  }
+}
+
+TEST_F(AlignTest, Banded) {
+  std::mt19937 rng(5);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+  const crimson::AlignmentType types[] = {crimson::AlignmentType::global,
+                                          crimson::AlignmentType::local,
+                                          crimson::AlignmentType::semiglobal};
+
+  for (unsigned t = 0; t < 60; ++t) {
+    std::string query = randomSequence(200 + (unsigned)rng() % 300);
+    std::string target = query;
+    for (unsigned i = 0; i < query.size() / 20; ++i)
+      target[rng() % target.size()] = "ACGT"[rng() % 4];
+    // a long insertion into the target, which the band has to grow over
+    unsigned insertion = (unsigned)rng() % (unsigned)target.size();
+    if (t % 2 == 0)
+      target.insert(insertion, randomSequence(80));
+    unsigned offset = (unsigned)rng() % 50;
+    target = randomSequence(offset) + target + randomSequence(offset);
+    bool affine = t % 3 != 0, dual = t % 3 == 2;
+    int gap_open = affine ? -4 : 0, gap_extend = affine ? -1 : 0;
+    int gap_open2 = dual ? -10 : 0, gap_extend2 = dual ? -1 : 0;
+    if (dual)
+      gap_extend = -2;
+
+    // exact matches of 15 bases, as a chain of minimizer hits would give
+    std::vector<crimson::AlignmentAnchor> anchors;
+    for (unsigned i = 0; i + 15 < query.size(); i += 50) {
+      unsigned j = offset + i + (t % 2 == 0 && i >= insertion ? 80 : 0);
+      if (target.compare(j, 15, query, i, 15) == 0)
+        anchors.push_back({i, j});
+    }
+
+    for (crimson::AlignmentType type : types) {
+      std::string expectedCigar;
+      unsigned int expectedBegin = 0;
+      int expected = crimson::Align(
+          query.c_str(), (unsigned)query.size(), target.c_str(),
+          (unsigned)target.size(), type, 2, -3, -2, &expectedCigar,
+          &expectedBegin, gap_open, gap_extend, gap_open2, gap_extend2);
+
+      for (unsigned band_width : {1u, 8u, 32u, 100000u}) {
+        std::string cigar;
+        unsigned int target_begin = 0;
+        int score = crimson::AlignBanded(
+            query.c_str(), (unsigned)query.size(), target.c_str(),
+            (unsigned)target.size(), type, 2, -3, -2, anchors, band_width,
+            &cigar, &target_begin, gap_open, gap_extend, gap_open2,
+            gap_extend2);
+        // alignments with free ends may start outside of the band
+        EXPECT_LE(score, expected);
+        if (type == crimson::AlignmentType::global) {
+          EXPECT_EQ(score, expected);
+        }
+        // a band over the whole matrix gives the very same alignment
+        if (band_width == 100000u) {
+          EXPECT_EQ(cigar, expectedCigar);
+          EXPECT_EQ(target_begin, expectedBegin);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(AlignTest, BandedWidens) {
+  std::mt19937 rng(7);
+  std::string query(300, 'A');
+  for (char &c : query)
+    c = "ACGT"[rng() % 4];
+  std::string insert(40, 'A');
+  for (char &c : insert)
+    c = "ACGT"[rng() % 4];
+  std::string target = query.substr(0, 150) + insert + query.substr(150);
+
+  // the only anchor leaves the band 40 columns off after the insertion, and
+  // mismatches cost enough for the alignment to run into the band edge
+  std::vector<crimson::AlignmentAnchor> anchors = {{0, 0}};
+  unsigned int target_begin = 1;
+  std::string expectedCigar;
+  int expected = crimson::Align(query.c_str(), (unsigned)query.size(),
+                                target.c_str(), (unsigned)target.size(),
+                                crimson::AlignmentType::semiglobal, 1, -10, -1,
+                                &expectedCigar, &target_begin);
+  std::string cigar;
+  target_begin = 1;
+  EXPECT_EQ(crimson::AlignBanded(query.c_str(), (unsigned)query.size(),
+                                 target.c_str(), (unsigned)target.size(),
+                                 crimson::AlignmentType::semiglobal, 1, -10, -1,
+                                 anchors, 4, &cigar, &target_begin),
+            expected);
+  EXPECT_EQ(expected, 260);
+  EXPECT_EQ(cigar, expectedCigar);
+  EXPECT_EQ(target_begin, 0u);
+}
+
+TEST_F(AlignTest, QueryBegin) {
+  std::mt19937 rng(13);
+  std::string core(200, 'A');
+  for (char &c : core)
+    c = "ACGT"[rng() % 4];
+  // flanks which never match each other, so the local alignment is the core
+  std::string query = std::string(60, 'A') + core + std::string(30, 'A');
+  std::string target = std::string(50, 'C') + core + std::string(40, 'C');
+  const auto local = crimson::AlignmentType::local;
+
+  auto expectCore = [](int score, const std::string &cigar,
+                       unsigned int target_begin, unsigned int query_begin) {
+    EXPECT_EQ(score, 600);
+    EXPECT_EQ(cigar, "200M");
+    EXPECT_EQ(target_begin, 50u);
+    EXPECT_EQ(query_begin, 60u);
+  };
+
+  std::string cigar;
+  unsigned int target_begin = 0, query_begin = 0;
+  int score = crimson::Align(query.c_str(), (unsigned)query.size(),
+                             target.c_str(), (unsigned)target.size(), local,
+                             3, -5, -4, &cigar, &target_begin, 0, 0, 0, 0,
+                             &query_begin);
+  expectCore(score, cigar, target_begin, query_begin);
+
+  cigar.clear();
+  score = crimson::AlignCheckpointed(
+      query.c_str(), (unsigned)query.size(), target.c_str(),
+      (unsigned)target.size(), local, 3, -5, -4, 7, &cigar, &target_begin, 0, 0,
+      0, 0, &query_begin);
+  expectCore(score, cigar, target_begin, query_begin);
+
+  for (crimson::SimdLevel level :
+       {crimson::SimdLevel::none, crimson::SimdLevel::sse41,
+        crimson::SimdLevel::avx2, crimson::SimdLevel::avx512}) {
+    if (level > crimson::HostSimdLevel())
+      break;
+    cigar.clear();
+    score = crimson::AlignVectorized(
+        query.c_str(), (unsigned)query.size(), target.c_str(),
+        (unsigned)target.size(), local, 3, -5, -4, level, &cigar,
+        &target_begin, 0, 0, 0, 0, &query_begin);
+    expectCore(score, cigar, target_begin, query_begin);
+  }
+
+  cigar.clear();
+  score = crimson::AlignBanded(query.c_str(), (unsigned)query.size(),
+                               target.c_str(), (unsigned)target.size(), local,
+                               3, -5, -4, {{60, 50}, {160, 150}}, 8, &cigar,
+                               &target_begin, 0, 0, 0, 0, &query_begin);
+  expectCore(score, cigar, target_begin, query_begin);
+
+  // every other type aligns the whole query
+  for (auto type : {crimson::AlignmentType::global,
+                    crimson::AlignmentType::semiglobal}) {
+    cigar.clear();
+    query_begin = 1;
+    crimson::Align(query.c_str(), (unsigned)query.size(), target.c_str(),
+                   (unsigned)target.size(), type, 3, -5, -4, &cigar,
+                   &target_begin, 0, 0, 0, 0, &query_begin);
+    EXPECT_EQ(query_begin, 0u);
+  }
+}
+
+TEST_F(AlignTest, Vectorized) {
+  std::mt19937 rng(11);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+  const crimson::AlignmentType types[] = {crimson::AlignmentType::global,
+                                          crimson::AlignmentType::local,
+                                          crimson::AlignmentType::semiglobal};
+  const crimson::SimdLevel levels[] = {
+      crimson::SimdLevel::sse41, crimson::SimdLevel::avx2,
+      crimson::SimdLevel::avx512};
+
+  // lengths for 8-bit, 16-bit and 32-bit lanes
+  for (unsigned t = 0; t < 42; ++t) {
+    unsigned len = t < 12 ? 1 + (unsigned)rng() % 8
+                          : (t < 36 ? 20 + (unsigned)rng() % 400
+                                    : 2500 + (unsigned)rng() % 1000);
+    std::string target = randomSequence(len);
+    std::string query = target.substr(rng() % target.size());
+    for (unsigned i = 0; i < query.size() / 8 + 1; ++i)
+      query[rng() % query.size()] = "ACGT"[rng() % 4];
+    query += randomSequence((unsigned)rng() % (t < 12 ? 3 : 10));
+    bool affine = t % 3 != 0, dual = t % 3 == 2;
+    int gap_open = affine ? -5 : 0, gap_extend = affine ? -2 : 0;
+    int gap_open2 = dual ? -14 : 0, gap_extend2 = dual ? -1 : 0;
+
+    for (crimson::AlignmentType type : types) {
+      std::string expectedCigar;
+      unsigned int expectedBegin = 0;
+      int expected = crimson::AlignCheckpointed(
+          query.c_str(), (unsigned)query.size(), target.c_str(),
+          (unsigned)target.size(), type, 3, -5, -4, (unsigned)query.size(),
+          &expectedCigar, &expectedBegin, gap_open, gap_extend, gap_open2,
+          gap_extend2);
+
+      for (crimson::SimdLevel level : levels) {
+        if (level > crimson::HostSimdLevel())
+          continue;
+        std::string cigar;
+        unsigned int target_begin = 0;
+        EXPECT_EQ(crimson::AlignVectorized(
+                      query.c_str(), (unsigned)query.size(), target.c_str(),
+                      (unsigned)target.size(), type, 3, -5, -4, level, &cigar,
+                      &target_begin, gap_open, gap_extend, gap_open2,
+                      gap_extend2),
+                  expected);
+        EXPECT_EQ(cigar, expectedCigar);
+        EXPECT_EQ(target_begin, expectedBegin);
+        EXPECT_EQ(crimson::AlignVectorized(
+                      query.c_str(), (unsigned)query.size(), target.c_str(),
+                      (unsigned)target.size(), type, 3, -5, -4, level, nullptr,
+                      nullptr, gap_open, gap_extend, gap_open2, gap_extend2),
+                  expected);
+      }
+    }
+  }
+}
+
+TEST_F(AlignTest, AffineGaps) {
+  std::mt19937 rng(13);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACG"[rng() % 3];
+    return ret;
+  };
+  // a deletion of 20 bases which no base next to it can shift
+  std::string query = randomSequence(30) + randomSequence(30);
+  std::string target =
+      query.substr(0, 30) + std::string(20, 'T') + query.substr(30);
+
+  struct {
+    int gap_open, gap_extend, gap_open2, gap_extend2, expected;
+  } gaps[] = {{-4, -2, 0, 0, 120 - 44}, {-4, -2, -13, -1, 120 - 33}};
+
+  for (auto g : gaps) {
+    std::string cigar;
+    unsigned int target_begin = 1;
+    EXPECT_EQ(crimson::AlignCheckpointed(
+                  query.c_str(), (unsigned)query.size(), target.c_str(),
+                  (unsigned)target.size(), crimson::AlignmentType::global, 2,
+                  -4, -2, 7, &cigar, &target_begin, g.gap_open, g.gap_extend,
+                  g.gap_open2, g.gap_extend2),
+              g.expected);
+    EXPECT_EQ(cigar, "30M20D30M");
+    EXPECT_EQ(target_begin, 0u);
+
+    // the long gap stays whole in every other kernel
+    cigar.clear();
+    EXPECT_EQ(crimson::Align(query.c_str(), (unsigned)query.size(),
+                             target.c_str(), (unsigned)target.size(),
+                             crimson::AlignmentType::semiglobal, 2, -4, -2,
+                             &cigar, &target_begin, g.gap_open, g.gap_extend,
+                             g.gap_open2, g.gap_extend2),
+              g.expected);
+    EXPECT_EQ(cigar, "30M20D30M");
+    cigar.clear();
+    EXPECT_EQ(crimson::AlignBanded(query.c_str(), (unsigned)query.size(),
+                                   target.c_str(), (unsigned)target.size(),
+                                   crimson::AlignmentType::global, 2, -4, -2,
+                                   {{0, 0}}, 4, &cigar, &target_begin,
+                                   g.gap_open, g.gap_extend, g.gap_open2,
+                                   g.gap_extend2),
+              g.expected);
+    EXPECT_EQ(cigar, "30M20D30M");
+  }
+}
+
+TEST_F(AlignTest, Piecewise) {
+  std::mt19937 rng(17);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+
+  for (unsigned t = 0; t < 40; ++t) {
+    // substitutions and short indels, and the position in the target every
+    // query base came from
+    std::string target = randomSequence(300 + (unsigned)rng() % 700);
+    std::string query;
+    std::vector<long> origin;
+    for (unsigned i = 0; i < target.size(); ++i) {
+      unsigned event = (unsigned)rng() % 100;
+      if (event < 3)
+        continue;
+      if (event < 6) {
+        query += "ACGT"[rng() % 4];
+        origin.push_back(-1);
+      }
+      query += event < 10 ? "ACGT"[rng() % 4] : target[i];
+      origin.push_back(event < 10 ? -1 : long(i));
+    }
+    bool affine = t % 2 == 0;
+    int gap_open = affine ? -4 : 0, gap_extend = affine ? -1 : 0;
+
+    // 15-mers which match, some of them overlapping on their diagonal and
+    // some which do not match at all
+    std::vector<crimson::AlignmentAnchor> anchors;
+    for (unsigned i = 0; i + 15 <= query.size();
+         i += 5 + (unsigned)rng() % 40) {
+      if (origin[i] >= 0 && size_t(origin[i]) + 15 <= target.size())
+        anchors.push_back({i, unsigned(origin[i])});
+      else
+        anchors.push_back({i, (unsigned)rng() % (unsigned)target.size()});
+    }
+
+    std::string cigar;
+    int score = crimson::AlignPiecewise(
+        query.c_str(), (unsigned)query.size(), target.c_str(),
+        (unsigned)target.size(), 2, -3, -2, anchors, 15, 8, &cigar, gap_open,
+        gap_extend);
+    EXPECT_EQ(crimson::AlignPiecewise(
+                  query.c_str(), (unsigned)query.size(), target.c_str(),
+                  (unsigned)target.size(), 2, -3, -2, anchors, 15, 8, nullptr,
+                  gap_open, gap_extend),
+              score);
+    EXPECT_LE(score, crimson::Align(query.c_str(), (unsigned)query.size(),
+                                    target.c_str(), (unsigned)target.size(),
+                                    crimson::AlignmentType::global, 2, -3, -2,
+                                    nullptr, nullptr, gap_open, gap_extend));
+
+    // the joined cigar accounts for the score and spans both sequences
+    int cigarScore = 0;
+    unsigned queryPos = 0, targetPos = 0, len = 0;
+    char previous = 0;
+    for (char c : cigar) {
+      if (isdigit(c)) {
+        len = len * 10 + unsigned(c - '0');
+        continue;
+      }
+      EXPECT_NE(c, previous);
+      previous = c;
+      if (c != 'M')
+        cigarScore += affine ? gap_open + int(len) * gap_extend : -2 * int(len);
+      for (; len > 0; --len) {
+        if (c == 'M')
+          cigarScore += query[queryPos++] == target[targetPos++] ? 2 : -3;
+        else if (c == 'I')
+          ++queryPos;
+        else
+          ++targetPos;
+      }
+    }
+    EXPECT_EQ(cigarScore, score);
+    EXPECT_EQ(queryPos, query.size());
+    EXPECT_EQ(targetPos, target.size());
+  }
+
+  // without anchors the whole alignment is a single piece
+  std::string query = randomSequence(200), target = randomSequence(220);
+  std::string cigar, expectedCigar;
+  unsigned int target_begin = 0;
+  EXPECT_EQ(crimson::AlignPiecewise(query.c_str(), 200, target.c_str(), 220, 2,
+                                    -3, -2, {}, 15, 1000, &cigar),
+            crimson::Align(query.c_str(), 200, target.c_str(), 220,
+                           crimson::AlignmentType::global, 2, -3, -2,
+                           &expectedCigar, &target_begin));
+  EXPECT_EQ(cigar, expectedCigar);
+}
+
+TEST_F(AlignTest, Extend) {
+  std::mt19937 rng(23);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+
+  // without a drop limit the extension ends at the best cell of the whole
+  // matrix, found here by aligning every pair of prefixes globally
+  for (unsigned t = 0; t < 20; ++t) {
+    std::string query = randomSequence(10 + (unsigned)rng() % 20);
+    std::string target = query;
+    for (unsigned i = 0; i < 6; ++i)
+      target[rng() % target.size()] = "ACGT"[rng() % 4];
+    target.insert(rng() % target.size(), randomSequence(rng() % 4));
+    bool affine = t % 2 == 0;
+    int gap_open = affine ? -4 : 0, gap_extend = affine ? -1 : 0;
+
+    int expected = 0;
+    for (unsigned i = 0; i <= query.size(); ++i)
+      for (unsigned j = 0; j <= target.size(); ++j)
+        expected = std::max(
+            expected, crimson::Align(query.c_str(), i, target.c_str(), j,
+                                     crimson::AlignmentType::global, 2, -3,
+                                     -2, nullptr, nullptr, gap_open,
+                                     gap_extend));
+
+    for (bool leftward : {false, true}) {
+      std::string q = query, tg = target;
+      if (leftward) {
+        std::reverse(q.begin(), q.end());
+        std::reverse(tg.begin(), tg.end());
+      }
+      std::string cigar;
+      unsigned queryExtent = 0, targetExtent = 0;
+      bool zDropped = true;
+      int score = crimson::ExtendAlignment(
+          q.c_str(), (unsigned)q.size(), tg.c_str(), (unsigned)tg.size(), 2,
+          -3, -2, 1000, 0, leftward, &cigar, &queryExtent, &targetExtent,
+          &zDropped, gap_open, gap_extend);
+      EXPECT_EQ(score, expected);
+      EXPECT_FALSE(zDropped);
+
+      // the cigar aligns the extents and accounts for the score
+      unsigned queryBegin = leftward ? (unsigned)q.size() - queryExtent : 0;
+      unsigned targetBegin = leftward ? (unsigned)tg.size() - targetExtent : 0;
+      unsigned targetEnd = 0;
+      EXPECT_EQ(crimson::Align(q.c_str() + queryBegin, queryExtent,
+                               tg.c_str() + targetBegin, targetExtent,
+                               crimson::AlignmentType::global, 2, -3, -2,
+                               nullptr, &targetEnd, gap_open, gap_extend),
+                score);
+      int cigarScore = 0;
+      unsigned queryPos = queryBegin, targetPos = targetBegin, len = 0;
+      for (char c : cigar) {
+        if (isdigit(c)) {
+          len = len * 10 + unsigned(c - '0');
+          continue;
+        }
+        if (c != 'M')
+          cigarScore +=
+              affine ? gap_open + int(len) * gap_extend : -2 * int(len);
+        for (; len > 0; --len) {
+          if (c == 'M')
+            cigarScore += q[queryPos++] == tg[targetPos++] ? 2 : -3;
+          else if (c == 'I')
+            ++queryPos;
+          else
+            ++targetPos;
+        }
+      }
+      EXPECT_EQ(cigarScore, score);
+      EXPECT_EQ(queryPos, queryBegin + queryExtent);
+      EXPECT_EQ(targetPos, targetBegin + targetExtent);
+    }
+  }
+
+  // the extension stops where the sequences diverge
+  std::string shared = randomSequence(100);
+  std::string query = shared + randomSequence(200);
+  std::string target = shared + randomSequence(200);
+  std::string cigar = "10M";
+  unsigned queryExtent = 0, targetExtent = 0;
+  EXPECT_EQ(crimson::ExtendAlignment(query.c_str(), 300, target.c_str(), 300,
+                                     2, -6, -6, 30, 0, false, &cigar,
+                                     &queryExtent, &targetExtent),
+            200);
+  EXPECT_EQ(cigar, "110M");
+  EXPECT_EQ(queryExtent, 100u);
+  EXPECT_EQ(targetExtent, 100u);
+  cigar = "10M";
+  EXPECT_EQ(crimson::ExtendAlignment(target.c_str(), 300, query.c_str(), 300,
+                                     2, -6, -6, 30, 0, true, &cigar,
+                                     &queryExtent, &targetExtent),
+            0);
+  EXPECT_EQ(cigar, "10M");
+
+  // a long gap is extended over, while a diverged region drops the
+  // extension although it would be aligned after it
+  std::string after = randomSequence(100);
+  query = shared + after;
+  target = shared + randomSequence(40) + after;
+  bool zDropped = true;
+  EXPECT_EQ(crimson::ExtendAlignment(query.c_str(), 200, target.c_str(), 240,
+                                     2, -6, -6, 1000, 150, false, nullptr,
+                                     &queryExtent, &targetExtent, &zDropped,
+                                     -8, -3),
+            400 - 128);
+  EXPECT_FALSE(zDropped);
+  EXPECT_EQ(targetExtent, 240u);
+  query = shared + randomSequence(200) + after;
+  target = shared + randomSequence(200) + after;
+  EXPECT_EQ(crimson::ExtendAlignment(query.c_str(), 400, target.c_str(), 400,
+                                     2, -6, -6, 1000, 150, false, nullptr,
+                                     &queryExtent, &targetExtent, &zDropped,
+                                     -8, -3),
+            200);
+  EXPECT_TRUE(zDropped);
+  EXPECT_EQ(queryExtent, 100u);
+  crimson::ExtendAlignment(query.c_str(), 400, target.c_str(), 400, 2, -6, -6,
+                           1000, 0, false, nullptr, &queryExtent,
+                           &targetExtent, &zDropped, -8, -3);
+  EXPECT_FALSE(zDropped);
+}
+
+TEST_F(AlignTest, SplitAtZDrops) {
+  std::mt19937 rng(17);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+  std::string before = randomSequence(200), after = randomSequence(200);
+  // 100 mismatches drop the score by 500, and a gap of 100 by 400
+  std::string query = before + std::string(100, 'A') + after;
+  std::string target = before + std::string(100, 'C') + after;
+
+  std::vector<crimson::AlignmentPart> parts = crimson::SplitAtZDrops(
+      "500M", query.c_str(), target.c_str(), 3, -5, -4, 200);
+  ASSERT_EQ(parts.size(), 2u);
+  EXPECT_EQ(parts[0].query_begin, 0u);
+  EXPECT_EQ(parts[0].target_begin, 0u);
+  EXPECT_EQ(parts[0].score, 600);
+  EXPECT_EQ(parts[0].cigar, "200M");
+  EXPECT_EQ(parts[1].query_begin, 300u);
+  EXPECT_EQ(parts[1].target_begin, 300u);
+  EXPECT_EQ(parts[1].score, 600);
+  EXPECT_EQ(parts[1].cigar, "200M");
+
+  // the drop is below the limit, or the limit is turned off
+  EXPECT_EQ(crimson::SplitAtZDrops("500M", query.c_str(), target.c_str(), 3,
+                                   -5, -4, 500)
+                .size(),
+            1u);
+  parts = crimson::SplitAtZDrops("500M", query.c_str(), target.c_str(), 3, -5,
+                                 -4, 0);
+  ASSERT_EQ(parts.size(), 1u);
+  EXPECT_EQ(parts[0].cigar, "500M");
+  EXPECT_EQ(parts[0].score, 700);
+
+  // a long gap does not split the alignment
+  target = before + after;
+  EXPECT_EQ(crimson::SplitAtZDrops("200M100I200M", query.c_str(),
+                                   target.c_str(), 3, -5, -4, 200)
+                .size(),
+            1u);
+
+  // a short part after the drop is left out with the diverged region
+  query = before + std::string(100, 'A') + "GG";
+  target = before + std::string(100, 'C') + "GG";
+  parts = crimson::SplitAtZDrops("302M", query.c_str(), target.c_str(), 3, -5,
+                                 -4, 200);
+  ASSERT_EQ(parts.size(), 1u);
+  EXPECT_EQ(parts[0].cigar, "200M");
+}
+
+TEST_F(AlignTest, Workspace) {
+  std::mt19937 rng(29);
+  auto randomSequence = [&rng](unsigned len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  };
+
+  // a workspace left with the buffers of other alignments gives the same
+  // results as fresh ones
+  crimson::AlignmentWorkspace workspace;
+  for (unsigned t = 0; t < 60; ++t) {
+    unsigned len = t % 4 == 0 ? 1000 + (unsigned)rng() % 1000
+                              : 1 + (unsigned)rng() % 200;
+    std::string target = randomSequence(len);
+    std::string query = target;
+    for (unsigned i = 0; i < len / 10; ++i)
+      query[rng() % len] = "ACGT"[rng() % 4];
+    query.erase(rng() % len, rng() % 5);
+    auto type = crimson::AlignmentType(t % 3);
+    int gap_open = t % 5 < 2 ? 0 : -4, gap_extend = t % 5 < 2 ? 0 : -1;
+    int gap_open2 = t % 5 == 4 ? -20 : 0, gap_extend2 = t % 5 == 4 ? -1 : 0;
+    unsigned queryLen = (unsigned)query.size(), targetLen = len;
+
+    std::string cigar, expectedCigar;
+    unsigned target_begin = 0, expectedBegin = 0;
+    EXPECT_EQ(crimson::Align(workspace, query.c_str(), queryLen,
+                             target.c_str(), targetLen, type, 2, -3, -2,
+                             &cigar, &target_begin, gap_open, gap_extend,
+                             gap_open2, gap_extend2),
+              crimson::Align(query.c_str(), queryLen, target.c_str(),
+                             targetLen, type, 2, -3, -2, &expectedCigar,
+                             &expectedBegin, gap_open, gap_extend, gap_open2,
+                             gap_extend2));
+    EXPECT_EQ(cigar, expectedCigar);
+    EXPECT_EQ(target_begin, expectedBegin);
+
+    std::vector<crimson::AlignmentAnchor> anchors;
+    for (unsigned i = 0; i + 20 < queryLen && i < targetLen; i += 20)
+      anchors.push_back({i, i});
+    cigar.clear();
+    expectedCigar.clear();
+    EXPECT_EQ(crimson::AlignBanded(workspace, query.c_str(), queryLen,
+                                   target.c_str(), targetLen, type, 2, -3, -2,
+                                   anchors, 8, &cigar, &target_begin,
+                                   gap_open, gap_extend, gap_open2,
+                                   gap_extend2),
+              crimson::AlignBanded(query.c_str(), queryLen, target.c_str(),
+                                   targetLen, type, 2, -3, -2, anchors, 8,
+                                   &expectedCigar, &expectedBegin, gap_open,
+                                   gap_extend, gap_open2, gap_extend2));
+    EXPECT_EQ(cigar, expectedCigar);
+    EXPECT_EQ(target_begin, expectedBegin);
+
+    cigar.clear();
+    expectedCigar.clear();
+    EXPECT_EQ(crimson::AlignPiecewise(workspace, query.c_str(), queryLen,
+                                      target.c_str(), targetLen, 2, -3, -2,
+                                      anchors, 10, 8, &cigar, gap_open,
+                                      gap_extend, gap_open2, gap_extend2),
+              crimson::AlignPiecewise(query.c_str(), queryLen, target.c_str(),
+                                      targetLen, 2, -3, -2, anchors, 10, 8,
+                                      &expectedCigar, gap_open, gap_extend,
+                                      gap_open2, gap_extend2));
+    EXPECT_EQ(cigar, expectedCigar);
+
+    cigar.clear();
+    expectedCigar.clear();
+    unsigned extent = 0, expectedExtent = 0;
+    EXPECT_EQ(crimson::ExtendAlignment(workspace, query.c_str(), queryLen,
+                                       target.c_str(), targetLen, 2, -3, -2,
+                                       20, 100, t % 2 == 0, &cigar, &extent,
+                                       nullptr, nullptr, gap_open, gap_extend,
+                                       gap_open2, gap_extend2),
+              crimson::ExtendAlignment(query.c_str(), queryLen,
+                                       target.c_str(), targetLen, 2, -3, -2,
+                                       20, 100, t % 2 == 0, &expectedCigar,
+                                       &expectedExtent, nullptr, nullptr,
+                                       gap_open, gap_extend, gap_open2,
+                                       gap_extend2));
+    EXPECT_EQ(cigar, expectedCigar);
+    EXPECT_EQ(extent, expectedExtent);
+  }
+
+  // buffers only grow, so alignments no larger than earlier ones allocate
+  // nothing new
+  std::string query = randomSequence(500), target = randomSequence(500);
+  std::string cigar;
+  unsigned target_begin = 0;
+  crimson::AlignmentWorkspace fresh;
+  const size_t empty = fresh.capacity();
+  crimson::Align(fresh, query.c_str(), 500, target.c_str(), 500,
+                 crimson::AlignmentType::global, 2, -3, -2, &cigar,
+                 &target_begin);
+  const size_t capacity = fresh.capacity();
+  EXPECT_GT(capacity, empty);
+  for (unsigned len : {500u, 100u, 499u}) {
+    cigar.clear();
+    crimson::Align(fresh, query.c_str(), len, target.c_str(), len,
+                   crimson::AlignmentType::global, 2, -3, -2, &cigar,
+                   &target_begin);
+    EXPECT_EQ(fresh.capacity(), capacity);
+  }
+}
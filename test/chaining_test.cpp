@@ -0,0 +1,215 @@
+#include "crimson_chaining_engine.hpp"
+#include "crimson_minimizer_engine.hpp"
+#include "crimson_packed_sequence.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+class ChainingTest : public ::testing::Test {
+protected:
+  static constexpr unsigned int kKmerLen = 15;
+  std::mt19937 rng{23};
+
+  std::string RandomSequence(size_t len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGT"[rng() % 4];
+    return ret;
+  }
+
+  // Copy of sequence with a substitution every 50 bases on average
+  std::string Mutated(std::string sequence) {
+    for (char &c : sequence)
+      if (rng() % 50 == 0)
+        c = "ACGT"[(std::string("ACGT").find(c) + 1 + rng() % 3) % 4];
+    return sequence;
+  }
+
+  static std::string ReverseComplement(const std::string &sequence) {
+    std::string ret(sequence.rbegin(), sequence.rend());
+    for (char &c : ret)
+      c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+    return ret;
+  }
+
+  std::vector<crimson::Chain> Chains(const std::vector<std::string> &refs,
+                                     const std::string &query) {
+    std::vector<const char *> sequences;
+    std::vector<unsigned int> lengths;
+    for (const std::string &i : refs) {
+      sequences.push_back(i.c_str());
+      lengths.push_back((unsigned int)i.size());
+    }
+    crimson::MinimizerIndex<std::uint32_t> index(sequences, lengths,
+                                                 kKmerLen, 10);
+    return crimson::ChainOverlaps(
+        index.Overlaps(crimson::PackedSequence(query)), kKmerLen,
+        (unsigned int)query.size());
+  }
+
+  // Matches of a query chain every 20 bases on the diagonal of offset
+  static std::vector<crimson::Overlap>
+  DiagonalMatches(unsigned int query_begin, unsigned int count,
+                  unsigned int offset) {
+    std::vector<crimson::Overlap> ret;
+    for (unsigned int i = 0; i < count; ++i) {
+      unsigned int pos = query_begin + 20 * i;
+      ret.push_back({0, 0, pos, pos + offset, true, true});
+    }
+    return ret;
+  }
+};
+
+TEST_F(ChainingTest, Forward) {
+  std::string reference = RandomSequence(20000);
+  auto chains = Chains({reference}, Mutated(reference.substr(5000, 3000)));
+  ASSERT_EQ(chains.size(), 1u);
+  const crimson::Chain &chain = chains[0];
+  EXPECT_EQ(chain.kind, crimson::ChainKind::primary);
+  EXPECT_FALSE(chain.is_reverse);
+  EXPECT_EQ(chain.mapq, 60u);
+  EXPECT_LT(chain.query_begin, 100u);
+  EXPECT_GT(chain.query_end, 2900u);
+  EXPECT_EQ(chain.reference_begin, chain.query_begin + 5000);
+  EXPECT_EQ(chain.reference_end, chain.query_end + 5000);
+  for (size_t i = 1; i < chain.matches.size(); ++i) {
+    EXPECT_LT(chain.matches[i - 1].query_pos, chain.matches[i].query_pos);
+    EXPECT_LT(chain.matches[i - 1].reference_pos,
+              chain.matches[i].reference_pos);
+  }
+}
+
+TEST_F(ChainingTest, Reverse) {
+  std::string reference = RandomSequence(20000);
+  std::string query = ReverseComplement(reference.substr(9000, 2500));
+  auto chains = Chains({RandomSequence(5000), reference}, query);
+  ASSERT_EQ(chains.size(), 1u);
+  const crimson::Chain &chain = chains[0];
+  EXPECT_TRUE(chain.is_reverse);
+  EXPECT_EQ(chain.reference_index, 1u);
+  // the query span is on the query, matches on its reverse complement
+  EXPECT_EQ(chain.reference_begin, 9000 + query.size() - chain.query_end);
+  EXPECT_EQ(chain.reference_end, 9000 + query.size() - chain.query_begin);
+  for (const crimson::Overlap &i : chain.matches)
+    EXPECT_EQ(i.reference_pos, i.query_pos + 9000);
+}
+
+TEST_F(ChainingTest, Repeat) {
+  // the query maps equally well to both copies of a repeat
+  std::string repeat = RandomSequence(2000);
+  std::string reference = RandomSequence(3000) + repeat +
+                          RandomSequence(3000) + repeat + RandomSequence(3000);
+  auto chains = Chains({reference}, repeat.substr(200, 1500));
+  ASSERT_EQ(chains.size(), 2u);
+  EXPECT_EQ(chains[0].kind, crimson::ChainKind::primary);
+  EXPECT_EQ(chains[1].kind, crimson::ChainKind::secondary);
+  EXPECT_EQ(chains[0].score, chains[1].score);
+  EXPECT_EQ(chains[0].mapq, 0u);
+  EXPECT_EQ(chains[1].mapq, 0u);
+  EXPECT_EQ(std::max(chains[0].reference_begin, chains[1].reference_begin) -
+                std::min(chains[0].reference_begin, chains[1].reference_begin),
+            5000u);
+
+  crimson::ChainOptions options;
+  options.max_secondary = 0;
+  std::vector<const char *> sequences = {reference.c_str()};
+  std::vector<unsigned int> lengths = {(unsigned int)reference.size()};
+  crimson::MinimizerIndex<std::uint32_t> index(sequences, lengths, kKmerLen,
+                                               10);
+  std::string query = repeat.substr(200, 1500);
+  auto primary = crimson::ChainOverlaps(
+      index.Overlaps(crimson::PackedSequence(query)), kKmerLen,
+      (unsigned int)query.size(), options);
+  ASSERT_EQ(primary.size(), 1u);
+  EXPECT_EQ(primary[0].mapq, 0u);
+}
+
+TEST_F(ChainingTest, Chimeric) {
+  // parts of the query map to distant places
+  std::string reference = RandomSequence(30000);
+  std::string query = reference.substr(2000, 1500) +
+                      ReverseComplement(reference.substr(20000, 1000));
+  auto chains = Chains({reference}, query);
+  ASSERT_EQ(chains.size(), 2u);
+  EXPECT_EQ(chains[0].kind, crimson::ChainKind::primary);
+  EXPECT_EQ(chains[1].kind, crimson::ChainKind::supplementary);
+  EXPECT_FALSE(chains[0].is_reverse);
+  EXPECT_TRUE(chains[1].is_reverse);
+  EXPECT_LE(chains[0].query_end, chains[1].query_begin + kKmerLen);
+  EXPECT_GT(chains[1].query_end, 2400u);
+  EXPECT_GT(chains[0].mapq, 0u);
+  EXPECT_GT(chains[1].mapq, 0u);
+}
+
+TEST_F(ChainingTest, GapCost) {
+  auto colinear = DiagonalMatches(100, 10, 1000);
+  auto chains = crimson::ChainOverlaps(colinear, kKmerLen, 1000);
+  ASSERT_EQ(chains.size(), 1u);
+  EXPECT_EQ(chains[0].score, int(10 * kKmerLen));
+  EXPECT_EQ(chains[0].matches.size(), 10u);
+
+  // a gap of 30 bases between the halves costs 0.01 * 15 * 30 + log2(30) / 2
+  auto gapped = DiagonalMatches(100, 5, 1000);
+  for (const crimson::Overlap &i : DiagonalMatches(200, 5, 1030))
+    gapped.push_back(i);
+  std::shuffle(gapped.begin(), gapped.end(), rng);
+  chains = crimson::ChainOverlaps(gapped, kKmerLen, 1000);
+  ASSERT_EQ(chains.size(), 1u);
+  EXPECT_EQ(chains[0].score, int(10 * kKmerLen) - 6);
+  EXPECT_EQ(chains[0].matches.size(), 10u);
+
+  // beyond the bandwidth the halves do not chain, and each is too short
+  gapped = DiagonalMatches(100, 2, 1000);
+  for (const crimson::Overlap &i : DiagonalMatches(200, 2, 2000))
+    gapped.push_back(i);
+  EXPECT_TRUE(crimson::ChainOverlaps(gapped, kKmerLen, 1000).empty());
+}
+
+TEST_F(ChainingTest, Workspace) {
+  // many small references of which queries hit a few
+  std::vector<std::string> refs;
+  for (unsigned int i = 0; i < 2000; ++i)
+    refs.push_back(RandomSequence(600));
+  std::vector<const char *> sequences;
+  std::vector<unsigned int> lengths;
+  for (const std::string &i : refs) {
+    sequences.push_back(i.c_str());
+    lengths.push_back((unsigned int)i.size());
+  }
+  crimson::MinimizerIndex<std::uint32_t> index(sequences, lengths, kKmerLen,
+                                               10);
+
+  crimson::ChainingWorkspace<std::uint32_t> workspace;
+  size_t capacity = 0;
+  for (unsigned int t = 0; t < 20; ++t) {
+    unsigned int ref = (unsigned int)(rng() % refs.size());
+    std::string query = Mutated(refs[ref].substr(50, 500));
+    if (t % 2 == 1)
+      query = ReverseComplement(query);
+    crimson::PackedSequence packed(query);
+
+    index.Overlaps(packed, workspace.overlaps());
+    auto chains = crimson::ChainOverlaps(workspace, kKmerLen,
+                                         (unsigned int)query.size());
+    auto expected = crimson::ChainOverlaps(index.Overlaps(packed), kKmerLen,
+                                           (unsigned int)query.size());
+    ASSERT_EQ(chains.size(), expected.size());
+    ASSERT_FALSE(chains.empty());
+    EXPECT_EQ(chains[0].reference_index, ref);
+    EXPECT_EQ(chains[0].is_reverse, t % 2 == 1);
+    for (size_t i = 0; i < chains.size(); ++i) {
+      EXPECT_EQ(chains[i].score, expected[i].score);
+      EXPECT_EQ(chains[i].reference_begin, expected[i].reference_begin);
+      EXPECT_EQ(chains[i].matches.size(), expected[i].matches.size());
+    }
+
+    // buffers grow only for queries of more matches than before
+    if (t == 0)
+      capacity = workspace.capacity();
+    EXPECT_GT(workspace.capacity(), 0u);
+    EXPECT_LE(workspace.capacity(), 2 * capacity);
+  }
+}
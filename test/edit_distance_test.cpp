@@ -0,0 +1,120 @@
+#include "crimson_alignment_engine.hpp"
+#include "crimson_edit_distance.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+std::string RandomSequence(std::mt19937 &rng, unsigned len) {
+  std::string ret(len, 'A');
+  for (char &c : ret)
+    c = "ACGT"[rng() % 4];
+  return ret;
+}
+
+// Copy of sequence with about one edit in every rate bases
+std::string Mutate(std::mt19937 &rng, const std::string &sequence,
+                   unsigned rate) {
+  std::string ret;
+  for (char c : sequence) {
+    unsigned edit = (unsigned)(rng() % (3 * rate));
+    if (edit == 0)
+      ret += "ACGT"[rng() % 4];
+    else if (edit == 1)
+      ret += c + std::string(1, "ACGT"[rng() % 4]);
+    else if (edit != 2)
+      ret += c;
+  }
+  return ret;
+}
+
+} // namespace
+
+TEST(EditDistanceTest, Small) {
+  EXPECT_EQ(crimson::EditDistance("GATTACA", 7, "GCATGCU", 7,
+                                  crimson::AlignmentType::global),
+            4);
+  EXPECT_EQ(crimson::EditDistance("TTAC", 4, "GGATTACAGG", 10,
+                                  crimson::AlignmentType::semiglobal),
+            0);
+  EXPECT_EQ(crimson::EditDistance("", 0, "ACG", 3,
+                                  crimson::AlignmentType::global),
+            3);
+
+  std::string cigar;
+  unsigned int target_begin = 0;
+  EXPECT_EQ(crimson::EditDistance("TTAC", 4, "GGATTACAGG", 10,
+                                  crimson::AlignmentType::semiglobal, &cigar,
+                                  &target_begin),
+            0);
+  EXPECT_EQ(cigar, "4M");
+  EXPECT_EQ(target_begin, 3u);
+
+  // the whole query is aligned
+  cigar.clear();
+  unsigned int query_begin = 1;
+  crimson::EditDistance("TTAC", 4, "GGATTACAGG", 10,
+                        crimson::AlignmentType::semiglobal, &cigar,
+                        &target_begin, -1, &query_begin);
+  EXPECT_EQ(query_begin, 0u);
+
+  EXPECT_THROW(crimson::EditDistance("A", 1, "A", 1,
+                                     crimson::AlignmentType::local),
+               std::invalid_argument);
+}
+
+TEST(EditDistanceTest, SameAsAlign) {
+  std::mt19937 rng(13);
+  for (unsigned t = 0; t < 200; ++t) {
+    unsigned len = t < 100 ? 1 + (unsigned)rng() % 150
+                           : 100 + (unsigned)rng() % 2000;
+    std::string target = RandomSequence(rng, len);
+    std::string query =
+        Mutate(rng, target.substr(rng() % (len / 4 + 1)), 2 + t % 20);
+    if (query.empty())
+      query = "A";
+    if (t % 7 == 0)
+      query += RandomSequence(rng, (unsigned)rng() % 300);
+    if (t % 11 == 0)
+      query[rng() % query.size()] = 'N';
+
+    for (crimson::AlignmentType type : {crimson::AlignmentType::global,
+                                        crimson::AlignmentType::semiglobal}) {
+      std::string expectedCigar;
+      unsigned int expectedBegin = 0;
+      int expected = -crimson::Align(
+          query.c_str(), (unsigned)query.size(), target.c_str(),
+          (unsigned)target.size(), type, 0, -1, -1, &expectedCigar,
+          &expectedBegin);
+
+      EXPECT_EQ(crimson::EditDistance(query.c_str(), (unsigned)query.size(),
+                                      target.c_str(), (unsigned)target.size(),
+                                      type),
+                expected);
+
+      std::string cigar;
+      unsigned int target_begin = 0;
+      EXPECT_EQ(crimson::EditDistance(query.c_str(), (unsigned)query.size(),
+                                      target.c_str(), (unsigned)target.size(),
+                                      type, &cigar, &target_begin),
+                expected);
+      EXPECT_EQ(cigar, expectedCigar);
+      EXPECT_EQ(target_begin, expectedBegin);
+
+      // a limit below the distance is reported as exceeded
+      EXPECT_EQ(crimson::EditDistance(query.c_str(), (unsigned)query.size(),
+                                      target.c_str(), (unsigned)target.size(),
+                                      type, nullptr, nullptr, expected),
+                expected);
+      if (expected > 0) {
+        EXPECT_EQ(crimson::EditDistance(
+                      query.c_str(), (unsigned)query.size(), target.c_str(),
+                      (unsigned)target.size(), type, nullptr, nullptr,
+                      expected - 1),
+                  -1);
+      }
+    }
+  }
+}
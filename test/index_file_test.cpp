@@ -0,0 +1,138 @@
+#include "crimson_index_file.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class IndexFileTest : public ::testing::Test {
+protected:
+  std::vector<std::string> names = {"chr1", "", "chrUn_gl000220 random"};
+  std::vector<std::string> references;
+  std::string path;
+
+  void SetUp() override {
+    std::mt19937 rng(5);
+    for (unsigned i = 0; i < names.size(); ++i) {
+      std::string reference(20000 + 7 * i, 'A');
+      for (char &c : reference)
+        c = "ACGT"[rng() % 4];
+      reference.replace(100, 50, 50, 'N');
+      reference[3000] = 'R';
+      reference[3001] = 'n';
+      reference[5000] = 'c';
+      references.push_back(reference);
+    }
+    references.back().replace(references.back().size() - 3, 3, "NNN");
+    path = testing::TempDir() + "index_file_test.idx";
+  }
+
+  void TearDown() override { std::remove(path.c_str()); }
+
+  template <typename KmerT>
+  crimson::MinimizerIndex<KmerT> Build(unsigned int kmer_len) {
+    std::vector<const char *> reference_sequences;
+    std::vector<unsigned int> ref_seq_sizes;
+    std::vector<std::string_view> name_views, reference_views;
+    for (unsigned i = 0; i < references.size(); ++i) {
+      reference_sequences.push_back(references[i].c_str());
+      ref_seq_sizes.push_back((unsigned int)references[i].size());
+      name_views.push_back(names[i]);
+      reference_views.push_back(references[i]);
+    }
+    crimson::MinimizerIndex<KmerT> index(reference_sequences, ref_seq_sizes,
+                                         kmer_len, 10);
+    index.Filter(0.001);
+    crimson::IndexFile::Write(path, index, name_views, reference_views);
+    return index;
+  }
+};
+
+TEST_F(IndexFileTest, References) {
+  Build<std::uint32_t>(15);
+  ASSERT_TRUE(crimson::IndexFile::Detect(path));
+
+  crimson::IndexFile file(path);
+  EXPECT_EQ(file.kmer_bytes(), 4u);
+  ASSERT_EQ(file.num_references(), references.size());
+  for (unsigned i = 0; i < references.size(); ++i) {
+    EXPECT_EQ(file.name(i), names[i]);
+    ASSERT_EQ(file.length(i), references[i].size());
+
+    std::string expected = references[i];
+    for (char &c : expected) {
+      c = (char)toupper(c);
+      if (c != 'A' && c != 'C' && c != 'G' && c != 'T')
+        c = 'N';
+    }
+    std::string bases;
+    file.Extract(i, 0, file.length(i), bases);
+    EXPECT_EQ(bases, expected);
+
+    bases = "x";
+    file.Extract(i, 2990, 3010, bases);
+    EXPECT_EQ(bases, "x" + expected.substr(2990, 20));
+    bases.clear();
+    file.Extract(i, 120, 125, bases);
+    EXPECT_EQ(bases, "NNNNN");
+  }
+}
+
+TEST_F(IndexFileTest, Index) {
+  auto built = Build<std::uint64_t>(21);
+  crimson::IndexFile file(path);
+  EXPECT_EQ(file.kmer_bytes(), 8u);
+  EXPECT_THROW(file.Index<std::uint32_t>(), std::invalid_argument);
+
+  auto mapped = file.Index<std::uint64_t>();
+  EXPECT_EQ(mapped.kmer_len(), 21u);
+  EXPECT_EQ(mapped.window_len(), 10u);
+  EXPECT_EQ(mapped.num_references(), built.num_references());
+  EXPECT_EQ(mapped.num_minimizers(), built.num_minimizers());
+  EXPECT_EQ(mapped.num_entries(), built.num_entries());
+
+  for (unsigned i = 0; i < references.size(); ++i) {
+    std::string query = references[i].substr(4000, 3000);
+    auto expected = built.Map(query.c_str(), (unsigned int)query.size());
+    auto overlaps = mapped.Map(query.c_str(), (unsigned int)query.size());
+    ASSERT_FALSE(overlaps.empty());
+    ASSERT_EQ(overlaps.size(), expected.size());
+    for (unsigned j = 0; j < overlaps.size(); ++j) {
+      EXPECT_EQ(overlaps[j].reference_index, i);
+      EXPECT_EQ(overlaps[j].reference_pos, expected[j].reference_pos);
+      EXPECT_EQ(overlaps[j].query_pos, expected[j].query_pos);
+    }
+  }
+}
+
+TEST_F(IndexFileTest, NotIndex) {
+  std::ofstream(path) << ">chr1\nACGT\n";
+  EXPECT_FALSE(crimson::IndexFile::Detect(path));
+  EXPECT_THROW(crimson::IndexFile file(path), std::runtime_error);
+  EXPECT_THROW(crimson::IndexFile file(path + ".missing"), std::runtime_error);
+}
+
+TEST_F(IndexFileTest, Corrupted) {
+  Build<std::uint32_t>(15);
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  EXPECT_NO_THROW(crimson::IndexFile file(path));
+
+  // the name offsets are 0, 4, 4, 25, and pointing the second name past
+  // the end of the third keeps the last offset within the names
+  const std::uint64_t offsets[] = {0, 4, 4, 25};
+  size_t at = data.find(std::string(reinterpret_cast<const char *>(offsets),
+                                    sizeof(offsets)));
+  ASSERT_NE(at, std::string::npos);
+  const std::uint64_t past = 30;
+  std::memcpy(&data[at + sizeof(std::uint64_t)], &past, sizeof(past));
+  std::ofstream(path, std::ios::binary) << data;
+  EXPECT_THROW(crimson::IndexFile file(path), std::runtime_error);
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class MapperTest : public ::testing::Test {
+protected:
+  std::string reference, read, referencePath, readPath;
+
+  // The read is reference[5088, 7088) with 40 random bases inserted after
+  // its first 30, so local alignments clip its beginning
+  void SetUp() override {
+    std::mt19937 rng(5);
+    reference.resize(20000);
+    for (char &c : reference)
+      c = "ACGT"[rng() % 4];
+    std::string insert(40, 'A');
+    for (char &c : insert)
+      c = "ACGT"[rng() % 4];
+    read = reference.substr(5088, 30) + insert + reference.substr(5118, 1970);
+
+    referencePath = ::testing::TempDir() + "mapper_test_reference.fa";
+    readPath = ::testing::TempDir() + "mapper_test_read.fa";
+    std::ofstream(referencePath) << ">ref\n" << reference << '\n';
+    std::ofstream(readPath) << ">read\n" << read << '\n';
+  }
+
+  void TearDown() override {
+    std::remove(referencePath.c_str());
+    std::remove(readPath.c_str());
+  }
+
+  // Output lines of the mapper run with args on the reference and the read
+  std::vector<std::string> Map(const std::string &args) {
+    std::string command = std::string(CRIMSON_MAPPER_PATH) + " " + args +
+                          " " + referencePath + " " + readPath;
+    std::vector<std::string> lines;
+    FILE *pipe = popen(command.c_str(), "r");
+    EXPECT_NE(pipe, nullptr) << command;
+    if (pipe == nullptr)
+      return lines;
+    std::string output;
+    char buffer[1 << 12];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+      output.append(buffer, n);
+    EXPECT_EQ(pclose(pipe), 0) << command;
+    std::istringstream stream(output);
+    for (std::string line; std::getline(stream, line);)
+      if (!line.empty() && line[0] != '@')
+        lines.push_back(line);
+    return lines;
+  }
+
+  static std::vector<std::string> Split(const std::string &line) {
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    for (std::string field; std::getline(stream, field, '\t');)
+      fields.push_back(field);
+    return fields;
+  }
+
+  static std::string Tag(const std::vector<std::string> &fields,
+                         const std::string &prefix) {
+    for (const std::string &field : fields)
+      if (field.compare(0, prefix.size(), prefix) == 0)
+        return field.substr(prefix.size());
+    return "";
+  }
+
+  struct Recount {
+    unsigned int query = 0, target = 0, clipped = 0;
+    unsigned int matches = 0, columns = 0, edits = 0;
+  };
+
+  // Walks the cigar over query and the reference from target_begin on,
+  // counting soft clips only in front of the query and not in it
+  Recount Walk(const std::string &cigar, const std::string &query,
+               unsigned int target_begin) const {
+    Recount ret;
+    unsigned int i = 0, j = target_begin, length = 0;
+    for (char c : cigar) {
+      if (std::isdigit(static_cast<unsigned char>(c))) {
+        length = length * 10 + static_cast<unsigned int>(c - '0');
+        continue;
+      }
+      if (c == 'S') {
+        ret.clipped += length;
+        if (i == 0)
+          i += length;
+      } else if (c == 'M') {
+        for (unsigned int k = 0; k < length; ++k, ++i, ++j) {
+          bool equal = i < query.size() && j < reference.size() &&
+                       query[i] == reference[j];
+          ret.matches += equal;
+          ret.edits += !equal;
+        }
+        ret.query += length;
+        ret.target += length;
+        ret.columns += length;
+      } else if (c == 'I') {
+        i += length;
+        ret.query += length;
+        ret.edits += length;
+        ret.columns += length;
+      } else if (c == 'D') {
+        j += length;
+        ret.target += length;
+        ret.edits += length;
+        ret.columns += length;
+      }
+      length = 0;
+    }
+    return ret;
+  }
+};
+
+TEST_F(MapperTest, SamPlacement) {
+  for (std::string type : {"global", "local"}) {
+    std::vector<std::string> lines = Map("--sam -a " + type);
+    ASSERT_EQ(lines.size(), 1u) << type;
+    std::vector<std::string> fields = Split(lines[0]);
+    ASSERT_GE(fields.size(), 11u) << type;
+    ASSERT_EQ(fields[1], "0") << type;
+    const std::string &seq = fields[9];
+    EXPECT_EQ(seq, read) << type;
+    unsigned int position =
+        static_cast<unsigned int>(std::stoul(fields[3])) - 1;
+    Recount recount = Walk(fields[5], seq, position);
+    EXPECT_EQ(recount.query + recount.clipped, seq.size()) << type;
+    unsigned int nm =
+        static_cast<unsigned int>(std::stoul(Tag(fields, "NM:i:")));
+    EXPECT_EQ(nm, recount.edits) << type << ' ' << fields[5];
+    EXPECT_LE(nm, 40u) << type << ' ' << fields[5];
+  }
+}
+
+TEST_F(MapperTest, PafCoordinates) {
+  for (std::string type : {"global", "local"}) {
+    std::vector<std::string> lines = Map("-c -a " + type);
+    ASSERT_EQ(lines.size(), 1u) << type;
+    std::vector<std::string> fields = Split(lines[0]);
+    ASSERT_GE(fields.size(), 12u) << type;
+    ASSERT_EQ(fields[4], "+") << type;
+    auto column = [&fields](size_t i) {
+      return static_cast<unsigned int>(std::stoul(fields[i]));
+    };
+    unsigned int queryBegin = column(2), queryEnd = column(3);
+    unsigned int targetBegin = column(7), targetEnd = column(8);
+    std::string cigar = Tag(fields, "cg:Z:");
+    Recount recount = Walk(cigar, read.substr(queryBegin), targetBegin);
+    EXPECT_EQ(queryEnd - queryBegin, recount.query) << type << ' ' << cigar;
+    EXPECT_EQ(targetEnd - targetBegin, recount.target) << type << ' ' << cigar;
+    EXPECT_EQ(column(9), recount.matches) << type << ' ' << cigar;
+    EXPECT_EQ(column(10), recount.columns) << type << ' ' << cigar;
+    EXPECT_LE(recount.edits, 40u) << type << ' ' << cigar;
+  }
+}
+
+TEST_F(MapperTest, ZDropSplit) {
+  // the chain spans 600 diverged bases in the middle of the read, where the
+  // alignment drops by more than the Z-drop
+  std::mt19937 rng(7);
+  std::string diverged(600, 'A');
+  for (char &c : diverged)
+    c = "ACGT"[rng() % 4];
+  read = reference.substr(5000, 2000) + diverged +
+         reference.substr(7600, 2000);
+  std::ofstream(readPath) << ">read\n" << read << '\n';
+
+  std::vector<std::string> lines = Map("--sam -z 200");
+  ASSERT_EQ(lines.size(), 2u);
+  unsigned int supplementary = 0, queryEnd = 0;
+  for (const std::string &line : lines) {
+    std::vector<std::string> fields = Split(line);
+    ASSERT_GE(fields.size(), 11u);
+    ASSERT_TRUE(fields[1] == "0" || fields[1] == "2048") << fields[1];
+    supplementary += fields[1] == "2048";
+    unsigned int position =
+        static_cast<unsigned int>(std::stoul(fields[3])) - 1;
+    Recount recount = Walk(fields[5], fields[9], position);
+    EXPECT_EQ(recount.query + recount.clipped, read.size());
+    unsigned int nm =
+        static_cast<unsigned int>(std::stoul(Tag(fields, "NM:i:")));
+    EXPECT_EQ(nm, recount.edits) << fields[5];
+    EXPECT_LE(nm, 20u) << fields[5];
+    // each part is on its side of the diverged bases, into which it may
+    // reach where they happen to match
+    unsigned int clipBegin = recount.clipped;
+    if (fields[5].back() == 'S')
+      clipBegin -= static_cast<unsigned int>(
+          std::stoul(fields[5].substr(fields[5].find_last_of("MID") + 1)));
+    EXPECT_TRUE(clipBegin + recount.query <= 2040 || clipBegin >= 2560)
+        << fields[5];
+    queryEnd = std::max(queryEnd, clipBegin + recount.query);
+  }
+  // one primary and one supplementary mapping
+  EXPECT_EQ(supplementary, 1u);
+  EXPECT_GE(queryEnd, 4590u);
+
+  // without the Z-drop the chain is aligned as a whole
+  EXPECT_EQ(Map("--sam -z 0").size(), 1u);
+}
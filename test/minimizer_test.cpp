@@ -1,8 +1,12 @@
 #include "crimson_minimizer_engine.hpp"
 #include <algorithm>
 #include <bitset>
+#include <cstring>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -28,13 +32,13 @@ protected:
 
   void SetUp() override {
     singleTests.push_back({"GTCATGCACGTTCAC", 3, 4, 4});
-    singleTests.push_back({"GTCATGCACGTTCAC", 3, 3, 4});
+    singleTests.push_back({"GTCATGCACGTTCAC", 3, 3, 7});
     singleTests.push_back({"ACCCAAC", 3, 4, 2});
     singleTests.push_back({"AAAAAAAAAAAAA", 3, 3, 3});
-    mapTests.push_back({{"GTCATGCACGTTCAC"}, 3, 3, 0.0, "GTCATGCACGTTCAC", 4});
-    mapTests.push_back({{"GTCATGCACGTTCAC"}, 3, 3, 0.5, "GTCATGCACGTTCAC", 2});
+    mapTests.push_back({{"GTCATGCACGTTCAC"}, 3, 3, 0.0, "GTCATGCACGTTCAC", 5});
+    mapTests.push_back({{"GTCATGCACGTTCAC"}, 3, 3, 0.5, "GTCATGCACGTTCAC", 3});
     mapTests.push_back(
-        {{"AAAAATATACG", "GCATTGAC"}, 3, 3, 0.0, "AAATGCTATACGA", 3});
+        {{"AAAAATATACG", "GCATTGAC"}, 3, 3, 0.0, "AAATGCTATACGA", 4});
     mapTests.push_back(
         {{"AAAAAAACCCCCCCC", "CCCCAAAAAAAAAAA"}, 3, 3, 0.0, "AAAAAATAAAAA", 2});
     mapTests.push_back(
@@ -49,6 +53,37 @@ protected:
 
   void TearDown() override { crimson::ResetData(); }
 
+  // Reference window scan, O(sequence_len * window_len)
+  template <typename KmerT = unsigned int>
+  std::vector<std::tuple<KmerT, unsigned int, bool>>
+  NaiveMinimize(const std::string &sequence, unsigned kmer_len,
+                unsigned window_len) {
+    std::vector<std::tuple<KmerT, unsigned int, bool>> kmers, ret;
+    for (unsigned i = 0; i + kmer_len <= sequence.size(); ++i) {
+      KmerT kmer = 0, kmerRev = 0;
+      for (unsigned j = i; j < i + kmer_len; ++j) {
+        unsigned code = sequence[j] == 'A'   ? 0
+                        : sequence[j] == 'C' ? 1
+                        : sequence[j] == 'G' ? 2
+                                             : 3;
+        kmer = kmer * 4 + code;
+        kmerRev += KmerT(3 - code) << (2 * (j - i));
+      }
+      kmers.push_back({std::min(kmer, kmerRev), i, kmer < kmerRev});
+    }
+    for (unsigned i = 0; i + window_len <= kmers.size(); ++i) {
+      auto best = kmers[i];
+      for (unsigned j = i; j < i + window_len; ++j)
+        if (std::get<0>(kmers[j]) <= std::get<0>(best))
+          best = kmers[j];
+      if (ret.empty() || std::get<1>(ret.back()) < i ||
+          std::get<0>(ret.back()) != std::get<0>(best) ||
+          std::get<2>(ret.back()) != std::get<2>(best))
+        ret.push_back(best);
+    }
+    return ret;
+  }
+
   std::string KmerString(unsigned int kmer, unsigned int kmer_len) {
     std::string ret;
     for (unsigned i = 0; i < kmer_len; ++i) {
@@ -75,6 +110,372 @@ TEST_F(MinimizeTest, Single) {
   }
 }
 
+TEST_F(MinimizeTest, SingleRandom) {
+  std::mt19937 rng(42);
+  for (unsigned t = 0; t < 500; ++t) {
+    unsigned alphabet = 1 + (unsigned)(rng() % 4);
+    std::string sequence(rng() % 120, 'A');
+    for (char &c : sequence)
+      c = "ACGT"[rng() % alphabet];
+    unsigned kmer_len = 1 + (unsigned)(rng() % 12);
+    unsigned window_len = 1 + (unsigned)(rng() % 10);
+    auto minimizers =
+        crimson::Minimize(sequence.c_str(), (unsigned int)sequence.size(),
+                          kmer_len, window_len);
+    EXPECT_EQ(minimizers, NaiveMinimize(sequence, kmer_len, window_len));
+  }
+}
+
+TEST_F(MinimizeTest, SingleWide) {
+  std::mt19937 rng(7);
+  for (unsigned t = 0; t < 200; ++t) {
+    std::string sequence(rng() % 300, 'A');
+    for (char &c : sequence)
+      c = "ACGT"[rng() % 4];
+    unsigned kmer_len = 1 + (unsigned)(rng() % 32);
+    unsigned window_len = 1 + (unsigned)(rng() % 10);
+    auto minimizers = crimson::Minimize<std::uint64_t>(
+        sequence.c_str(), (unsigned int)sequence.size(), kmer_len, window_len);
+    EXPECT_EQ(minimizers,
+              NaiveMinimize<std::uint64_t>(sequence, kmer_len, window_len));
+    if (kmer_len <= 16) {
+      auto narrow =
+          crimson::Minimize(sequence.c_str(), (unsigned int)sequence.size(),
+                            kmer_len, window_len);
+      ASSERT_EQ(narrow.size(), minimizers.size());
+      for (unsigned i = 0; i < narrow.size(); ++i)
+        EXPECT_EQ(std::get<0>(narrow[i]), std::get<0>(minimizers[i]));
+    }
+  }
+  EXPECT_THROW(crimson::Minimize("ACGT", 4, 17, 1), std::invalid_argument);
+}
+
+TEST_F(MinimizeTest, MapWide) {
+  std::mt19937 rng(11);
+  std::string reference(5000, 'A');
+  for (char &c : reference)
+    c = "ACGT"[rng() % 4];
+  std::string query = reference.substr(1000, 2000);
+
+  std::vector<const char *> reference_sequences = {reference.c_str()};
+  std::vector<unsigned int> ref_seq_sizes = {(unsigned int)reference.size()};
+
+  crimson::Minimize<std::uint64_t>(reference_sequences, ref_seq_sizes, 21, 10);
+  crimson::Filter<std::uint64_t>(0.0);
+  auto overlaps =
+      crimson::Map<std::uint64_t>(query.c_str(), (unsigned)query.size());
+
+  ASSERT_FALSE(overlaps.empty());
+  for (auto j : overlaps) {
+    EXPECT_EQ(j.reference_index, 0u);
+    EXPECT_EQ(j.reference_pos, j.query_pos + 1000);
+  }
+  EXPECT_GT(overlaps.size(), 300u);
+}
+
+TEST_F(MinimizeTest, IndexInstances) {
+  std::mt19937 rng(17);
+  std::vector<std::string> references(2, std::string(20000, 'A'));
+  for (std::string &reference : references)
+    for (char &c : reference)
+      c = "ACGT"[rng() % 4];
+
+  std::vector<const char *> reference_sequences;
+  std::vector<unsigned int> ref_seq_sizes;
+  for (const std::string &reference : references) {
+    reference_sequences.push_back(reference.c_str());
+    ref_seq_sizes.push_back((unsigned int)reference.size());
+  }
+
+  crimson::MinimizerIndex<std::uint32_t> narrow(reference_sequences,
+                                                ref_seq_sizes, 15, 10);
+  crimson::MinimizerIndex<std::uint64_t> wide(reference_sequences,
+                                              ref_seq_sizes, 25, 5, 4);
+  EXPECT_EQ(narrow.kmer_len(), 15u);
+  EXPECT_EQ(wide.kmer_len(), 25u);
+  EXPECT_EQ(wide.num_references(), 2u);
+
+  // every reference minimizer is found at its own position
+  for (unsigned r = 0; r < references.size(); ++r) {
+    auto mins = crimson::Minimize<std::uint64_t>(
+        references[r].c_str(), ref_seq_sizes[r], 25, 5);
+    for (auto &i : mins) {
+      auto occurrences = wide.Query(std::get<0>(i));
+      EXPECT_TRUE(std::any_of(
+          occurrences.begin(), occurrences.end(),
+          [&](const crimson::IndexEntry &j) {
+            return j.reference_index == r && j.position() == std::get<1>(i) &&
+                   j.is_original() == std::get<2>(i);
+          }));
+    }
+  }
+
+  std::string query = references[1].substr(5000, 3000);
+  auto narrowOverlaps = narrow.Map(query.c_str(), (unsigned)query.size());
+  auto wideOverlaps = wide.Map(query.c_str(), (unsigned)query.size());
+  ASSERT_FALSE(narrowOverlaps.empty());
+  ASSERT_FALSE(wideOverlaps.empty());
+  for (auto j : narrowOverlaps)
+    EXPECT_EQ(j.reference_pos, j.query_pos + 5000);
+  for (auto j : wideOverlaps)
+    EXPECT_EQ(j.reference_pos, j.query_pos + 5000);
+}
+
+TEST_F(MinimizeTest, IndexLimits) {
+  // positions share 32 bits with the strand, so a reference of 2^31 bases
+  // is refused before any of its bases are read
+  const std::uint8_t bases[1] = {};
+  crimson::PackedSequence huge = crimson::PackedSequence::View(
+      bases, 0, std::size_t(1) << 31, nullptr, 0);
+  EXPECT_THROW(crimson::MinimizerIndex<std::uint32_t>({&huge}, 15, 10),
+               std::invalid_argument);
+  EXPECT_THROW(crimson::MinimizerIndex<std::uint32_t>(
+                   {&huge}, 15, 10, 1, crimson::IndexFilter{0.5, 0}),
+               std::invalid_argument);
+}
+
+TEST_F(MinimizeTest, BatchLookups) {
+  std::mt19937 rng(29);
+  std::vector<std::string> references(3, std::string(30000, 'A'));
+  for (std::string &reference : references)
+    for (char &c : reference)
+      c = "ACGT"[rng() % 4];
+  // a repeat gives some minimizers several occurrences
+  references[2].replace(1000, 5000, references[0].substr(0, 5000));
+
+  std::vector<const char *> reference_sequences;
+  std::vector<unsigned int> ref_seq_sizes;
+  for (const std::string &reference : references) {
+    reference_sequences.push_back(reference.c_str());
+    ref_seq_sizes.push_back((unsigned int)reference.size());
+  }
+  crimson::MinimizerIndex<std::uint32_t> index(reference_sequences,
+                                               ref_seq_sizes, 15, 10);
+
+  // queries of every size, also too short to have a minimizer, and of
+  // sequences absent from the index
+  std::vector<crimson::PackedSequence> queries;
+  for (unsigned i = 0; i < 40; ++i) {
+    const std::string &reference = references[i % references.size()];
+    size_t len = i % 10 == 3 ? i % 20 : 100 + rng() % 3000;
+    std::string query = reference.substr(rng() % (reference.size() - len), len);
+    if (i % 7 == 0)
+      for (char &c : query)
+        c = "ACGT"[rng() % 4];
+    queries.emplace_back(query);
+  }
+  std::vector<const crimson::PackedSequence *> batch;
+  for (const crimson::PackedSequence &query : queries)
+    batch.push_back(&query);
+
+  std::vector<crimson::Overlap> overlaps;
+  std::vector<size_t> offsets;
+  index.Overlaps(batch, overlaps, offsets);
+  ASSERT_EQ(offsets.size(), queries.size() + 1);
+  EXPECT_EQ(offsets.back(), overlaps.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    auto expected = index.Overlaps(queries[i]);
+    ASSERT_EQ(offsets[i + 1] - offsets[i], expected.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      const crimson::Overlap &overlap = overlaps[offsets[i] + j];
+      EXPECT_EQ(overlap.kmer, expected[j].kmer);
+      EXPECT_EQ(overlap.reference_index, expected[j].reference_index);
+      EXPECT_EQ(overlap.query_pos, expected[j].query_pos);
+      EXPECT_EQ(overlap.reference_pos, expected[j].reference_pos);
+      EXPECT_EQ(overlap.is_original_query, expected[j].is_original_query);
+      EXPECT_EQ(overlap.is_original_reference,
+                expected[j].is_original_reference);
+    }
+  }
+
+  // batched lookups find what single ones do, also for absent k-mers
+  std::vector<std::uint32_t> kmers;
+  for (unsigned i = 0; i < 1000; ++i)
+    kmers.push_back(i % 2 ? overlaps[rng() % overlaps.size()].kmer
+                          : (std::uint32_t)(rng() & ((1u << 30) - 1)));
+  std::vector<crimson::MinimizerIndex<std::uint32_t>::Occurrences> found(
+      kmers.size());
+  index.Query(kmers.data(), kmers.size(), found.data());
+  for (size_t i = 0; i < kmers.size(); ++i) {
+    auto expected = index.Query(kmers[i]);
+    EXPECT_EQ(found[i].first, expected.first);
+    EXPECT_EQ(found[i].last, expected.last);
+  }
+  crimson::MinimizerIndex<std::uint32_t> empty;
+  empty.Query(kmers.data(), kmers.size(), found.data());
+  for (const auto &i : found)
+    EXPECT_TRUE(i.empty());
+}
+
+TEST_F(MinimizeTest, IndexFilter) {
+  // repeats of a few units make some minimizers far more frequent
+  std::mt19937 rng(19);
+  std::vector<std::string> units(20);
+  for (std::string &unit : units)
+    for (unsigned i = 0; i < 200; ++i)
+      unit += "ACGT"[rng() % 4];
+  std::vector<std::string> references(2);
+  for (std::string &reference : references)
+    while (reference.size() < 100000) {
+      if (rng() % 3 == 0)
+        reference += units[rng() % units.size()];
+      else
+        for (unsigned i = 0; i < 300; ++i)
+          reference += "ACGT"[rng() % 4];
+    }
+  std::vector<const char *> reference_sequences;
+  std::vector<unsigned int> ref_seq_sizes;
+  for (const std::string &reference : references) {
+    reference_sequences.push_back(reference.c_str());
+    ref_seq_sizes.push_back((unsigned int)reference.size());
+  }
+
+  crimson::MinimizerIndex<std::uint32_t> unfiltered(reference_sequences,
+                                                    ref_seq_sizes, 11, 5);
+  std::map<std::uint32_t, size_t> counts;
+  for (auto &i : crimson::Minimize(references[0].c_str(), ref_seq_sizes[0], 11,
+                                   5))
+    ++counts[std::get<0>(i)];
+  for (auto &i : crimson::Minimize(references[1].c_str(), ref_seq_sizes[1], 11,
+                                   5))
+    ++counts[std::get<0>(i)];
+  // most frequent minimizers first, larger k-mers first on ties
+  std::vector<std::pair<size_t, std::uint32_t>> byCount;
+  for (auto &i : counts)
+    byCount.push_back({i.second, i.first});
+  std::sort(byCount.rbegin(), byCount.rend());
+
+  for (crimson::IndexFilter filter : {crimson::IndexFilter{0.01, 0},
+                                      crimson::IndexFilter{0.0, 20},
+                                      crimson::IndexFilter{0.002, 5}}) {
+    crimson::MinimizerIndex<std::uint32_t> built(
+        reference_sequences, ref_seq_sizes, 11, 5, 3, filter);
+    crimson::MinimizerIndex<std::uint32_t> filtered(reference_sequences,
+                                                    ref_seq_sizes, 11, 5);
+    filtered.Filter(filter);
+
+    size_t removed = 0;
+    while (double(removed) < filter.frequency * double(counts.size() - removed))
+      ++removed;
+    for (size_t i = 0; i < byCount.size(); ++i) {
+      bool dropped = i < removed || (filter.max_occurrences != 0 &&
+                                     byCount[i].first > filter.max_occurrences);
+      EXPECT_EQ(built.Query(byCount[i].second).size(),
+                dropped ? 0u : byCount[i].first);
+    }
+
+    // filtering a built index gives the same index as filtering at build
+    std::ostringstream builtOut, filteredOut;
+    built.Write(builtOut);
+    filtered.Write(filteredOut);
+    EXPECT_EQ(builtOut.str(), filteredOut.str());
+  }
+  EXPECT_EQ(unfiltered.num_minimizers(), counts.size());
+}
+
+TEST_F(MinimizeTest, IndexView) {
+  std::mt19937 rng(23);
+  std::string reference(5000, 'A');
+  for (char &c : reference)
+    c = "ACGT"[rng() % 4];
+  std::vector<const char *> reference_sequences = {reference.c_str()};
+  std::vector<unsigned int> ref_seq_sizes = {(unsigned int)reference.size()};
+  crimson::MinimizerIndex<std::uint32_t> index(reference_sequences,
+                                               ref_seq_sizes, 11, 5);
+  std::ostringstream out;
+  index.Write(out);
+  const std::string written = out.str();
+
+  // views need aligned data, which is then checked once
+  std::vector<std::uint64_t> storage;
+  auto view = [&storage](const std::string &data) {
+    storage.assign(data.size() / sizeof(std::uint64_t) + 1, 0);
+    std::memcpy(storage.data(), data.data(), data.size());
+    return crimson::MinimizerIndex<std::uint32_t>::View(
+        reinterpret_cast<const char *>(storage.data()), data.size());
+  };
+  crimson::MinimizerIndex<std::uint32_t> viewed = view(written);
+  EXPECT_EQ(viewed.num_minimizers(), index.num_minimizers());
+
+  // the layout is four 32-bit fields followed by the 64-bit references,
+  // minimizers, buckets and entries, and the buckets follow it
+  const size_t layoutBytes = 16 + 4 * sizeof(std::uint64_t);
+  const size_t bucketBytes = 3 * sizeof(std::uint32_t);
+  std::uint64_t buckets, entries;
+  std::memcpy(&buckets, written.data() + 32, sizeof(buckets));
+  std::memcpy(&entries, written.data() + 40, sizeof(entries));
+
+  std::string corrupted = written;
+  std::memset(&corrupted[32], 0, sizeof(std::uint64_t));
+  EXPECT_THROW(view(corrupted), std::invalid_argument);
+
+  // a bucket reaching past the entries
+  size_t used = layoutBytes;
+  for (std::uint32_t count = 0; count == 0; used += bucketBytes)
+    std::memcpy(&count, written.data() + used + 8, sizeof(count));
+  used -= bucketBytes;
+  corrupted = written;
+  std::uint32_t past = static_cast<std::uint32_t>(entries);
+  std::memcpy(&corrupted[used + 4], &past, sizeof(past));
+  EXPECT_THROW(view(corrupted), std::invalid_argument);
+
+  // a table without empty buckets, where lookups would never stop
+  corrupted = written;
+  for (std::uint64_t i = 0; i < buckets; ++i) {
+    char *bucket = &corrupted[layoutBytes + i * bucketBytes];
+    std::uint32_t begin = 0, count = 1;
+    std::memcpy(bucket + 4, &begin, sizeof(begin));
+    std::memcpy(bucket + 8, &count, sizeof(count));
+  }
+  EXPECT_THROW(view(corrupted), std::invalid_argument);
+}
+
+TEST_F(MinimizeTest, MapThreads) {
+  // long homopolymers and tandem repeats make chunks of a reference start
+  // out of phase with the sequential minimizer emission
+  std::mt19937 rng(13);
+  std::vector<std::string> references(3);
+  for (std::string &reference : references) {
+    while (reference.size() < 300000) {
+      std::string unit;
+      for (unsigned i = 0, len = 1 + (unsigned)(rng() % 4); i < len; ++i)
+        unit += "ACGT"[rng() % 4];
+      for (unsigned i = 0, cnt = (unsigned)(rng() % 2000); i < cnt; ++i)
+        reference += rng() % 8 ? unit : std::string(1, "ACGT"[rng() % 4]);
+    }
+  }
+  std::vector<const char *> reference_sequences;
+  std::vector<unsigned int> ref_seq_sizes;
+  for (const std::string &reference : references) {
+    reference_sequences.push_back(reference.c_str());
+    ref_seq_sizes.push_back((unsigned int)reference.size());
+  }
+
+  std::vector<std::vector<crimson::Overlap>> expected;
+  for (unsigned threads : {1u, 8u}) {
+    crimson::Minimize(reference_sequences, ref_seq_sizes, 9, 7, threads);
+    crimson::Filter(0.05);
+    for (unsigned i = 0; i < 30; ++i) {
+      const std::string &reference = references[i % references.size()];
+      std::string query = reference.substr(i * 9000, 2000);
+      auto overlaps =
+          crimson::Map(query.c_str(), (unsigned int)query.size());
+      if (threads == 1) {
+        expected.push_back(overlaps);
+        continue;
+      }
+      ASSERT_EQ(overlaps.size(), expected[i].size());
+      for (unsigned j = 0; j < overlaps.size(); ++j) {
+        EXPECT_EQ(overlaps[j].reference_index,
+                  expected[i][j].reference_index);
+        EXPECT_EQ(overlaps[j].reference_pos, expected[i][j].reference_pos);
+        EXPECT_EQ(overlaps[j].query_pos, expected[i][j].query_pos);
+      }
+    }
+    crimson::ResetData();
+  }
+}
+
 TEST_F(MinimizeTest, Map) {
   for (mapTestArgs i : mapTests) {
     std::vector<unsigned int> ref_seq_sizes;
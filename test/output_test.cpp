@@ -0,0 +1,208 @@
+#include "crimson_output.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+class OutputTest : public ::testing::Test {
+protected:
+  // Decompresses concatenated gzip members, as gzip does
+  static std::string Gunzip(const std::string &data) {
+    std::string ret;
+    z_stream stream = {};
+    EXPECT_EQ(inflateInit2(&stream, 16 + MAX_WBITS), Z_OK);
+    stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    char buffer[1 << 16];
+    while (stream.avail_in > 0) {
+      stream.next_out = reinterpret_cast<Bytef *>(buffer);
+      stream.avail_out = sizeof(buffer);
+      int status = inflate(&stream, Z_NO_FLUSH);
+      EXPECT_TRUE(status == Z_OK || status == Z_STREAM_END) << status;
+      ret.append(buffer, sizeof(buffer) - stream.avail_out);
+      if (status == Z_STREAM_END)
+        inflateReset(&stream);
+      else if (status != Z_OK)
+        break;
+    }
+    inflateEnd(&stream);
+    return ret;
+  }
+
+  // Sizes of the BGZF blocks data consists of, empty if it does not
+  static std::vector<size_t> BlockSizes(const std::string &data) {
+    std::vector<size_t> ret;
+    for (size_t i = 0; i < data.size();) {
+      const auto *block = reinterpret_cast<const unsigned char *>(&data[i]);
+      if (data.size() - i < 28 || block[0] != 31 || block[1] != 139 ||
+          block[3] != 4 || block[12] != 'B' || block[13] != 'C')
+        return {};
+      ret.push_back(size_t(block[16]) + 256 * size_t(block[17]) + 1);
+      i += ret.back();
+    }
+    return ret;
+  }
+};
+
+TEST_F(OutputTest, AppendInt) {
+  std::string out = "x";
+  crimson::AppendInt(out, 0);
+  crimson::AppendInt(out, -17);
+  crimson::AppendInt(out, std::numeric_limits<std::uint64_t>::max());
+  EXPECT_EQ(out, "x0-1718446744073709551615");
+}
+
+TEST_F(OutputTest, Cigar) {
+  crimson::CigarLengths lengths = crimson::MeasureCigar("3M2I10M1D4M");
+  EXPECT_EQ(lengths.query, 19u);
+  EXPECT_EQ(lengths.target, 18u);
+  EXPECT_EQ(lengths.matches, 17u);
+  EXPECT_EQ(lengths.columns, 20u);
+
+  // one mismatch, two inserted and one deleted base
+  unsigned int mismatches = 0;
+  EXPECT_EQ(crimson::CigarEditDistance("2M2I3M1D2M", "ACTTGTCGC", "ACGTAAGC",
+                                       &mismatches),
+            4u);
+  EXPECT_EQ(mismatches, 1u);
+  EXPECT_EQ(crimson::CigarEditDistance("", "", ""), 0u);
+}
+
+TEST_F(OutputTest, Paf) {
+  crimson::PafRecord record;
+  record.query_name = "read1";
+  record.query_len = 1000;
+  record.query_begin = 10;
+  record.query_end = 990;
+  record.is_reverse = true;
+  record.target_name = "chr1";
+  record.target_len = 5000000000ull;
+  record.target_begin = 123;
+  record.target_end = 1100;
+  record.matches = 950;
+  record.block_len = 990;
+  record.mapq = 60;
+  record.type = 'P';
+  record.score = -3;
+  std::string out;
+  crimson::AppendPaf(record, out);
+  EXPECT_EQ(out, "read1\t1000\t10\t990\t-\tchr1\t5000000000\t123\t1100\t950\t"
+                 "990\t60\ttp:A:P\ts1:i:-3\n");
+
+  record.is_reverse = false;
+  record.edit_distance = 40;
+  record.cigar = "980M";
+  out.clear();
+  crimson::AppendPaf(record, out);
+  EXPECT_EQ(out, "read1\t1000\t10\t990\t+\tchr1\t5000000000\t123\t1100\t950\t"
+                 "990\t60\ttp:A:P\ts1:i:-3\tNM:i:40\tcg:Z:980M\n");
+}
+
+TEST_F(OutputTest, Sam) {
+  std::string out;
+  crimson::AppendSamHeader({"chr1 first", "chr2"}, {100, 2000}, "1.2.3",
+                           "mapper ref.fa reads.fq", out);
+  EXPECT_EQ(out, "@HD\tVN:1.6\tSO:unsorted\tGO:query\n"
+                 "@SQ\tSN:chr1\tLN:100\n"
+                 "@SQ\tSN:chr2\tLN:2000\n"
+                 "@PG\tID:crimson_mapper\tPN:crimson_mapper\tVN:1.2.3\t"
+                 "CL:mapper ref.fa reads.fq\n");
+
+  crimson::SamRecord record;
+  record.query_name = "read1 runid=7";
+  record.flag = crimson::kSamReverse | crimson::kSamSupplementary;
+  record.target_name = "chr2";
+  record.position = 99;
+  record.mapq = 17;
+  record.clip_begin = 2;
+  record.cigar = "3M1I";
+  record.clip_end = 1;
+  record.sequence = "ACGTACG";
+  record.quality = "!!!!!!!";
+  record.edit_distance = 1;
+  record.type = 'P';
+  record.score = 44;
+  out.clear();
+  crimson::AppendSam(record, out);
+  EXPECT_EQ(out, "read1\t2064\tchr2\t100\t17\t2S3M1I1S\t*\t0\t0\tACGTACG\t"
+                 "!!!!!!!\tNM:i:1\ttp:A:P\ts1:i:44\n");
+
+  // secondary lines leave out the sequence, and FASTA has no qualities
+  record.flag = crimson::kSamSecondary;
+  record.sequence = {};
+  out.clear();
+  crimson::AppendSam(record, out);
+  EXPECT_EQ(out, "read1\t256\tchr2\t100\t17\t2S3M1I1S\t*\t0\t0\t*\t*\t"
+                 "NM:i:1\ttp:A:P\ts1:i:44\n");
+
+  crimson::SamRecord unmapped;
+  unmapped.query_name = "read2";
+  unmapped.flag = crimson::kSamUnmapped;
+  unmapped.sequence = "ACGT";
+  out.clear();
+  crimson::AppendSam(unmapped, out);
+  EXPECT_EQ(out, "read2\t4\t*\t0\t0\t*\t*\t0\t0\tACGT\t*\n");
+}
+
+TEST_F(OutputTest, Bgzf) {
+  std::mt19937 rng(5);
+  // compressible lines and random bytes, which do not compress
+  std::string text, noise(200000, '\0');
+  for (unsigned i = 0; i < 20000; ++i)
+    text += "read" + std::to_string(i) + "\t1000\t+\tchr1\t" +
+            std::to_string(rng() % 100000) + "\n";
+  for (char &c : noise)
+    c = static_cast<char>(rng());
+
+  for (const std::string *data : {&text, &noise}) {
+    // pieces compressed apart and concatenated are one BGZF file
+    std::string compressed;
+    size_t half = data->size() / 2;
+    crimson::AppendBgzf(std::string_view(*data).substr(0, half), compressed);
+    crimson::AppendBgzf(std::string_view(*data).substr(half), compressed, 1);
+    crimson::AppendBgzfEof(compressed);
+
+    std::vector<size_t> sizes = BlockSizes(compressed);
+    ASSERT_FALSE(sizes.empty());
+    for (size_t i : sizes)
+      EXPECT_LE(i, 65536u);
+    EXPECT_EQ(sizes.back(), 28u);
+    EXPECT_EQ(Gunzip(compressed), *data);
+  }
+
+  std::string empty;
+  crimson::AppendBgzf("", empty);
+  EXPECT_TRUE(empty.empty());
+}
+
+TEST_F(OutputTest, Writer) {
+  std::FILE *file = std::tmpfile();
+  ASSERT_NE(file, nullptr);
+  std::string expected;
+  {
+    crimson::OutputWriter writer(file, true);
+    std::string piece;
+    for (unsigned i = 0; i < 300; ++i) {
+      std::string line(1 + i * 37 % 20000, char('a' + i % 26));
+      expected += line;
+      piece.clear();
+      crimson::AppendBgzf(line, piece);
+      writer.Write(piece);
+    }
+    writer.Close();
+  }
+
+  std::string written;
+  std::rewind(file);
+  char buffer[4096];
+  for (size_t len; (len = std::fread(buffer, 1, sizeof(buffer), file)) > 0;)
+    written.append(buffer, len);
+  std::fclose(file);
+  EXPECT_FALSE(BlockSizes(written).empty());
+  EXPECT_EQ(Gunzip(written), expected);
+}
@@ -0,0 +1,136 @@
+#include "crimson_minimizer_engine.hpp"
+#include "crimson_packed_sequence.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+class PackedSequenceTest : public ::testing::Test {
+protected:
+  std::mt19937 rng{3};
+
+  // Random sequence of both cases with runs of N and other characters
+  std::string RandomSequence(size_t len) {
+    std::string ret(len, 'A');
+    for (char &c : ret)
+      c = "ACGTacgt"[rng() % 8];
+    for (size_t i = 0; i < len / 50; ++i) {
+      size_t begin = rng() % len;
+      size_t runLen = std::min<size_t>(1 + rng() % 20, len - begin);
+      ret.replace(begin, runLen, runLen, "NnRY-"[rng() % 5]);
+    }
+    return ret;
+  }
+
+  // The text unpacked sequences should have
+  static std::string Unpacked(const std::string &sequence) {
+    std::string ret;
+    for (char c : sequence) {
+      char upper = static_cast<char>(std::toupper(c));
+      ret += upper == 'A' || upper == 'C' || upper == 'G' || upper == 'T'
+                 ? upper
+                 : 'N';
+    }
+    return ret;
+  }
+};
+
+TEST_F(PackedSequenceTest, Unpack) {
+  for (size_t len : {0, 1, 3, 4, 5, 17, 1000, 4099}) {
+    std::string sequence = RandomSequence(len);
+    std::string expected = Unpacked(sequence);
+    crimson::PackedSequence packed(sequence);
+    ASSERT_EQ(packed.size(), len);
+    EXPECT_EQ(packed.empty(), len == 0);
+    EXPECT_GE(packed.capacity(), (len + 3) / 4);
+
+    std::string text = "prefix";
+    packed.Unpack(0, len, text);
+    EXPECT_EQ(text, "prefix" + expected);
+
+    // random slices, which start and end at any offset within a byte
+    for (unsigned t = 0; t < 50 && len > 0; ++t) {
+      size_t begin = rng() % len;
+      size_t end = begin + rng() % (len - begin + 1);
+      text.clear();
+      packed.Unpack(begin, end, text);
+      EXPECT_EQ(text, expected.substr(begin, end - begin));
+    }
+  }
+}
+
+TEST_F(PackedSequenceTest, Runs) {
+  crimson::PackedSequence packed("NNACnRYGTN-");
+  ASSERT_EQ(packed.num_runs(), 3u);
+  EXPECT_EQ(packed.runs()[0].begin, 0u);
+  EXPECT_EQ(packed.runs()[0].len, 2u);
+  EXPECT_EQ(packed.runs()[1].begin, 4u);
+  EXPECT_EQ(packed.runs()[1].len, 3u);
+  EXPECT_EQ(packed.runs()[2].begin, 9u);
+  EXPECT_EQ(packed.runs()[2].len, 2u);
+
+  crimson::PackedSequence bases("ACGTacgt");
+  EXPECT_EQ(bases.num_runs(), 0u);
+  for (size_t i = 0; i < bases.size(); ++i)
+    EXPECT_EQ(bases.code(i), i % 4);
+}
+
+TEST_F(PackedSequenceTest, Cursor) {
+  std::string sequence = RandomSequence(3000);
+  std::string expected = Unpacked(sequence);
+  crimson::PackedSequence packed(sequence);
+  for (size_t pos : {0, 1, 2, 3, 4, 1001, 2999, 3000}) {
+    crimson::PackedSequence::Cursor cursor(packed, pos);
+    for (size_t i = pos; i < expected.size(); ++i) {
+      unsigned char code = cursor.Next();
+      if (expected[i] == 'N')
+        ASSERT_EQ(code, crimson::kPackedN) << i;
+      else
+        ASSERT_EQ("ACGT"[code], expected[i]) << i;
+    }
+  }
+}
+
+TEST_F(PackedSequenceTest, View) {
+  // the second of two sequences packed back to back, which starts within a
+  // byte, as in index files
+  std::string first = RandomSequence(13), second = RandomSequence(2001);
+  crimson::PackedSequence whole(first + second);
+  crimson::PackedSequence tail(second);
+
+  std::vector<std::uint8_t> bases((first.size() + second.size() + 3) / 4);
+  for (size_t i = 0; i < whole.size(); ++i)
+    bases[i / 4] = static_cast<std::uint8_t>(bases[i / 4] |
+                                             whole.code(i) << (2 * (i % 4)));
+
+  crimson::PackedSequence view = crimson::PackedSequence::View(
+      bases.data(), first.size(), second.size(), tail.runs(), tail.num_runs());
+  EXPECT_EQ(view.capacity(), 0u);
+  std::string text;
+  view.Unpack(0, view.size(), text);
+  EXPECT_EQ(text, Unpacked(second));
+  for (size_t i = 0; i < view.size(); ++i)
+    EXPECT_EQ(view.code(i), tail.code(i));
+
+  crimson::PackedSequence moved = std::move(view);
+  text.clear();
+  moved.Unpack(5, 9, text);
+  EXPECT_EQ(text, Unpacked(second).substr(5, 4));
+}
+
+TEST_F(PackedSequenceTest, Minimize) {
+  // packed sequences have the minimizers of their text
+  for (unsigned t = 0; t < 50; ++t) {
+    std::string sequence = RandomSequence(rng() % 500);
+    unsigned kmer_len = 1 + (unsigned)(rng() % 15);
+    unsigned window_len = 1 + (unsigned)(rng() % 10);
+    crimson::PackedSequence packed(sequence);
+    EXPECT_EQ(crimson::Minimize(packed, kmer_len, window_len),
+              crimson::Minimize(sequence.c_str(),
+                                (unsigned int)sequence.size(), kmer_len,
+                                window_len));
+  }
+}
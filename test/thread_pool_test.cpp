@@ -0,0 +1,65 @@
+#include "crimson_thread_pool.hpp"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(ThreadPoolTest, Results) {
+  crimson::ThreadPool pool(4);
+  std::vector<std::future<unsigned>> results;
+  for (unsigned i = 0; i < 1000; ++i)
+    results.push_back(pool.Submit([](unsigned x) { return x * x; }, i));
+  for (unsigned i = 0; i < 1000; ++i)
+    EXPECT_EQ(results[i].get(), i * i);
+}
+
+TEST(ThreadPoolTest, NestedSubmit) {
+  std::atomic<unsigned> done(0);
+  {
+    crimson::ThreadPool pool(3);
+    for (unsigned i = 0; i < 100; ++i) {
+      pool.Submit([&pool, &done]() {
+        for (unsigned j = 0; j < 10; ++j)
+          pool.Submit([&done]() { ++done; });
+      });
+    }
+  }
+  EXPECT_EQ(done.load(), 1000u);
+}
+
+TEST(ThreadPoolTest, Exception) {
+  crimson::ThreadPool pool(2);
+  auto result = pool.Submit([]() -> int { throw std::runtime_error("x"); });
+  EXPECT_THROW(result.get(), std::runtime_error);
+  EXPECT_EQ(pool.Submit([]() { return 7; }).get(), 7);
+}
+
+TEST(BoundedQueueTest, ProducerConsumer) {
+  crimson::BoundedQueue<std::unique_ptr<unsigned>> queue(2);
+  std::thread producer([&queue]() {
+    for (unsigned i = 0; i < 1000; ++i)
+      queue.Push(std::make_unique<unsigned>(i));
+    queue.Close();
+  });
+  std::unique_ptr<unsigned> item;
+  unsigned expected = 0;
+  while (queue.Pop(&item))
+    EXPECT_EQ(*item, expected++);
+  producer.join();
+  EXPECT_EQ(expected, 1000u);
+  EXPECT_FALSE(queue.Push(std::make_unique<unsigned>(0)));
+}
+
+TEST(BoundedQueueTest, CloseWakesProducer) {
+  crimson::BoundedQueue<unsigned> queue(1);
+  ASSERT_TRUE(queue.Push(1));
+  std::thread producer([&queue]() { EXPECT_FALSE(queue.Push(2)); });
+  queue.Close();
+  producer.join();
+  unsigned item = 0;
+  EXPECT_TRUE(queue.Pop(&item));
+  EXPECT_EQ(item, 1u);
+  EXPECT_FALSE(queue.Pop(&item));
+}